@@ -0,0 +1,39 @@
+#version 330
+
+// Resolves the multisampled scene and adds the last bloom upsample to it
+
+uniform sampler2DMS u_SceneSampler;
+uniform sampler2D u_BloomSampler;
+uniform int u_SampleCount;
+uniform vec2 u_BloomTexelSize;
+uniform float u_Radius;
+uniform float u_Intensity;
+
+smooth in vec2 v_uv;
+
+out vec4 BlendUnitColor;
+
+void main()
+{
+  ivec2 size = textureSize(u_SceneSampler);
+  ivec2 coord = min(ivec2(v_uv * vec2(size)), size - 1);
+  vec4 scene = vec4(0.0f);
+  for (int i = 0; i < u_SampleCount; i++)
+    {
+      scene += texelFetch(u_SceneSampler, coord, i);
+    }
+  scene /= float(u_SampleCount);
+
+  vec2 t = u_BloomTexelSize * u_Radius;
+  vec4 bloom = texture(u_BloomSampler, v_uv)*4.0f;
+  bloom += (texture(u_BloomSampler, v_uv + t*vec2( 0, 1)) +
+            texture(u_BloomSampler, v_uv + t*vec2(-1, 0)) +
+            texture(u_BloomSampler, v_uv + t*vec2( 1, 0)) +
+            texture(u_BloomSampler, v_uv + t*vec2( 0,-1)))*2.0f;
+  bloom += texture(u_BloomSampler, v_uv + t*vec2(-1, 1)) +
+           texture(u_BloomSampler, v_uv + t*vec2( 1, 1)) +
+           texture(u_BloomSampler, v_uv + t*vec2(-1,-1)) +
+           texture(u_BloomSampler, v_uv + t*vec2( 1,-1));
+
+  BlendUnitColor = scene + (bloom / 16.0f) * u_Intensity;
+}
@@ -0,0 +1,31 @@
+#version 330
+
+// 13 taps in 4 overlapping boxes around the center, the bilinear
+// filtering does the rest
+
+uniform sampler2D u_Sampler;
+uniform vec2 u_TexelSize;
+
+smooth in vec2 v_uv;
+
+out vec4 BlendUnitColor;
+
+void main()
+{
+  vec2 t = u_TexelSize;
+  vec4 a = texture(u_Sampler, v_uv + t*vec2(-2, 2));
+  vec4 b = texture(u_Sampler, v_uv + t*vec2( 0, 2));
+  vec4 c = texture(u_Sampler, v_uv + t*vec2( 2, 2));
+  vec4 d = texture(u_Sampler, v_uv + t*vec2(-2, 0));
+  vec4 e = texture(u_Sampler, v_uv);
+  vec4 f = texture(u_Sampler, v_uv + t*vec2( 2, 0));
+  vec4 g = texture(u_Sampler, v_uv + t*vec2(-2,-2));
+  vec4 h = texture(u_Sampler, v_uv + t*vec2( 0,-2));
+  vec4 i = texture(u_Sampler, v_uv + t*vec2( 2,-2));
+  vec4 j = texture(u_Sampler, v_uv + t*vec2(-1, 1));
+  vec4 k = texture(u_Sampler, v_uv + t*vec2( 1, 1));
+  vec4 l = texture(u_Sampler, v_uv + t*vec2(-1,-1));
+  vec4 m = texture(u_Sampler, v_uv + t*vec2( 1,-1));
+
+  BlendUnitColor = e*0.125f + (a + c + g + i)*0.03125f + (b + d + f + h)*0.0625f + (j + k + l + m)*0.125f;
+}
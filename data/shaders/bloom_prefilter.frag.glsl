@@ -0,0 +1,35 @@
+#version 330
+
+// Resolves the multisampled emit buffer, thresholds it and downsamples
+// it to the first bloom level in one pass
+
+uniform sampler2DMS u_EmitSampler;
+uniform int u_SampleCount;
+uniform int u_Downscale;
+uniform float u_Threshold;
+
+smooth in vec2 v_uv;
+
+out vec4 BlendUnitColor;
+
+void main()
+{
+  ivec2 size = textureSize(u_EmitSampler);
+  ivec2 base = ivec2(gl_FragCoord.xy) * u_Downscale;
+  vec4 sum = vec4(0.0f);
+  for (int y = 0; y < u_Downscale; y++)
+    {
+      for (int x = 0; x < u_Downscale; x++)
+        {
+          ivec2 coord = min(base + ivec2(x, y), size - 1);
+          for (int i = 0; i < u_SampleCount; i++)
+            {
+              sum += texelFetch(u_EmitSampler, coord, i);
+            }
+        }
+    }
+  vec4 color = sum / float(u_Downscale*u_Downscale*u_SampleCount);
+
+  float brightness = max(color.r, max(color.g, color.b));
+  BlendUnitColor = color * (max(brightness - u_Threshold, 0.0f) / max(brightness, 0.0001f));
+}
@@ -0,0 +1,26 @@
+#version 330
+
+// 3x3 tent filter, the result is added to the level above
+
+uniform sampler2D u_Sampler;
+uniform vec2 u_TexelSize;
+uniform float u_Radius;
+
+smooth in vec2 v_uv;
+
+out vec4 BlendUnitColor;
+
+void main()
+{
+  vec2 t = u_TexelSize * u_Radius;
+  vec4 sum = texture(u_Sampler, v_uv)*4.0f;
+  sum += (texture(u_Sampler, v_uv + t*vec2( 0, 1)) +
+          texture(u_Sampler, v_uv + t*vec2(-1, 0)) +
+          texture(u_Sampler, v_uv + t*vec2( 1, 0)) +
+          texture(u_Sampler, v_uv + t*vec2( 0,-1)))*2.0f;
+  sum += texture(u_Sampler, v_uv + t*vec2(-1, 1)) +
+         texture(u_Sampler, v_uv + t*vec2( 1, 1)) +
+         texture(u_Sampler, v_uv + t*vec2(-1,-1)) +
+         texture(u_Sampler, v_uv + t*vec2( 1,-1));
+  BlendUnitColor = sum / 16.0f;
+}
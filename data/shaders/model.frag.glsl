@@ -11,18 +11,41 @@
 #define LightIntensity 1.0f
 #define M_PI 3.1415926535897932384626433832795
 
+layout (std140) uniform FrameUniforms {
+  mat4  u_ProjectionView;
+  vec4  u_FogColor;
+  vec4  u_ExplosionLightColor;
+  vec3  u_CamPos;
+  float u_FogStart;
+  float u_FogEnd;
+  float u_BendRadius;
+  float u_RoadTangentPoint;
+  float u_ExplosionLightTimer;
+};
+
+layout (std140) uniform MaterialUniforms {
+  vec4  u_DiffuseColor;
+  vec4  u_SpecularColor;
+  vec4  u_EmissiveColor;
+  vec2  u_UvScale;
+  float u_TexWeight;
+  float u_FogWeight;
+  float u_Emission;
+  float u_Shininess;
+  int   u_MaterialFlags;
+};
+
 uniform sampler2D u_Sampler;
-uniform vec4 u_DiffuseColor;
-uniform float u_Emission;
-uniform float u_TexWeight;
-uniform float u_FogWeight;
-uniform vec2 u_UvScale;
-uniform vec4 u_ExplosionLightColor;
-uniform float u_ExplosionLightTimer;
-uniform vec3 u_CamPos;
-uniform vec4 u_FogColor;
-uniform float u_FogStart;
-uniform float u_FogEnd;
+
+#ifdef INSTANCED
+flat in vec4 v_DiffuseColor;
+flat in float v_Emission;
+#define DIFFUSE_COLOR v_DiffuseColor
+#define EMISSION v_Emission
+#else
+#define DIFFUSE_COLOR u_DiffuseColor
+#define EMISSION u_Emission
+#endif
 
 #ifdef A_UV
 smooth in vec2  v_Uv;
@@ -52,7 +75,7 @@ void main() {
   color *= v_Color;
 #endif
 
-  color *= u_DiffuseColor;
+  color *= DIFFUSE_COLOR;
 
   vec4 Lighting = LightColor * AmbientLight;
   Lighting += LightColor * clamp(dot(-vec3(0, 0, -1), v_Normal), 0, 1) * LightIntensity;
@@ -67,7 +90,7 @@ void main() {
   fog = clamp(fog, 0.0, 1.0);
 
   color = mix(color, u_FogColor, (1.0 - fog) * u_FogWeight);
-  vec4 Emit = (color * u_Emission);
+  vec4 Emit = (color * EMISSION);
   BlendUnitColor[0] = color;
   BlendUnitColor[1] = Emit;
 }
@@ -20,12 +20,40 @@ layout (location = A_COLOR) in vec4  a_Color;
 
 layout (location = A_NORMAL) in vec3  a_Normal;
 
-uniform mat4 u_ProjectionView;
+layout (std140) uniform FrameUniforms {
+  mat4  u_ProjectionView;
+  vec4  u_FogColor;
+  vec4  u_ExplosionLightColor;
+  vec3  u_CamPos;
+  float u_FogStart;
+  float u_FogEnd;
+  float u_BendRadius;
+  float u_RoadTangentPoint;
+  float u_ExplosionLightTimer;
+};
+
+layout (std140) uniform MaterialUniforms {
+  vec4  u_DiffuseColor;
+  vec4  u_SpecularColor;
+  vec4  u_EmissiveColor;
+  vec2  u_UvScale;
+  float u_TexWeight;
+  float u_FogWeight;
+  float u_Emission;
+  float u_Shininess;
+  int   u_MaterialFlags;
+};
+
+#ifdef INSTANCED
+layout (location = A_INSTANCE_TRANSFORM) in mat4 a_InstanceTransform;
+layout (location = A_INSTANCE_COLOR) in vec4 a_InstanceColor;
+layout (location = A_INSTANCE_EMISSION) in float a_InstanceEmission;
+flat out vec4 v_DiffuseColor;
+flat out float v_Emission;
+#else
 uniform mat4 u_Transform;
+#endif
 uniform mat4 u_NormalTransform;
-uniform int  u_MaterialFlags;
-uniform float u_BendRadius;
-uniform float u_RoadTangentPoint;
 
 #ifdef A_UV
 smooth out vec2 v_Uv;
@@ -62,8 +90,16 @@ vec3 WorldToRenderTransform(in vec3 pos) {
 }
 
 void main() {
-  mat4 transformMatrix = u_Transform;
-  vec3 transformPos = u_Transform[3].xyz;
+#ifdef INSTANCED
+  mat4 modelTransform = a_InstanceTransform;
+  v_DiffuseColor = a_InstanceColor;
+  v_Emission = a_InstanceEmission;
+#else
+  mat4 modelTransform = u_Transform;
+#endif
+
+  mat4 transformMatrix = modelTransform;
+  vec3 transformPos = modelTransform[3].xyz;
   if ((u_MaterialFlags & MaterialFlag_TransformUniform) > 0)
   {
     transformMatrix[3] = vec4(WorldToRenderTransform(transformPos), 1.0);
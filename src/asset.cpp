@@ -998,7 +998,17 @@ LoadAssetThreadUnsafePart(asset_entry *Entry)
     {
         auto *Param = (shader_asset_param *)Entry->Param;
         GLuint Result = Entry->Shader.Result;
-        CompileShader(Result, Entry->Shader.Source);
+        if (Param->Defines.empty())
+        {
+            CompileShader(Result, Entry->Shader.Source);
+        }
+        else
+        {
+            std::string source = Entry->Shader.Source;
+            size_t versionEnd = source.find('\n');
+            source.insert(versionEnd == std::string::npos ? 0 : versionEnd + 1, Param->Defines);
+            CompileShader(Result, source.c_str());
+        }
         if (Param->Type == GL_VERTEX_SHADER)
         {
             Param->ShaderProgram->VertexShader = Result;
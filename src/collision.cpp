@@ -2,20 +2,61 @@
 
 #include "collision.h"
 
-static void UpdateEntityBounds(entity *ent)
+#define COLLIDER_SLEEP_FRAMES 30
+
+// bitwise so a -0 is a change too, the box would differ
+inline static bool SameVec(const vec3 &a, const vec3 &b)
 {
-    // TODO: this is not good
-    if (ent->Model)
+    return memcmp(&a, &b, sizeof(vec3)) == 0;
+}
+
+// Only entities with a model have their bounds built from the transform
+inline static bool BoundsChanged(entity *ent)
+{
+    if (!ent->Model)
     {
-        ent->Collider->Box = BoundsFromMinMax(ent->Model->Mesh->Min*ent->Scl()*ent->Collider->Scale,
-                                              ent->Model->Mesh->Max*ent->Scl()*ent->Collider->Scale);
-        ent->Collider->Box.Center += ent->Transform.Position;
+        return false;
     }
-    else
+
+    auto *col = ent->Collider;
+    return ent->Model->Mesh != col->BoundsMesh ||
+        !SameVec(ent->Transform.Position, col->BoundsPosition) ||
+        !SameVec(ent->Transform.Scale, col->BoundsScale) ||
+        !SameVec(col->Scale, col->BoundsColliderScale);
+}
+
+// Returns true if the box was rebuilt
+static bool UpdateEntityBounds(entity *ent, collision_stats &stats)
+{
+    // TODO: this is not good
+    if (!ent->Model)
     {
         //ent->Bounds->Center = ent->Position;
         //ent->Bounds->Half = ent->Size*0.5f;
+        return false;
     }
+
+    auto *col = ent->Collider;
+    auto *mesh = ent->Model->Mesh;
+    if (mesh != col->BoundsMesh || !SameVec(ent->Scl(), col->BoundsScale) || !SameVec(col->Scale, col->BoundsColliderScale))
+    {
+        col->LocalBox = BoundsFromMinMax(mesh->Min*ent->Scl()*col->Scale,
+                                         mesh->Max*ent->Scl()*col->Scale);
+        col->BoundsMesh = mesh;
+        col->BoundsScale = ent->Scl();
+        col->BoundsColliderScale = col->Scale;
+        stats.NumLocalUpdates++;
+    }
+    else if (SameVec(ent->Pos(), col->BoundsPosition))
+    {
+        return false;
+    }
+
+    col->Box = col->LocalBox;
+    col->Box.Center += ent->Transform.Position;
+    col->BoundsPosition = ent->Transform.Position;
+    stats.NumBoxUpdates++;
+    return true;
 }
 
 inline static void
@@ -39,99 +80,1081 @@ ApplyCorrection(entity *Entity, vec3 Correction)
 }
 
 #define ClimbHeight 0.26f
-void DetectCollisions(const std::vector<entity *> &activeEntities, const std::vector<entity *> &passiveEntities, std::vector<collision_result> &collisions, size_t *numCollisions)
+inline static bool TestBoxCollision(const bounding_box &First, const bounding_box &Second, collision_result &col)
 {
-    // The entities' bounding boxes only get updated in the integration
-    // phase, which happens after the collision detection so we need
-    // to skip the first frame
-    static bool FirstFrame = true;
-    if (FirstFrame)
+    vec3 Dif = Second.Center - First.Center;
+    float dx = First.Half.x + Second.Half.x - std::abs(Dif.x);
+    if (dx <= 0)
     {
-        FirstFrame = false;
+        return false;
+    }
+
+    float dy = First.Half.y + Second.Half.y - std::abs(Dif.y);
+    if (dy <= 0)
+    {
+        return false;
+    }
+
+    float dz = First.Half.z + Second.Half.z - std::abs(Dif.z);
+    if (dz <= 0)
+    {
+        return false;
+    }
+
+    // At this point we have a collision
+    col.Normal = vec3(0.0f);
+    if (dx < dy && dy > ClimbHeight)
+    {
+        col.Normal.x = std::copysign(1, Dif.x);
+        col.Depth = dx;
+    }
+    else
+    {
+        col.Normal.y = std::copysign(1, Dif.y);
+        col.Depth = dy;
+    }
+    return true;
+}
+
+// Gives the first segment of the chain that overlaps the box
+inline static bool TestSegmentCollision(const bounding_box &box, const collider *compound, collision_result &col)
+{
+    for (int i = 0; i < compound->NumSegments; i++)
+    {
+        if (TestBoxCollision(box, compound->Segments[i], col))
+        {
+            col.Segment = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finds when First, moving by motion relative to Second, starts touching
+// it. The boxes are where they are at the end of the motion. Returns
+// false if they don't touch during it, axis is -1 if they already
+// touched at the start
+static bool SweepBoxes(const bounding_box &First, vec3 motion, const bounding_box &Second, float &entry, int &axis)
+{
+    vec3 start = First.Center - motion - Second.Center;
+    vec3 extent = First.Half + Second.Half;
+    float exit = 1.0f;
+    entry = 0.0f;
+    axis = -1;
+    for (int i = 0; i < 3; i++)
+    {
+        if (motion[i] == 0.0f)
+        {
+            if (std::abs(start[i]) >= extent[i])
+            {
+                return false;
+            }
+            continue;
+        }
+
+        float t0 = (-extent[i] - start[i]) / motion[i];
+        float t1 = (extent[i] - start[i]) / motion[i];
+        if (t0 > t1)
+        {
+            std::swap(t0, t1);
+        }
+        if (t0 > entry)
+        {
+            entry = t0;
+            axis = i;
+        }
+        exit = std::min(exit, t1);
+        if (entry >= exit)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The box tunneled through Second in the motion: the normal is the axis
+// it entered by and the depth is how far it went past the contact
+inline static bool TestSweptBoxCollision(const bounding_box &First, vec3 motion, const bounding_box &Second, collision_result &col)
+{
+    float entry;
+    int axis;
+    if (!SweepBoxes(First, motion, Second, entry, axis) || axis < 0)
+    {
+        return false;
+    }
+
+    col.Normal = vec3(0.0f);
+    col.Normal[axis] = std::copysign(1.0f, motion[axis]);
+    col.Depth = (1.0f - entry) * std::abs(motion[axis]);
+    col.Time = entry;
+    return true;
+}
+
+// A compound is touched during the motion if any of its segments is, the
+// earliest one is reported
+inline static bool TestSweptCollision(const bounding_box &box, vec3 motion, const collider *second, collision_result &col)
+{
+    col.Segment = -1;
+    if (second->NumSegments == 0)
+    {
+        return TestSweptBoxCollision(box, motion, second->Box, col);
+    }
+
+    float entry;
+    int axis;
+    if (!SweepBoxes(box, motion, second->Box, entry, axis))
+    {
+        return false;
+    }
+
+    collision_result segment;
+    for (int i = 0; i < second->NumSegments; i++)
+    {
+        if (TestSweptBoxCollision(box, motion, second->Segments[i], segment) && (col.Segment < 0 || segment.Time < col.Time))
+        {
+            col.Normal = segment.Normal;
+            col.Depth = segment.Depth;
+            col.Time = segment.Time;
+            col.Segment = i;
+        }
+    }
+    return col.Segment >= 0;
+}
+
+// Tests the boxes where they are first, and if they don't overlap and
+// the continuous collision is on, sweeps EntityA over the last motion
+// of the two so a thin collider can't be skipped
+inline static bool TestCollision(entity *EntityA, entity *EntityB, collision_result &col)
+{
+    auto &First = EntityA->Collider->Box;
+    auto *Second = EntityB->Collider;
+    col.Segment = -1;
+    col.Time = 1.0f;
+    bool hit = TestBoxCollision(First, Second->Box, col) &&
+        (Second->NumSegments == 0 || TestSegmentCollision(First, Second, col));
+    if (!hit && Global_Collision_Continuous)
+    {
+        vec3 motion = EntityA->Collider->Motion - Second->Motion;
+        hit = motion != vec3(0.0f) && TestSweptCollision(First, motion, Second, col);
+    }
+    if (!hit)
+    {
+        return false;
+    }
+
+    col.First = EntityA;
+    col.Second = EntityB;
+    return true;
+}
+
+inline static void AddCollision(std::vector<collision_result> &collisions, size_t *numCollisions, const collision_result &col)
+{
+    size_t size = collisions.size();
+    if (*numCollisions + 1 > size)
+    {
+        if (size == 0)
+        {
+            size = 4;
+        }
+
+        collisions.resize(size * 2);
+    }
+
+    collisions[*numCollisions] = col;
+    *numCollisions += 1;
+}
+
+collision_kernel GetBestCollisionKernel()
+{
+#ifdef DRAFT_COLLISION_AVX
+    // can run before the static constructors
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+        return CollisionKernel_AVX;
+    }
+#endif
+#ifdef DRAFT_COLLISION_SSE
+    return CollisionKernel_SSE;
+#else
+    return CollisionKernel_Scalar;
+#endif
+}
+
+bool IsCollisionKernelSupported(collision_kernel kernel)
+{
+    return kernel <= GetBestCollisionKernel();
+}
+
+// The kernels below do the same math as TestCollision on the boxes
+// [begin, end) of the sweep, in the same order so the results are
+// bit-identical. The comparisons are written so a NaN is treated as
+// an overlap like in the scalar test
+static void TestBoxesScalar(const bounding_box &a, const collider_soa &s, const sweep_entry *entries, size_t begin, size_t end, std::vector<sweep_hit> &hits)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        float difX = s.CenterX[i] - a.Center.x;
+        float dx = a.Half.x + s.HalfX[i] - std::abs(difX);
+        if (dx <= 0) continue;
+
+        float difY = s.CenterY[i] - a.Center.y;
+        float dy = a.Half.y + s.HalfY[i] - std::abs(difY);
+        if (dy <= 0) continue;
+
+        float difZ = s.CenterZ[i] - a.Center.z;
+        float dz = a.Half.z + s.HalfZ[i] - std::abs(difZ);
+        if (dz <= 0) continue;
+
+        sweep_hit hit;
+        hit.Index = entries[i].Index;
+        hit.Normal = vec3(0.0f);
+        if (dx < dy && dy > ClimbHeight)
+        {
+            hit.Normal.x = std::copysign(1, difX);
+            hit.Depth = dx;
+        }
+        else
+        {
+            hit.Normal.y = std::copysign(1, difY);
+            hit.Depth = dy;
+        }
+        hits.push_back(hit);
+    }
+}
+
+inline static void AddHits(int mask, int xMask, const float *depth, const float *sign, const sweep_entry *entries, std::vector<sweep_hit> &hits)
+{
+    for (int lane = 0; mask; lane++, mask >>= 1)
+    {
+        if (!(mask & 1)) continue;
+
+        sweep_hit hit;
+        hit.Index = entries[lane].Index;
+        hit.Depth = depth[lane];
+        hit.Normal = vec3(0.0f);
+        if (xMask & (1 << lane))
+        {
+            hit.Normal.x = sign[lane];
+        }
+        else
+        {
+            hit.Normal.y = sign[lane];
+        }
+        hits.push_back(hit);
+    }
+}
+
+#ifdef DRAFT_COLLISION_SSE
+static void TestBoxesSSE(const bounding_box &a, const collider_soa &s, const sweep_entry *entries, size_t begin, size_t end, std::vector<sweep_hit> &hits)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 climb = _mm_set1_ps(ClimbHeight);
+    const __m128 cx = _mm_set1_ps(a.Center.x);
+    const __m128 cy = _mm_set1_ps(a.Center.y);
+    const __m128 cz = _mm_set1_ps(a.Center.z);
+    const __m128 hx = _mm_set1_ps(a.Half.x);
+    const __m128 hy = _mm_set1_ps(a.Half.y);
+    const __m128 hz = _mm_set1_ps(a.Half.z);
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 difX = _mm_sub_ps(_mm_loadu_ps(&s.CenterX[i]), cx);
+        __m128 difY = _mm_sub_ps(_mm_loadu_ps(&s.CenterY[i]), cy);
+        __m128 difZ = _mm_sub_ps(_mm_loadu_ps(&s.CenterZ[i]), cz);
+        __m128 dx = _mm_sub_ps(_mm_add_ps(hx, _mm_loadu_ps(&s.HalfX[i])), _mm_andnot_ps(signMask, difX));
+        __m128 dy = _mm_sub_ps(_mm_add_ps(hy, _mm_loadu_ps(&s.HalfY[i])), _mm_andnot_ps(signMask, difY));
+        __m128 dz = _mm_sub_ps(_mm_add_ps(hz, _mm_loadu_ps(&s.HalfZ[i])), _mm_andnot_ps(signMask, difZ));
+        __m128 overlap = _mm_and_ps(_mm_and_ps(_mm_cmpnle_ps(dx, zero), _mm_cmpnle_ps(dy, zero)), _mm_cmpnle_ps(dz, zero));
+        int mask = _mm_movemask_ps(overlap);
+        if (!mask) continue;
+
+        __m128 useX = _mm_and_ps(_mm_cmplt_ps(dx, dy), _mm_cmpgt_ps(dy, climb));
+        __m128 depth = _mm_or_ps(_mm_and_ps(useX, dx), _mm_andnot_ps(useX, dy));
+        __m128 dif = _mm_or_ps(_mm_and_ps(useX, difX), _mm_andnot_ps(useX, difY));
+        __m128 sign = _mm_or_ps(one, _mm_and_ps(signMask, dif));
+
+        float depths[4], signs[4];
+        _mm_storeu_ps(depths, depth);
+        _mm_storeu_ps(signs, sign);
+        AddHits(mask, _mm_movemask_ps(useX), depths, signs, entries + i, hits);
+    }
+    TestBoxesScalar(a, s, entries, i, end, hits);
+}
+#endif
+
+#ifdef DRAFT_COLLISION_AVX
+__attribute__((target("avx")))
+static void TestBoxesAVX(const bounding_box &a, const collider_soa &s, const sweep_entry *entries, size_t begin, size_t end, std::vector<sweep_hit> &hits)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 climb = _mm256_set1_ps(ClimbHeight);
+    const __m256 cx = _mm256_set1_ps(a.Center.x);
+    const __m256 cy = _mm256_set1_ps(a.Center.y);
+    const __m256 cz = _mm256_set1_ps(a.Center.z);
+    const __m256 hx = _mm256_set1_ps(a.Half.x);
+    const __m256 hy = _mm256_set1_ps(a.Half.y);
+    const __m256 hz = _mm256_set1_ps(a.Half.z);
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 difX = _mm256_sub_ps(_mm256_loadu_ps(&s.CenterX[i]), cx);
+        __m256 difY = _mm256_sub_ps(_mm256_loadu_ps(&s.CenterY[i]), cy);
+        __m256 difZ = _mm256_sub_ps(_mm256_loadu_ps(&s.CenterZ[i]), cz);
+        __m256 dx = _mm256_sub_ps(_mm256_add_ps(hx, _mm256_loadu_ps(&s.HalfX[i])), _mm256_andnot_ps(signMask, difX));
+        __m256 dy = _mm256_sub_ps(_mm256_add_ps(hy, _mm256_loadu_ps(&s.HalfY[i])), _mm256_andnot_ps(signMask, difY));
+        __m256 dz = _mm256_sub_ps(_mm256_add_ps(hz, _mm256_loadu_ps(&s.HalfZ[i])), _mm256_andnot_ps(signMask, difZ));
+        __m256 overlap = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(dx, zero, _CMP_NLE_UQ), _mm256_cmp_ps(dy, zero, _CMP_NLE_UQ)),
+                                       _mm256_cmp_ps(dz, zero, _CMP_NLE_UQ));
+        int mask = _mm256_movemask_ps(overlap);
+        if (!mask) continue;
+
+        __m256 useX = _mm256_and_ps(_mm256_cmp_ps(dx, dy, _CMP_LT_OQ), _mm256_cmp_ps(dy, climb, _CMP_GT_OQ));
+        __m256 depth = _mm256_blendv_ps(dy, dx, useX);
+        __m256 dif = _mm256_blendv_ps(difY, difX, useX);
+        __m256 sign = _mm256_or_ps(one, _mm256_and_ps(signMask, dif));
+
+        float depths[8], signs[8];
+        _mm256_storeu_ps(depths, depth);
+        _mm256_storeu_ps(signs, sign);
+        AddHits(mask, _mm256_movemask_ps(useX), depths, signs, entries + i, hits);
+    }
+    TestBoxesScalar(a, s, entries, i, end, hits);
+}
+#endif
+
+static void TestBoxes(collision_kernel kernel, const bounding_box &a, const collider_soa &s, const sweep_entry *entries, size_t begin, size_t end, std::vector<sweep_hit> &hits)
+{
+    switch (kernel)
+    {
+#ifdef DRAFT_COLLISION_AVX
+    case CollisionKernel_AVX:
+        TestBoxesAVX(a, s, entries, begin, end, hits);
+        return;
+#endif
+#ifdef DRAFT_COLLISION_SSE
+    case CollisionKernel_SSE:
+        TestBoxesSSE(a, s, entries, begin, end, hits);
         return;
+#endif
     }
+    TestBoxesScalar(a, s, entries, begin, end, hits);
+}
 
-	*numCollisions = 0;
-	size_t activeEntitiesSize = activeEntities.size();
-	size_t passiveEntitiesSize = passiveEntities.size();
-    for (int i = 0; i < activeEntitiesSize; i++)
+// The reference version, every active entity is tested against every
+// passive one
+void DetectCollisionsBruteForce(const std::vector<entity *> &activeEntities, const std::vector<entity *> &passiveEntities, std::vector<collision_result> &collisions, size_t *numCollisions)
+{
+    *numCollisions = 0;
+    for (auto *EntityA : activeEntities)
     {
-		auto *EntityA = activeEntities[i];
         if (!EntityA) continue;
 
         EntityA->NumCollisions = 0;
-
-        for (int j = 0; j < passiveEntitiesSize; j++)
+        for (auto *EntityB : passiveEntities)
         {
-			auto *EntityB = passiveEntities[j];
             if (!EntityB) continue;
 
-            auto &First = EntityA->Collider->Box;
-            auto &Second = EntityB->Collider->Box;
-            vec3 Dif = Second.Center - First.Center;
-            float dx = First.Half.x + Second.Half.x - std::abs(Dif.x);
-            if (dx <= 0)
+            collision_result col;
+            if (TestCollision(EntityA, EntityB, col))
             {
-                continue;
+                AddCollision(collisions, numCollisions, col);
             }
+        }
+    }
+}
 
-            float dy = First.Half.y + Second.Half.y - std::abs(Dif.y);
-            if (dy <= 0)
-            {
-                continue;
-            }
+// The entries are refreshed in last frame's order, so they're almost
+// sorted already and an insertion sort is enough unless a lot of
+// entities were added
+static void SortBroadphase(collision_broadphase &bp, const std::vector<entity *> &passiveEntities)
+{
+    auto &entries = bp.Entries;
+    bp.Seen.assign(passiveEntities.size(), 0);
+    bp.MaxLengthY = 0;
+    bp.MaxMotion = vec3(0.0f);
+
+    size_t count = 0;
+    for (auto &entry : entries)
+    {
+        if (size_t(entry.Index) >= passiveEntities.size() || !passiveEntities[entry.Index] || bp.Seen[entry.Index])
+        {
+            continue;
+        }
+
+        bp.Seen[entry.Index] = 1;
+        entries[count++].Index = entry.Index;
+    }
+    entries.resize(count);
+
+    size_t numAdded = 0;
+    for (size_t i = 0; i < passiveEntities.size(); i++)
+    {
+        if (!passiveEntities[i] || bp.Seen[i]) continue;
+
+        entries.push_back(sweep_entry{ 0, 0, int(i) });
+        numAdded++;
+    }
+
+    for (auto &entry : entries)
+    {
+        auto &box = passiveEntities[entry.Index]->Collider->Box;
+        entry.MinY = box.Center.y - box.Half.y;
+        entry.MaxY = box.Center.y + box.Half.y;
+        bp.MaxLengthY = std::max(bp.MaxLengthY, entry.MaxY - entry.MinY);
+        if (Global_Collision_Continuous)
+        {
+            bp.MaxMotion = glm::max(bp.MaxMotion, glm::abs(passiveEntities[entry.Index]->Collider->Motion));
+        }
+    }
 
-            float dz = First.Half.z + Second.Half.z - std::abs(Dif.z);
-            if (dz <= 0)
+    if (numAdded > entries.size() / 8)
+    {
+        std::sort(entries.begin(), entries.end(), [](const sweep_entry &a, const sweep_entry &b)
+        {
+            return a.MinY < b.MinY;
+        });
+    }
+    else
+    {
+        for (size_t i = 1; i < entries.size(); i++)
+        {
+            auto entry = entries[i];
+            size_t j = i;
+            for (; j > 0 && entries[j - 1].MinY > entry.MinY; j--)
             {
-                continue;
+                entries[j] = entries[j - 1];
             }
+            entries[j] = entry;
+        }
+    }
 
-            // At this point we have a collision
-            collision_result col;
-			col.Normal = vec3(0.0f);
-            if (dx < dy && dy > ClimbHeight)
+    auto &boxes = bp.Boxes;
+    count = entries.size();
+    boxes.CenterX.resize(count);
+    boxes.CenterY.resize(count);
+    boxes.CenterZ.resize(count);
+    boxes.HalfX.resize(count);
+    boxes.HalfY.resize(count);
+    boxes.HalfZ.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto &box = passiveEntities[entries[i].Index]->Collider->Box;
+        boxes.CenterX[i] = box.Center.x;
+        boxes.CenterY[i] = box.Center.y;
+        boxes.CenterZ[i] = box.Center.z;
+        boxes.HalfX[i] = box.Half.x;
+        boxes.HalfY[i] = box.Half.y;
+        boxes.HalfZ[i] = box.Half.z;
+    }
+}
+
+static void RunCollisionWorker(collision_worker &w)
+{
+    auto &bp = *w.Broadphase;
+    auto &activeEntities = *w.ActiveEntities;
+    auto &passiveEntities = *w.PassiveEntities;
+    w.Results.clear();
+    if (w.Begin >= w.End)
+    {
+        return;
+    }
+
+    // the last query starting at or before the worker's first test
+    auto end = bp.Queries.end();
+    auto q = std::upper_bound(bp.Queries.begin(), end, w.Begin, [](size_t test, const sweep_query &query)
+    {
+        return test < query.Offset;
+    }) - 1;
+
+    for (; q != end && q->Offset < w.End; q++)
+    {
+        size_t size = q->End - q->Begin;
+        size_t from = std::max(w.Begin, q->Offset) - q->Offset;
+        size_t to = std::min(w.End, q->Offset + size) - q->Offset;
+        if (from >= to) continue;
+
+        auto *EntityA = activeEntities[q->Active];
+        auto &box = EntityA->Collider->Box;
+        w.Hits.clear();
+        TestBoxes(bp.Kernel, q->Box, bp.Boxes, bp.Entries.data(), q->Begin + from, q->Begin + to, w.Hits);
+        for (auto &hit : w.Hits)
+        {
+            narrow_hit result;
+            result.Active = q->Active;
+            result.Index = hit.Index;
+
+            auto &col = result.Result;
+            col.Normal = hit.Normal;
+            col.Depth = hit.Depth;
+            col.First = EntityA;
+            col.Second = passiveEntities[hit.Index];
+
+            // a swept box only finds the candidates, and the kernels only
+            // test the bounds of a compound collider
+            auto *compound = col.Second->Collider;
+            if (q->Swept)
             {
-				col.Normal.x = std::copysign(1, Dif.x);
-				col.Depth = dx;
+                if (!TestCollision(EntityA, col.Second, col)) continue;
             }
-            else
+            else if (compound->NumSegments > 0 && !TestSegmentCollision(box, compound, col))
             {
-				col.Normal.y = std::copysign(1, Dif.y);
-				col.Depth = dy;
+                continue;
             }
+            w.Results.push_back(result);
+        }
+    }
+}
+
+static void CollisionWorkerJob(void *arg)
+{
+    auto *w = (collision_worker *)arg;
+    RunCollisionWorker(*w);
+    w->Broadphase->Pending--;
+}
+
+// Gives the same collisions in the same order as the brute force
+// version: by active entity, then in the order of the passive list.
+// The tests are split in contiguous slices between the workers, so
+// the merged results only need to be sorted within each active entity
+void SweepCollisions(const std::vector<entity *> &activeEntities, const std::vector<entity *> &passiveEntities, collision_broadphase &bp, thread_pool *pool, std::vector<collision_result> &collisions, size_t *numCollisions)
+{
+    *numCollisions = 0;
+    SortBroadphase(bp, passiveEntities);
+
+    auto &entries = bp.Entries;
+    size_t numTests = 0;
+    bp.Queries.clear();
+    for (size_t i = 0; i < activeEntities.size(); i++)
+    {
+        auto *EntityA = activeEntities[i];
+        if (!EntityA) continue;
+
+        EntityA->NumCollisions = 0;
+
+        // a moving box is tested over its whole motion, relative to
+        // the passive box that moved the most
+        bounding_box box = EntityA->Collider->Box;
+        vec3 motion = EntityA->Collider->Motion;
+        bool swept = Global_Collision_Continuous && (motion != vec3(0.0f) || bp.MaxMotion != vec3(0.0f));
+        if (swept)
+        {
+            box.Center -= motion * 0.5f;
+            box.Half += glm::abs(motion) * 0.5f + bp.MaxMotion;
+        }
+
+        // the interval is padded so a rounding difference from the
+        // exact test can't drop a pair
+        float pad = 1e-3f + std::abs(box.Center.y)*1e-6f;
+        float minY = box.Center.y - box.Half.y - pad;
+        float maxY = box.Center.y + box.Half.y + pad;
+
+        // no entry starting before this one can reach minY
+        auto it = std::lower_bound(entries.begin(), entries.end(), minY - bp.MaxLengthY, [](const sweep_entry &entry, float y)
+        {
+            return entry.MinY < y;
+        });
+
+        size_t begin = it - entries.begin();
+        size_t end = begin;
+        while (end < entries.size() && entries[end].MinY < maxY)
+        {
+            end++;
+        }
+
+        bp.Queries.push_back(sweep_query{ int(i), uint32(begin), uint32(end), numTests, box, swept });
+        numTests += end - begin;
+    }
+    bp.NumTests = numTests;
+
+    int numWorkers = 1;
+    if (pool && bp.MinTestsPerWorker > 0)
+    {
+        numWorkers = int(std::min(numTests / bp.MinTestsPerWorker, size_t(pool->MaxThreads + 1)));
+        numWorkers = std::max(numWorkers, 1);
+    }
+    if (bp.Workers.size() < size_t(numWorkers))
+    {
+        bp.Workers.resize(numWorkers);
+    }
+
+    bp.NumWorkers = numWorkers;
+    for (int i = 0; i < numWorkers; i++)
+    {
+        auto &w = bp.Workers[i];
+        w.Broadphase = &bp;
+        w.ActiveEntities = &activeEntities;
+        w.PassiveEntities = &passiveEntities;
+        w.Begin = numTests * i / numWorkers;
+        w.End = numTests * (i + 1) / numWorkers;
+    }
+
+    bp.Pending = numWorkers - 1;
+    for (int i = 1; i < numWorkers; i++)
+    {
+        if (!AddJob(*pool, CollisionWorkerJob, &bp.Workers[i]))
+        {
+            CollisionWorkerJob(&bp.Workers[i]);
+        }
+    }
+    RunCollisionWorker(bp.Workers[0]);
+    while (bp.Pending > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    bp.Merged.clear();
+    for (int i = 0; i < numWorkers; i++)
+    {
+        auto &results = bp.Workers[i].Results;
+        bp.Merged.insert(bp.Merged.end(), results.begin(), results.end());
+    }
+    std::sort(bp.Merged.begin(), bp.Merged.end(), [](const narrow_hit &a, const narrow_hit &b)
+    {
+        return a.Active < b.Active || (a.Active == b.Active && a.Index < b.Index);
+    });
 
-            size_t size = collisions.size();
-            if (*numCollisions + 1 > size)
+    if (collisions.size() < bp.Merged.size())
+    {
+        collisions.resize(bp.Merged.size());
+    }
+    for (auto &hit : bp.Merged)
+    {
+        collisions[(*numCollisions)++] = hit.Result;
+    }
+}
+
+void DetectCollisions(const std::vector<entity *> &activeEntities, const std::vector<entity *> &passiveEntities, collision_broadphase &bp, thread_pool *pool, std::vector<collision_result> &collisions, size_t *numCollisions)
+{
+    // The entities' bounding boxes only get updated in the integration
+    // phase, which happens after the collision detection so we need
+    // to skip the first frame
+    static bool FirstFrame = true;
+    if (FirstFrame)
+    {
+        FirstFrame = false;
+        return;
+    }
+
+    SweepCollisions(activeEntities, passiveEntities, bp, pool, collisions, numCollisions);
+}
+
+static bool SameCollisions(const std::vector<collision_result> &a, const std::vector<collision_result> &b, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (a[i].First != b[i].First || a[i].Second != b[i].Second || a[i].Segment != b[i].Segment ||
+            a[i].Depth != b[i].Depth || a[i].Normal != b[i].Normal || a[i].Time != b[i].Time)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the sweep with every supported kernel, the sweep split between
+// the workers of the pool and the brute force version on the same
+// moving boxes and checks they find the same collisions. The passive
+// boxes are sized like trail pieces, one in BENCHMARK_TRAIL_EVERY is a
+// whole trail as a compound collider, and the active ones are sized
+// like ships
+#define BENCHMARK_TRAIL_EVERY 25
+#define BENCHMARK_TRAIL_PIECE 2.0f
+static void SetBenchmarkTrail(collider *col)
+{
+    float length = BENCHMARK_TRAIL_PIECE * col->NumSegments;
+    vec3 tail = col->Box.Center - vec3(0, length * 0.5f, 0);
+    for (int k = 0; k < col->NumSegments; k++)
+    {
+        col->Segments[k].Half = vec3{ 0.5f, BENCHMARK_TRAIL_PIECE * 0.5f, 0.5f };
+        col->Segments[k].Center = tail + vec3(0, (k + 0.5f) * BENCHMARK_TRAIL_PIECE, 0);
+    }
+    col->Box.Half = vec3{ 0.5f, length * 0.5f, 0.5f } + vec3(1e-3f);
+}
+
+void BenchmarkBroadphase(collision_benchmark &bench, int numPassive, int numActive, thread_pool *pool)
+{
+    const int numFrames = 60;
+    const float trackLength = numPassive * 0.5f;
+    const float dt = 1.0f / 60.0f;
+
+    random_series series = RandomSeed(numPassive);
+    std::vector<entity> entities(numPassive + numActive);
+    std::vector<collider> colliders(entities.size());
+    std::vector<entity *> passive;
+    std::vector<entity *> active;
+    std::vector<bounding_box> segments((numPassive / BENCHMARK_TRAIL_EVERY + 1) * TRAIL_COUNT);
+    for (size_t i = 0; i < entities.size(); i++)
+    {
+        auto &ent = entities[i];
+        bool isActive = i >= size_t(numPassive);
+        ent.Collider = &colliders[i];
+        // spread over the 5 lanes of the road, 2 units apart
+        ent.Collider->Box.Center = vec3{ RandomBetween(series, -2, 2) * 2.0f, RandomBetween(series, 0.0f, trackLength), 0.0f };
+        ent.Collider->Box.Half = isActive ? vec3{ 0.75f, 1.5f, 0.5f } : vec3{ 0.25f, 0.5f, 0.25f };
+        ent.Vel().y = RandomBetween(series, -75.0f, 150.0f);
+        if (!isActive && i % BENCHMARK_TRAIL_EVERY == 0)
+        {
+            ent.Collider->Segments = &segments[(i / BENCHMARK_TRAIL_EVERY) * TRAIL_COUNT];
+            ent.Collider->NumSegments = TRAIL_COUNT;
+            SetBenchmarkTrail(ent.Collider);
+        }
+        (isActive ? active : passive).push_back(&ent);
+    }
+
+    bench = collision_benchmark{};
+    bench.NumActive = numActive;
+    bench.NumPassive = numPassive;
+    bench.NumFrames = numFrames;
+    bench.Identical = true;
+
+    collision_broadphase bp[CollisionKernel_count];
+
+    // split in small slices so every worker gets some of the tests
+    collision_broadphase parallelBp;
+    parallelBp.MinTestsPerWorker = 32;
+    std::vector<collision_result> sweepResult;
+    std::vector<collision_result> bruteForceResult;
+    for (int f = 0; f < numFrames; f++)
+    {
+        for (auto &ent : entities)
+        {
+            ent.Collider->Motion.y = ent.Vel().y * dt;
+            ent.Collider->Box.Center.y += ent.Collider->Motion.y;
+            if (ent.Collider->NumSegments > 0)
             {
-                if (size == 0)
-                {
-                    size = 4;
-                }
+                SetBenchmarkTrail(ent.Collider);
+            }
+        }
+
+        size_t bruteForceCount = 0;
+        auto start = benchmark_clock::now();
+        DetectCollisionsBruteForce(active, passive, bruteForceResult, &bruteForceCount);
+        bench.BruteForceTime += MillisecondsSince(start) / numFrames;
+        bench.BruteForceTests += active.size() * passive.size();
+        bench.NumCollisions += bruteForceCount;
+        for (size_t i = 0; i < bruteForceCount; i++)
+        {
+            bench.NumSweptCollisions += (bruteForceResult[i].Time < 1.0f);
+        }
 
-                collisions.resize(size * 2);
+        for (int k = 0; k < CollisionKernel_count; k++)
+        {
+            if (!IsCollisionKernelSupported(collision_kernel(k))) continue;
+
+            size_t sweepCount = 0;
+            bp[k].Kernel = collision_kernel(k);
+            start = benchmark_clock::now();
+            SweepCollisions(active, passive, bp[k], NULL, sweepResult, &sweepCount);
+            bench.SweepTime[k] += MillisecondsSince(start) / numFrames;
+
+            if (sweepCount != bruteForceCount || !SameCollisions(sweepResult, bruteForceResult, sweepCount))
+            {
+                bench.Identical = false;
             }
+        }
+        bench.SweepTests += bp[0].NumTests;
+
+        // the workers finish in any order, the results must not change
+        size_t parallelCount = 0;
+        start = benchmark_clock::now();
+        SweepCollisions(active, passive, parallelBp, pool, sweepResult, &parallelCount);
+        bench.ParallelTime += MillisecondsSince(start) / numFrames;
+        bench.NumWorkers = std::max(bench.NumWorkers, parallelBp.NumWorkers);
+        if (parallelCount != bruteForceCount || !SameCollisions(sweepResult, bruteForceResult, parallelCount))
+        {
+            bench.Identical = false;
+        }
+    }
+}
 
-			col.First = EntityA;
-			col.Second = EntityB;
-            collisions[*numCollisions] = col;
-			*numCollisions += 1;
+// The integrate kernels move the batch entities [begin, end). They do
+// the same operations as the scalar one in the same order, so the
+// results are bit-identical; the kinematic entities keep their velocity
+// through a blend instead of adding a zero
+static void IntegrateScalar(integrate_batch &b, size_t begin, size_t end, const vec3 &Gravity, float DeltaTime)
+{
+    vec3 g = Gravity * DeltaTime;
+    for (size_t i = begin; i < end; i++)
+    {
+        if (b.Dynamic[i])
+        {
+            b.VelX[i] += g.x;
+            b.VelY[i] += g.y;
+            b.VelZ[i] += g.z;
         }
+        b.PosX[i] += b.VelX[i] * DeltaTime;
+        b.PosY[i] += b.VelY[i] * DeltaTime;
+        b.PosZ[i] += b.VelZ[i] * DeltaTime;
+    }
+}
+
+#ifdef DRAFT_COLLISION_SSE
+inline static __m128 BlendSSE(__m128 a, __m128 b, __m128 mask)
+{
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+static void IntegrateSSE(integrate_batch &b, size_t begin, size_t end, const vec3 &Gravity, float DeltaTime)
+{
+    vec3 g = Gravity * DeltaTime;
+    const __m128 gx = _mm_set1_ps(g.x);
+    const __m128 gy = _mm_set1_ps(g.y);
+    const __m128 gz = _mm_set1_ps(g.z);
+    const __m128 dt = _mm_set1_ps(DeltaTime);
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 dynamic = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)&b.Dynamic[i]));
+        __m128 vx = _mm_loadu_ps(&b.VelX[i]);
+        __m128 vy = _mm_loadu_ps(&b.VelY[i]);
+        __m128 vz = _mm_loadu_ps(&b.VelZ[i]);
+        vx = BlendSSE(vx, _mm_add_ps(vx, gx), dynamic);
+        vy = BlendSSE(vy, _mm_add_ps(vy, gy), dynamic);
+        vz = BlendSSE(vz, _mm_add_ps(vz, gz), dynamic);
+        _mm_storeu_ps(&b.VelX[i], vx);
+        _mm_storeu_ps(&b.VelY[i], vy);
+        _mm_storeu_ps(&b.VelZ[i], vz);
+        _mm_storeu_ps(&b.PosX[i], _mm_add_ps(_mm_loadu_ps(&b.PosX[i]), _mm_mul_ps(vx, dt)));
+        _mm_storeu_ps(&b.PosY[i], _mm_add_ps(_mm_loadu_ps(&b.PosY[i]), _mm_mul_ps(vy, dt)));
+        _mm_storeu_ps(&b.PosZ[i], _mm_add_ps(_mm_loadu_ps(&b.PosZ[i]), _mm_mul_ps(vz, dt)));
+    }
+    IntegrateScalar(b, i, end, Gravity, DeltaTime);
+}
+#endif
+
+#ifdef DRAFT_COLLISION_AVX
+__attribute__((target("avx")))
+static void IntegrateAVX(integrate_batch &b, size_t begin, size_t end, const vec3 &Gravity, float DeltaTime)
+{
+    vec3 g = Gravity * DeltaTime;
+    const __m256 gx = _mm256_set1_ps(g.x);
+    const __m256 gy = _mm256_set1_ps(g.y);
+    const __m256 gz = _mm256_set1_ps(g.z);
+    const __m256 dt = _mm256_set1_ps(DeltaTime);
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 dynamic = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)&b.Dynamic[i]));
+        __m256 vx = _mm256_loadu_ps(&b.VelX[i]);
+        __m256 vy = _mm256_loadu_ps(&b.VelY[i]);
+        __m256 vz = _mm256_loadu_ps(&b.VelZ[i]);
+        vx = _mm256_blendv_ps(vx, _mm256_add_ps(vx, gx), dynamic);
+        vy = _mm256_blendv_ps(vy, _mm256_add_ps(vy, gy), dynamic);
+        vz = _mm256_blendv_ps(vz, _mm256_add_ps(vz, gz), dynamic);
+        _mm256_storeu_ps(&b.VelX[i], vx);
+        _mm256_storeu_ps(&b.VelY[i], vy);
+        _mm256_storeu_ps(&b.VelZ[i], vz);
+        _mm256_storeu_ps(&b.PosX[i], _mm256_add_ps(_mm256_loadu_ps(&b.PosX[i]), _mm256_mul_ps(vx, dt)));
+        _mm256_storeu_ps(&b.PosY[i], _mm256_add_ps(_mm256_loadu_ps(&b.PosY[i]), _mm256_mul_ps(vy, dt)));
+        _mm256_storeu_ps(&b.PosZ[i], _mm256_add_ps(_mm256_loadu_ps(&b.PosZ[i]), _mm256_mul_ps(vz, dt)));
+    }
+    IntegrateScalar(b, i, end, Gravity, DeltaTime);
+}
+#endif
+
+static void IntegrateBatch(integrate_batch &b, const vec3 &Gravity, float DeltaTime)
+{
+    size_t count = b.Entities.size();
+    switch (b.Kernel)
+    {
+#ifdef DRAFT_COLLISION_AVX
+    case CollisionKernel_AVX:
+        IntegrateAVX(b, 0, count, Gravity, DeltaTime);
+        return;
+#endif
+#ifdef DRAFT_COLLISION_SSE
+    case CollisionKernel_SSE:
+        IntegrateSSE(b, 0, count, Gravity, DeltaTime);
+        return;
+#endif
     }
+    IntegrateScalar(b, 0, count, Gravity, DeltaTime);
+}
+
+static void ResizeBatch(integrate_batch &b, size_t count)
+{
+    b.PosX.resize(count);
+    b.PosY.resize(count);
+    b.PosZ.resize(count);
+    b.VelX.resize(count);
+    b.VelY.resize(count);
+    b.VelZ.resize(count);
+    b.Dynamic.resize(count);
+}
+
+static void AddToBatch(integrate_batch &b, entity *ent)
+{
+    size_t i = b.Entities.size();
+    b.Entities.push_back(ent);
+    ResizeBatch(b, b.Entities.size());
+
+    auto &pos = ent->Transform.Position;
+    auto &vel = ent->Transform.Velocity;
+    b.PosX[i] = pos.x;
+    b.PosY[i] = pos.y;
+    b.PosZ[i] = pos.z;
+    b.VelX[i] = vel.x;
+    b.VelY[i] = vel.y;
+    b.VelZ[i] = vel.z;
+    b.Dynamic[i] = (ent->Flags & EntityFlag_Kinematic) ? 0 : 0xffffffff;
 }
 
-void Integrate(const std::vector<entity *> &entities, const vec3 &Gravity, float DeltaTime)
+// The awake entities are gathered in the batch, moved by the kernel and
+// written back, then their bounds are updated one by one
+void Integrate(const std::vector<entity *> &entities, const vec3 &Gravity, float DeltaTime, integrate_batch &batch, collision_stats &stats)
 {
+    batch.Entities.clear();
     for (auto *Entity : entities)
     {
         if (!Entity) continue;
 
+        // a sleeping collider has no velocity and an up to date box, so
+        // integrating it wouldn't change anything
+        auto *col = Entity->Collider;
+        if (col->Sleeping)
+        {
+            bool still = (Entity->Flags & EntityFlag_Kinematic) && Entity->Transform.Velocity == vec3(0.0f);
+            if (still && !BoundsChanged(Entity))
+            {
+                stats.NumSleeping++;
+                continue;
+            }
+
+            col->Sleeping = false;
+            col->StillFrames = 0;
+        }
+        AddToBatch(batch, Entity);
+    }
+
+    IntegrateBatch(batch, Gravity, DeltaTime);
+
+    for (size_t i = 0; i < batch.Entities.size(); i++)
+    {
+        auto *Entity = batch.Entities[i];
+        auto *col = Entity->Collider;
+        auto &pos = Entity->Transform.Position;
+        auto &vel = Entity->Transform.Velocity;
+
+        // kinematic entities don't get gravity, so their velocity is
+        // the one they moved with
+        bool still = !batch.Dynamic[i] && vel == vec3(0.0f);
+        pos = vec3(batch.PosX[i], batch.PosY[i], batch.PosZ[i]);
+        vel = vec3(batch.VelX[i], batch.VelY[i], batch.VelZ[i]);
+        stats.NumIntegrated++;
+
+        // only the boxes built from the transform move with it, the
+        // compound ones get their motion when they're rebuilt
+        if (Entity->Model)
+        {
+            col->Motion = vel * DeltaTime;
+        }
+
+        if (UpdateEntityBounds(Entity, stats) || !still)
+        {
+            col->StillFrames = 0;
+        }
+        else if (++col->StillFrames >= COLLIDER_SLEEP_FRAMES)
+        {
+            col->Sleeping = true;
+        }
+    }
+}
+
+// The entities are moved through their pointers like Integrate did
+// before the batch, to compare against
+static void IntegrateEntities(const std::vector<entity *> &entities, const vec3 &Gravity, float DeltaTime)
+{
+    for (auto *Entity : entities)
+    {
         if (!(Entity->Flags & EntityFlag_Kinematic))
         {
             Entity->Transform.Velocity += Gravity * DeltaTime;
         }
         Entity->Transform.Position += Entity->Transform.Velocity * DeltaTime;
-        UpdateEntityBounds(Entity);
+    }
+}
+
+// Runs every supported kernel on the same entities, a third of them
+// kinematic, and checks they end up bit-identical to the scalar one
+void BenchmarkIntegrate(integrate_benchmark &bench, int numEntities)
+{
+    const int numFrames = 60;
+    const float dt = 1.0f / 60.0f;
+    const vec3 gravity = vec3(0.0f, 0.0f, -9.8f);
+
+    random_series series = RandomSeed(numEntities);
+    std::vector<entity> entities(numEntities);
+    std::vector<entity *> list;
+    for (int i = 0; i < numEntities; i++)
+    {
+        auto &ent = entities[i];
+        ent.Pos() = vec3{ RandomBetween(series, -4.0f, 4.0f), RandomBetween(series, 0.0f, 1000.0f), RandomBetween(series, 0.0f, 10.0f) };
+        ent.Vel() = vec3{ RandomBetween(series, -5.0f, 5.0f), RandomBetween(series, -75.0f, 150.0f), 0.0f };
+        if (i % 3 == 0)
+        {
+            ent.Flags |= EntityFlag_Kinematic;
+        }
+        list.push_back(&ent);
+    }
+
+    bench = integrate_benchmark{};
+    bench.NumEntities = numEntities;
+    bench.NumFrames = numFrames;
+    bench.Identical = true;
+
+    integrate_batch reference;
+    reference.Kernel = CollisionKernel_Scalar;
+    for (int k = 0; k < CollisionKernel_count; k++)
+    {
+        if (!IsCollisionKernelSupported(collision_kernel(k))) continue;
+
+        integrate_batch b;
+        b.Kernel = collision_kernel(k);
+        for (auto ent : list)
+        {
+            AddToBatch(b, ent);
+        }
+
+        auto start = benchmark_clock::now();
+        for (int f = 0; f < numFrames; f++)
+        {
+            IntegrateBatch(b, gravity, dt);
+        }
+        bench.Time[k] = MillisecondsSince(start) / numFrames;
+
+        if (k == CollisionKernel_Scalar)
+        {
+            reference = b;
+        }
+        else if (b.PosX != reference.PosX || b.PosY != reference.PosY || b.PosZ != reference.PosZ ||
+                 b.VelX != reference.VelX || b.VelY != reference.VelY || b.VelZ != reference.VelZ)
+        {
+            bench.Identical = false;
+        }
+    }
+
+    auto start = benchmark_clock::now();
+    for (int f = 0; f < numFrames; f++)
+    {
+        IntegrateEntities(list, gravity, dt);
+    }
+    bench.EntityTime = MillisecondsSince(start) / numFrames;
+    for (int i = 0; i < numEntities; i++)
+    {
+        auto &ent = entities[i];
+        if (ent.Pos() != vec3(reference.PosX[i], reference.PosY[i], reference.PosZ[i]))
+        {
+            bench.Identical = false;
+        }
     }
 }
 
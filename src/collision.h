@@ -1,6 +1,16 @@
 #ifndef DRAFT_COLLISION_H
 #define DRAFT_COLLISION_H
 
+#ifdef DRAFT_SSE
+#define DRAFT_COLLISION_SSE
+#endif
+
+// the AVX kernel is compiled with a target attribute and picked at runtime
+#if defined(DRAFT_COLLISION_SSE) && defined(__GNUC__)
+#define DRAFT_COLLISION_AVX
+#include <immintrin.h>
+#endif
+
 struct bounding_box
 {
     vec3 Center = vec3(0.0f);
@@ -14,6 +24,168 @@ struct collision_result
     float Depth;
     entity *First;
     entity *Second;
+
+    // the segment of Second that was hit if it's a compound collider
+    int Segment = -1;
+
+    // when in the last motion the boxes started touching, 1 if they
+    // overlap at the end of it
+    float Time = 1.0f;
+};
+
+enum collision_kernel
+{
+    CollisionKernel_Scalar,
+    CollisionKernel_SSE,
+    CollisionKernel_AVX,
+    CollisionKernel_count,
+};
+
+static const char *CollisionKernelNames[] = {
+    "Scalar",
+    "SSE",
+    "AVX",
+};
+
+collision_kernel GetBestCollisionKernel();
+bool IsCollisionKernelSupported(collision_kernel kernel);
+
+struct sweep_entry
+{
+    float MinY;
+    float MaxY;
+
+    // index in the passive list, the hits are reported in that order
+    int Index;
+};
+
+// The broadphase boxes in sweep order, split by component so the
+// narrowphase can test 4 or 8 of them at once
+struct collider_soa
+{
+    std::vector<float> CenterX;
+    std::vector<float> CenterY;
+    std::vector<float> CenterZ;
+    std::vector<float> HalfX;
+    std::vector<float> HalfY;
+    std::vector<float> HalfZ;
+};
+
+struct sweep_hit
+{
+    int Index;
+    float Depth;
+    vec3 Normal;
+};
+
+// The range of the sweep an active entity is tested against, Offset
+// is the number of tests of the queries before it
+struct sweep_query
+{
+    int Active;
+    uint32 Begin;
+    uint32 End;
+    size_t Offset;
+
+    // the active box, swept over its motion if Swept is set
+    bounding_box Box;
+    bool Swept;
+};
+
+struct narrow_hit
+{
+    int Active;
+    int Index;
+    collision_result Result;
+};
+
+// A slice of the narrowphase tests, each worker writes to its own
+// buffers so they can run in parallel
+struct collision_broadphase;
+struct collision_worker
+{
+    collision_broadphase *Broadphase = NULL;
+    const std::vector<entity *> *ActiveEntities = NULL;
+    const std::vector<entity *> *PassiveEntities = NULL;
+    size_t Begin = 0;
+    size_t End = 0;
+    std::vector<sweep_hit> Hits;
+    std::vector<narrow_hit> Results;
+};
+
+// Sort and sweep broadphase along Y, the track axis. The passive boxes
+// are sorted once per frame and each active box only tests the ones
+// whose Y interval overlaps its own
+struct collision_broadphase
+{
+    std::vector<sweep_entry> Entries;
+    std::vector<uint8> Seen;
+    collider_soa Boxes;
+    collision_kernel Kernel = GetBestCollisionKernel();
+    float MaxLengthY = 0;
+
+    // the biggest motion of the passive boxes in each axis
+    vec3 MaxMotion = vec3(0.0f);
+    size_t NumTests = 0;
+
+    std::vector<sweep_query> Queries;
+    std::vector<collision_worker> Workers;
+    std::vector<narrow_hit> Merged;
+    std::atomic_int Pending;
+
+    // the narrowphase is split in slices of at least this many tests
+    size_t MinTestsPerWorker = 1024;
+    int NumWorkers = 0;
+};
+
+// The entities Integrate moves this frame, split by component so the
+// kernels can move 4 or 8 of them at once. Gravity is only added where
+// Dynamic has all bits set
+struct integrate_batch
+{
+    std::vector<entity *> Entities;
+    std::vector<float> PosX;
+    std::vector<float> PosY;
+    std::vector<float> PosZ;
+    std::vector<float> VelX;
+    std::vector<float> VelY;
+    std::vector<float> VelZ;
+    std::vector<uint32> Dynamic;
+    collision_kernel Kernel = GetBestCollisionKernel();
+};
+
+struct integrate_benchmark
+{
+    int NumEntities = 0;
+    int NumFrames = 0;
+    double Time[CollisionKernel_count] = {};
+    double EntityTime = 0;
+    bool Identical = false;
+};
+
+// The collision work done in the last frame
+struct collision_stats
+{
+    int NumIntegrated = 0;
+    int NumSleeping = 0;
+    int NumLocalUpdates = 0;
+    int NumBoxUpdates = 0;
+};
+
+struct collision_benchmark
+{
+    int NumActive = 0;
+    int NumPassive = 0;
+    int NumFrames = 0;
+    double SweepTime[CollisionKernel_count] = {};
+    double BruteForceTime = 0;
+    double ParallelTime = 0;
+    int NumWorkers = 0;
+    size_t SweepTests = 0;
+    size_t BruteForceTests = 0;
+    size_t NumCollisions = 0;
+    size_t NumSweptCollisions = 0;
+    bool Identical = false;
 };
 
 inline static bounding_box
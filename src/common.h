@@ -12,6 +12,8 @@
 #include <vector>
 #include <list>
 #include <unordered_map>
+#include <map>
+#include <chrono>
 #include <cctype>
 #include <locale>
 #include <limits>
@@ -30,6 +32,13 @@
 
 #define ARRAY_COUNT(arr) (sizeof(arr)/sizeof(arr[0]))
 
+// SSE2 paths for the batched loops, both the collision and the render code
+// pick them with this
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAFT_SSE
+#include <emmintrin.h>
+#endif
+
 typedef uint8_t  uint8;
 typedef uint16_t uint16;
 typedef uint32_t uint32;
@@ -66,6 +75,13 @@ enum direction
     Direction_left,
 };
 
+typedef std::chrono::high_resolution_clock benchmark_clock;
+
+inline static double MillisecondsSince(benchmark_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+}
+
 #include <sstream>
 
 inline string ToString(vec2 v2)
@@ -11,11 +11,13 @@ static float Global_Camera_LookZOffset = 0.0f;
 static float Global_Camera_FieldOfView = 75.0f;
 
 static bool  Global_Collision_DrawCollider = false;
+static bool  Global_Collision_Continuous = true;
 
 static float Global_Game_TimeSpeed          = 1.0f;
 static float Global_Game_BoostVelocity      = 75.0f;
 static float Global_Game_TrailRecordTimer   = 0.016f;
 static float Global_Game_DraftChargeTime    = 0.1f;
+static float Global_Game_DraftTailCharge    = 0.5f;
 static float Global_Game_ExplosionLifeTime  = 1.0f;
 static float Global_Game_ExplosionLightTime = 1.0f;
 static float Global_Game_WallRaiseTime      = 0.5f;
@@ -24,7 +26,14 @@ static float Global_Game_WallHeight         = 10.0f;
 
 static bool  Global_Renderer_DoPostFX = true;
 static bool  Global_Renderer_BloomEnabled = true;
-static float Global_Renderer_BloomBlurOffset = 1.8f;
+static int   Global_Renderer_BloomPassCount = 4;
+static int   Global_Renderer_BloomDownscale = 2;
+static float Global_Renderer_BloomThreshold = 0.0f;
+static float Global_Renderer_BloomIntensity = 3.0f;
+static float Global_Renderer_BloomRadius = 1.0f;
+static bool  Global_Renderer_TrackCulling = true;
+static bool  Global_Renderer_Instancing = true;
+static bool  Global_Renderer_FrustumCulling = true;
 static float Global_Renderer_FogStart = 500.0f;
 static float Global_Renderer_FogEnd = 1000.0f;
 
@@ -18,18 +18,29 @@ void DrawDebugUI(game_main *g, float dt)
     auto &updateTime = g->UpdateTime;
     auto &renderTime = g->RenderTime;
     auto playerEntity = g->World.PlayerEntity;
-    auto lanes = g->World.GenState->LaneSlots;
     ImGui::Text("ms: %.2f", dt * 1000.0f);
     ImGui::Text("FPS: %.5f", 1.0f/dt);
     ImGui::Text("Update time: %dms", updateTime.End - updateTime.Begin);
     ImGui::Text("Render time: %dms", renderTime.End - renderTime.Begin);
+    ImGui::Text("Tick: %llu (%dHz, alpha %.2f)", (unsigned long long)g->TickCount, GAME_TICK_RATE, g->RenderAlpha);
     ImGui::Text("Time elapsed: %.2f", g->LevelState.TimeElapsed);
     ImGui::Text("Player min vel: %.2f", g->LevelState.PlayerMinVel);
     ImGui::Text("Player max vel: %.2f", g->LevelState.PlayerMaxVel);
     ImGui::Text("Player vel: %s", ToString(playerEntity->Vel()).c_str());
     ImGui::Text("Checkpoint: %d", g->LevelState.CheckpointNum);
-    ImGui::Text("Checkpoint time: %.2f", float(g->LevelState.CurrentCheckpointFrame) / 60.0f);
-    ImGui::Text("Lanes: %d|%d|%d|%d|%d", lanes[0], lanes[1], lanes[2], lanes[3], lanes[4]);
+    ImGui::Text("Checkpoint time: %.2f", float(g->LevelState.CurrentCheckpointFrame) / GAME_TICK_RATE);
+    {
+        auto &lanes = g->World.LaneIndex;
+        float y = playerEntity->Pos().y + GEN_PLAYER_OFFSET;
+        int counts[LANE_INDEX_LANES];
+        for (int i = 0; i < LANE_INDEX_LANES; i++)
+        {
+            counts[i] = GetLaneCount(lanes, i, y - GEN_LANE_MARGIN, y + GEN_LANE_MARGIN);
+        }
+        ImGui::Text("Spawn lanes: %d|%d|%d|%d|%d (free mask 0x%02x)", counts[0], counts[1], counts[2], counts[3], counts[4],
+                    GetFreeLanes(lanes, y - GEN_LANE_MARGIN, y + GEN_LANE_MARGIN));
+        ImGui::Text("Lane index: %d entities, %d moved", lanes.NumEntities, lanes.NumMoved);
+    }
 	ImGui::Text("Road bounds: %.2f|%.2f", g->World.RoadState.Left, g->World.RoadState.Right);
 	ImGui::Text("min/max lanes: %d|%d", g->World.RoadState.MinLaneIndex, g->World.RoadState.MaxLaneIndex);
 	
@@ -72,23 +83,184 @@ void DrawDebugUI(game_main *g, float dt)
     if (ImGui::CollapsingHeader("Collision"))
     {
         ImGui::Checkbox("Draw Bounds", &Global_Collision_DrawCollider);
+        ImGui::Checkbox("Continuous", &Global_Collision_Continuous);
+
+        auto &index = g->World.TrackIndex;
+        ImGui::Text("Track index: %d entities, %zu buckets, %d moved", index.NumEntities, index.Buckets.size(), index.NumMoved);
+
+        static track_index_benchmark bench;
+        if (ImGui::Button("Benchmark track index (10k)"))
+        {
+            BenchmarkTrackIndex(bench, 10000);
+        }
+        if (bench.NumEntities > 0)
+        {
+            ImGui::Text("Insert: %.3fms", bench.InsertTime);
+            ImGui::Text("Update: %.3fms/frame", bench.UpdateTime);
+            ImGui::Text("%d queries: %.3fms (%zu hits)", bench.NumQueries, bench.QueryTime, bench.QueryHits);
+            ImGui::Text("%d linear scans: %.3fms (%zu hits)", bench.NumQueries, bench.LinearQueryTime, bench.LinearQueryHits);
+        }
+
+        auto &stats = g->World.CollisionStats;
+        ImGui::Text("Integrated: %d, sleeping: %d", stats.NumIntegrated, stats.NumSleeping);
+        ImGui::Text("Bounds rebuilt: %d local, %d world", stats.NumLocalUpdates, stats.NumBoxUpdates);
+        ImGui::Text("Integrate kernel: %s", CollisionKernelNames[g->World.IntegrateBatch.Kernel]);
+
+        static integrate_benchmark integrateBench;
+        if (ImGui::Button("Benchmark integrate (10k)"))
+        {
+            BenchmarkIntegrate(integrateBench, 10000);
+        }
+        if (integrateBench.NumEntities > 0)
+        {
+            for (int k = 0; k < CollisionKernel_count; k++)
+            {
+                if (!IsCollisionKernelSupported(collision_kernel(k))) continue;
+
+                ImGui::Text("  %s: %.3fms/frame", CollisionKernelNames[k], integrateBench.Time[k]);
+            }
+            ImGui::Text("  Per entity: %.3fms/frame, %s", integrateBench.EntityTime, integrateBench.Identical ? "identical" : "DIFFERENT");
+        }
+        ImGui::Text("Collision events: %zu", g->LevelState.CollisionEvents.size());
+        ImGui::Text("Player trail hits: %d, swept: %d", g->LevelState.NumTrailHits, g->LevelState.NumSweptTrailHits);
+
+        auto &bp = g->World.Broadphase;
+        ImGui::Text("Broadphase: %zu passive, %zu tests, %d workers", bp.Entries.size(), bp.NumTests, bp.NumWorkers);
+        for (int k = 0; k < CollisionKernel_count; k++)
+        {
+            if (!IsCollisionKernelSupported(collision_kernel(k))) continue;
+
+            if (ImGui::RadioButton(CollisionKernelNames[k], bp.Kernel == k))
+            {
+                bp.Kernel = collision_kernel(k);
+            }
+            ImGui::SameLine();
+        }
+        ImGui::NewLine();
+
+        static collision_benchmark collisionBench;
+        if (ImGui::Button("Benchmark broadphase (5k)"))
+        {
+            BenchmarkBroadphase(collisionBench, 5000, 16, &g->World.CollisionThreadPool);
+        }
+        if (collisionBench.NumPassive > 0)
+        {
+            ImGui::Text("Sweep: %zu tests", collisionBench.SweepTests);
+            for (int k = 0; k < CollisionKernel_count; k++)
+            {
+                if (!IsCollisionKernelSupported(collision_kernel(k))) continue;
+
+                ImGui::Text("  %s: %.3fms/frame", CollisionKernelNames[k], collisionBench.SweepTime[k]);
+            }
+            ImGui::Text("  %d workers: %.3fms/frame", collisionBench.NumWorkers, collisionBench.ParallelTime);
+            ImGui::Text("Brute force: %.3fms/frame (%zu tests)", collisionBench.BruteForceTime, collisionBench.BruteForceTests);
+            ImGui::Text("%zu collisions (%zu swept), %s", collisionBench.NumCollisions, collisionBench.NumSweptCollisions,
+                        collisionBench.Identical ? "identical" : "DIFFERENT");
+        }
         ImGui::Spacing();
     }
     if (ImGui::CollapsingHeader("Game"))
     {
+        auto &start = g->LevelState.StartSnapshot;
+        auto &checkpoint = g->LevelState.CheckpointSnapshot;
+        ImGui::Text("Start snapshot: %zu bytes, %d entities", start.Data.size(), start.NumEntities);
+        ImGui::Text("Checkpoint snapshot: %zu bytes, %d entities", checkpoint.Data.size(), checkpoint.NumEntities);
+        ImGui::Text("Last restore: %.3fms", std::max(start.LoadTime, checkpoint.LoadTime));
+
+        static world_snapshot saveState;
+        if (ImGui::Button("Save state"))
+        {
+            SaveWorldSnapshot(g, saveState);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load state"))
+        {
+            LoadWorldSnapshot(g, saveState);
+        }
+        if (!IsEmpty(saveState))
+        {
+            ImGui::Text("State: %zu bytes, saved in %.3fms, loaded in %.3fms", saveState.Data.size(), saveState.SaveTime, saveState.LoadTime);
+        }
         ImGui::Spacing();
     }
     if (ImGui::CollapsingHeader("Renderer"))
     {
-		ImGui::Text("Renderables: %lu", g->RenderState.FrameSolidRenderables.size() + g->RenderState.FrameTransparentRenderables.size());
+		ImGui::Text("Renderables: %zu (%zu transparent)", g->RenderState.RenderableCount, g->RenderState.NumTransparent);
+		ImGui::Text("Visible: %zu, culled: %zu", g->RenderState.NumVisible, g->RenderState.NumCulled);
+		ImGui::Text("Material blocks: %zu", g->RenderState.NumMaterials);
+		ImGui::Text("Instanced draws: %zu (%zu instances)", g->RenderState.NumInstancedDraws, g->RenderState.Instances.size());
+		auto &particles = g->World.Particles;
+		ImGui::Text("Particles: %zu/%d (%zu dropped)", particles.Particles.Count, PARTICLE_CAPACITY, particles.Particles.NumDropped);
+		ImGui::Text("Ribbons: %zu/%d (%zu dropped)", particles.Ribbons.Count, RIBBON_CAPACITY, particles.Ribbons.NumDropped);
+		static particle_benchmark particleBench;
+		if (ImGui::Button("Benchmark particles (30k)"))
+		{
+			BenchmarkParticles(particleBench, 30000, 256);
+		}
+		if (particleBench.NumFrames > 0)
+		{
+			ImGui::Text("  %d particles, %d ribbons, %zu instances", particleBench.NumParticles, particleBench.NumRibbons, particleBench.NumInstances);
+			ImGui::Text("  Update: %.3fms/frame, build: %.3fms/frame", particleBench.UpdateTime, particleBench.BuildTime);
+		}
+		ImGui::Text("Particle instances: %zu", g->RenderState.ParticleInstanceCount);
+        ImGui::Text("Models drawn: %d", g->World.NumDrawnModels);
+        ImGui::Text("Matrices built: %d, cached: %d", g->World.NumMatricesBuilt, g->World.NumMatricesCached);
+        auto &stream = Global_StreamBuffer;
+        ImGui::Text("Streamed: %.1f KB/frame of %zu KB (%s)", stream.BytesLastFrame / 1024.0f, stream.FrameSize / 1024,
+                    stream.Persistent ? "persistent" : "mapped ranges");
+        ImGui::Text("Stream stalls: %u, overflows (grown): %u", stream.NumStalls, stream.NumOverflows);
+        auto &pool = g->RenderState.TargetPool;
+        ImGui::Text("Render targets: %zu (%zu created, %zu destroyed)", pool.Targets.size(), pool.NumCreated, pool.NumDestroyed);
+        if (ImGui::TreeNode("GL state"))
+        {
+            auto &stats = Global_GLState.LastFrame;
+            uint32 totalIssued = 0, totalSkipped = 0;
+            ImGui::Columns(3);
+            ImGui::Text("Call"); ImGui::NextColumn();
+            ImGui::Text("Issued"); ImGui::NextColumn();
+            ImGui::Text("Skipped"); ImGui::NextColumn();
+            for (int i = 0; i < GLStateCall_count; i++)
+            {
+                ImGui::Text("%s", GLStateCallNames[i]); ImGui::NextColumn();
+                ImGui::Text("%u", stats.Issued[i]); ImGui::NextColumn();
+                ImGui::Text("%u", stats.Skipped[i]); ImGui::NextColumn();
+                totalIssued += stats.Issued[i];
+                totalSkipped += stats.Skipped[i];
+            }
+            ImGui::Text("Total"); ImGui::NextColumn();
+            ImGui::Text("%u", totalIssued); ImGui::NextColumn();
+            ImGui::Text("%u", totalSkipped); ImGui::NextColumn();
+            ImGui::Columns(1);
+            ImGui::TreePop();
+        }
 		ImGui::Spacing();
+        ImGui::Checkbox("Track culling", &Global_Renderer_TrackCulling);
+        ImGui::Checkbox("Instancing", &Global_Renderer_Instancing);
+        ImGui::Checkbox("Frustum culling", &Global_Renderer_FrustumCulling);
         ImGui::Checkbox("PostFX", &Global_Renderer_DoPostFX);
+        ImGui::Text("Post process: %.2f ms GPU", g->RenderState.PostProcessTimer.Milliseconds);
 		ImGui::SliderFloat("Bend radius", &g->RenderState.BendRadius, 0, 1000.0f, "%.2f");
 
         if (ImGui::TreeNode("Bloom"))
         {
 			ImGui::Checkbox("Enabled", &Global_Renderer_BloomEnabled);
-            ImGui::SliderFloat("Blur Offset", &Global_Renderer_BloomBlurOffset, 0.0f, 10.0f, "%.2f");
+            ImGui::SliderInt("Passes", &Global_Renderer_BloomPassCount, 1, BLOOM_MAX_PASSES);
+            ImGui::SliderInt("Downscale", &Global_Renderer_BloomDownscale, 1, 4);
+            ImGui::SliderFloat("Threshold", &Global_Renderer_BloomThreshold, 0.0f, 2.0f, "%.2f");
+            ImGui::SliderFloat("Intensity", &Global_Renderer_BloomIntensity, 0.0f, 10.0f, "%.2f");
+            ImGui::SliderFloat("Radius", &Global_Renderer_BloomRadius, 0.0f, 4.0f, "%.2f");
+
+            auto &bloomBench = g->RenderState.BloomBenchmark;
+            if (ImGui::Button("Benchmark bloom (10x)"))
+            {
+                bloomBench.Pending = true;
+            }
+            if (bloomBench.NumRuns > 0)
+            {
+                ImGui::Text("  Separable blur: %.3fms, mip chain: %.3fms", bloomBench.BlurTime, bloomBench.ChainTime);
+                ImGui::Text("  Image diff: max %d, mean %.2f (%s)", bloomBench.MaxDiff, bloomBench.MeanDiff,
+                            bloomBench.WithinThreshold ? "within threshold" : "OVER THRESHOLD");
+            }
             ImGui::TreePop();
         }
 		if (ImGui::TreeNode("Fog"))
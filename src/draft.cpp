@@ -21,8 +21,11 @@
 #include "gui.cpp"
 #include "debug_ui.cpp"
 #include "meshes.cpp"
+#include "track_index.cpp"
+#include "particles.cpp"
 #include "entity.cpp"
 #include "generate.cpp"
+#include "snapshot.cpp"
 #include "init.cpp"
 #include "menu_state.cpp"
 #include "level_state.cpp"
@@ -37,6 +40,8 @@ extern "C"
         int Width = g->Width;
         int Height = g->Height;
 		Global_Platform = &g->Platform;
+        g->TickTime = 1.0f / GAME_TICK_RATE;
+        g->Entropy = RandomSeed(g->Seed);
 
         ImGui_ImplSdlGL3_Init(g->Window);
 
@@ -214,6 +219,7 @@ extern "C"
 		MusicMasterExit(game->MusicMaster);
 		StopThreadPool(game->AssetLoader.Pool);
 		StopThreadPool(game->World.UpdateThreadPool);
+		StopThreadPool(game->World.CollisionThreadPool);
 
 		//game->MusicMaster.StopLoop = false;
 		//RestartThreadPool(game->AssetLoader.Pool);
@@ -234,6 +240,11 @@ extern "C"
 		Global_Platform = &game->Platform;
 
 		ResetProfileTimers();
+		g->TickCount++;
+		g->PrevCameraPosition = g->Camera.Position;
+		g->PrevCameraLookAt = g->Camera.LookAt;
+		SaveEntityTransforms(g->World);
+
 		MusicMasterTick(g->MusicMaster, dt);
         if (IsJustPressed(g, Action_debugUI))
         {
@@ -254,11 +265,18 @@ extern "C"
             }
         }
 #endif
+
+        if (g->ComputeChecksum)
+        {
+            g->Checksum = GetWorldChecksum(g->World);
+        }
     }
 
     export_func GAME_RENDER(GameRender)
     {
         auto g = game;
+        BeginGLStateFrame();
+        BeginStreamFrame(Global_StreamBuffer);
         ImGui_ImplSdlGL3_NewFrame(g->Window);
         MakeCameraPerspective(g->Camera, (float)g->Width, (float)g->Height, Global_Camera_FieldOfView, 0.1f, 1000.0f);
         MakeCameraPerspective(g->FinalCamera, (float)g->Width, (float)g->Height, Global_Camera_FieldOfView, 0.1f, 1000.0f);
@@ -281,12 +299,15 @@ extern "C"
 
         DrawDebugUI(g, dt);
         ImGui::Render();
+        EndStreamFrame(Global_StreamBuffer);
+        EndRenderTargetFrame(g->RenderState);
     }
 
     export_func GAME_DESTROY(GameDestroy)
     {
         auto g = game;
         ImGui_ImplSdlGL3_Shutdown();
+        DestroyRenderTargets(g->RenderState);
         DestroyAssetLoader(g->AssetLoader);
     }
 }
@@ -14,6 +14,7 @@
 #include "config.h"
 #include "common.h"
 #include "collision.h"
+#include "track_index.h"
 #include "memory.h"
 #include "tween.h"
 #include "options.h"
@@ -23,8 +24,10 @@
 #include "asset.h"
 #include "gui.h"
 #include "random.h"
+#include "particles.h"
 #include "entity.h"
 #include "generate.h"
+#include "snapshot.h"
 #include "menu_state.h"
 #include "level_state.h"
 
@@ -62,6 +65,13 @@ struct platform_api
 
 static platform_api *Global_Platform;
 
+// The simulation always advances in ticks of 1/GAME_TICK_RATE seconds,
+// the level timeline is counted in ticks too. Lower rates rely on the
+// continuous collision so thin colliders aren't skipped
+#ifndef GAME_TICK_RATE
+#define GAME_TICK_RATE 60
+#endif
+
 #define GAME_INIT(name) void name(game_main *game)
 #define GAME_RELOAD(name) void name(game_main *game)
 #define GAME_UNLOAD(name) void name(game_main *game)
@@ -171,6 +181,12 @@ struct game_main
     profile_time UpdateTime;
     profile_time RenderTime;
 
+    // set by the platform before rendering, how far between the
+    // previous and the current tick the frame is
+    float TickTime = 1.0f / GAME_TICK_RATE;
+    float RenderAlpha = 1.0f;
+    uint64 TickCount = 0;
+
 	music_master MusicMaster;
 	asset_loader AssetLoader;
     gui GUI;
@@ -182,6 +198,8 @@ struct game_main
     memory_arena Arena;
     camera Camera;
     camera FinalCamera;
+    vec3 PrevCameraPosition;
+    vec3 PrevCameraLookAt;
     vec3 Gravity;
     entity_world World;
     level_state LevelState;
@@ -190,6 +208,13 @@ struct game_main
     random_series ExplosionEntropy;
 	float ScreenRectAlpha;
 
+    // set by the platform before GameInit, every random series of the
+    // game is seeded from it so a replay can run the same game again
+    uint32 Seed = 0;
+    random_series Entropy;
+    bool ComputeChecksum = false;
+    uint32 Checksum = 0;
+
 	void *GameLibrary;
     platform_api Platform;
 	SDL_Window *Window;
@@ -30,7 +30,7 @@ static collider *CreateCollider(allocator *alloc, collider_type type, vec3 scale
     return result;
 }
 
-#define TRAIL_SIZE (sizeof(trail) + (sizeof(trail_piece)+sizeof(collider))*TRAIL_COUNT)
+#define TRAIL_SIZE (sizeof(trail))
 static trail *CreateTrail(allocator *alloc, entity *Owner, color Color,
 						  float radius = 0.5f, bool renderOnly = false)
 {
@@ -42,14 +42,13 @@ static trail *CreateTrail(allocator *alloc, entity *Owner, color Color,
 	{
 		auto ent = result->Entities + i;
 		ent->Transform.Position = vec3(0.0f);
-		if (!renderOnly)
-		{
-			ent->TrailPiece = PushStruct<trail_piece>(alloc);
-			ent->TrailPiece->Owner = Owner;
-			ent->Collider = PushStruct<collider>(alloc);
-			ent->Collider->Type = ColliderType_TrailPiece;
-			AddFlags(ent, EntityFlag_Kinematic);
-		}
+	}
+	if (!renderOnly)
+	{
+		result->Owner = Owner;
+		result->Collider.Type = ColliderType_Trail;
+		result->Collider.Segments = result->Segments;
+		result->Collider.NumSegments = TRAIL_COUNT;
 	}
 	return result;
 }
@@ -65,7 +64,7 @@ static trail_group *CreateTrailGroup(allocator *alloc, entity *owner, color c,
 	  result->Entities.resize(count);
     result->PointCache.resize(count);
 
-    InitMeshBuffer(result->Mesh.Buffer);
+    InitMeshBuffer(result->Mesh.Buffer, true);
     result->Model.Mesh = &result->Mesh;
 
     const size_t LineCount = count*TRAIL_COUNT*2;
@@ -81,13 +80,21 @@ static trail_group *CreateTrailGroup(allocator *alloc, entity *owner, color c,
     // right line
     AddPart(&result->Mesh, { CreateMaterial(alloc, c, emission, 0, NULL), PlaneCount + LineCount, LineCount, GL_LINES});
 
-	ReserveVertices(result->Mesh.Buffer, PlaneCount + LineCount * 2, GL_DYNAMIC_DRAW);
+	// built in place every update and streamed when drawn
+	auto &buffer = result->Mesh.Buffer;
+	ResetBuffer(buffer, PlaneCount + LineCount * 2);
+	buffer.Vertices.resize(buffer.RawIndex);
 
 	for (size_t i = 0; i < count; i++)
 	{
 		auto ent = PushStruct<entity>(alloc);
 		ent->Transform.Position = vec3(0.0f);
 		ent->Trail = CreateTrail(alloc, owner, c, radius, renderOnly);
+		if (!renderOnly)
+		{
+			ent->Collider = &ent->Trail->Collider;
+			AddFlags(ent, EntityFlag_Kinematic);
+		}
 
 		result->Entities[i] = ent;
 		result->PointCache[i] = (vec3 *)PushSize(alloc, TRAIL_COUNT*4*sizeof(vec3), "trail group point cache");
@@ -136,6 +143,7 @@ entity *CreateShipEntity(allocator *alloc, mesh *shipMesh, color c, color outlin
     ent->Ship = PushStruct<ship>(alloc);
     ent->Ship->Color = c;
     ent->Ship->OutlineColor = outlineColor;
+    ent->Ship->ColorIndex = colorIndex;
 	  ent->LaneSlot = CreateLaneSlot(alloc, lane);
 
     bool trailRenderOnly = isPlayer || (colorIndex == SHIP_RED);
@@ -214,33 +222,19 @@ entity *CreatePowerupEntity(allocator *alloc, random_series &series, float timeS
     return result;
 }
 
-#define EXPLOSION_ENTITY_SIZE (sizeof(entity) + sizeof(audio_source) + sizeof(lane_slot) + sizeof(explosion) + TRAIL_GROUP_SIZE(EXPLOSION_PARTS_COUNT))
+// The parts are emitted to the particle system when the explosion starts
+#define EXPLOSION_ENTITY_SIZE (sizeof(entity) + sizeof(audio_source) + sizeof(lane_slot) + sizeof(explosion))
 entity *CreateExplosionEntity(allocator *alloc, asset_loader &loader, vec3 pos, vec3 vel, color c, color outlineColor, vec3 sign, int lane = 0)
 {
     auto exp = PushStruct<explosion>(alloc);
-	auto tg = CreateTrailGroup(alloc, NULL, c, 0.2, true, EXPLOSION_PARTS_COUNT);
     exp->LifeTime = Global_Game_ExplosionLifeTime;
     exp->Color = c;
-    InitMeshBuffer(exp->Mesh.Buffer);
-
-    const float count = EXPLOSION_PARTS_COUNT;
-    const float theta = M_PI*2 / count;
-    float angle = 0;
-    for (int i = 0; i < count; i++)
-    {
-        angle += theta;
-
-        auto ent = tg->Entities[i];
-        ent->SetPos(pos);
-        ent->Vel().x = std::cos(angle)*10.0f;
-        ent->Vel().y = vel.y + std::sin(angle)*10.0f;
-    }
 
     auto result = CreateEntity(alloc);
 	result->Type = EntityType_Explosion;
     result->Transform.Position = pos;
+    result->Transform.Velocity = vel;
     result->Explosion = exp;
-	result->TrailGroup = tg;
 	result->AudioSource = CreateAudioSource(alloc, FindSound(loader, "explosion", "main_assets"));
 	result->LaneSlot = CreateLaneSlot(alloc, lane, false);
     return result;
@@ -297,6 +291,16 @@ entity *CreateEnemySkullEntity(allocator *alloc, mesh *skullMesh)
 	return result;
 }
 
+#define RANDOM_GEOMETRY_ENTITY_SIZE (sizeof(entity)+sizeof(model)+sizeof(frame_rotation))
+entity *CreateRandomGeometryEntity(allocator *alloc, mesh *geometryMesh)
+{
+	auto result = CreateEntity(alloc);
+	result->Type = EntityType_RandomGeometry;
+	result->Model = CreateModel(alloc, geometryMesh);
+	result->FrameRotation = PushStruct<frame_rotation>(alloc);
+	return result;
+}
+
 float Interp(float c, float t, float a, float dt)
 {
     if (c == t)
@@ -487,6 +491,7 @@ void InitEntityWorld(game_main *g, entity_world &world)
     world.CheckpointPool.ElemSize = CHECKPOINT_ENTITY_SIZE;
 	world.FinishPool.ElemSize = FINISH_ENTITY_SIZE;
 	world.EnemySkullPool.ElemSize = ENEMY_SKULL_ENTITY_SIZE;
+	world.RandomGeometryPool.ElemSize = RANDOM_GEOMETRY_ENTITY_SIZE;
 
     world.ShipPool.Arena = &world.Arena;
     world.CrystalPool.Arena = &world.Arena;
@@ -497,6 +502,7 @@ void InitEntityWorld(game_main *g, entity_world &world)
 	world.FinishPool.Arena = &world.Arena;
 	world.UpdateArgsPool.Arena = &world.Arena;
 	world.EnemySkullPool.Arena = &world.Arena;
+	world.RandomGeometryPool.Arena = &world.Arena;
 
     world.ShipPool.Name = "ShipPool";
     world.CrystalPool.Name = "CrystalPool";
@@ -506,8 +512,11 @@ void InitEntityWorld(game_main *g, entity_world &world)
     world.CheckpointPool.Name = "CheckpointPool";
 	world.FinishPool.Name = "FinishPool";
 	world.EnemySkullPool.Name = "EnemySkullPool";
+	world.RandomGeometryPool.Name = "RandomGeometryPool";
 
+	InitParticleSystem(world.PersistentArena, world.Particles, g->Seed);
 	CreateThreadPool(world.UpdateThreadPool, g, std::thread::hardware_concurrency(), 8);
+	CreateThreadPool(world.CollisionThreadPool, g, std::max(int(std::thread::hardware_concurrency()) - 1, 0), 1);
 }
 
 // Finds the first free slot on the list and insert the entity
@@ -527,6 +536,7 @@ void AddEntityToList(std::vector<entity *> &list, entity *ent)
 
 void AddEntity(entity_world &world, entity *ent)
 {
+	ent->InWorld = true;
 	if (ent->Type == EntityType_EnemySkull)
 	{
 		AddEntityToList(world.EnemySkullEntities, ent);
@@ -596,6 +606,7 @@ void AddEntity(entity_world &world, entity *ent)
     if (ent->LaneSlot && ent->LaneSlot->Occupy)
     {
         AddEntityToList(world.LaneSlotEntities, ent);
+        AddToLaneIndex(world.LaneIndex, ent);
     }
     if (ent->FrameRotation)
     {
@@ -621,6 +632,8 @@ void AddEntity(entity_world &world, entity *ent)
     {
         AddEntityToList(world.MovementEntities, ent);
     }
+    AddToTrackIndex(world.TrackIndex, ent);
+    ent->PrevTransform = ent->Transform;
     world.NumEntities++;
 }
 
@@ -638,9 +651,15 @@ void RemoveEntityFromList(std::vector<entity *> &list, entity *ent)
 
 void RemoveEntity(entity_world &world, entity *ent)
 {
+	ent->InWorld = false;
 	if (ent->Type == EntityType_EnemySkull)
 	{
 		RemoveEntityFromList(world.EnemySkullEntities, ent);
+		FreeEntry(world.EnemySkullPool, ent->PoolEntry);
+	}
+	if (ent->Type == EntityType_RandomGeometry)
+	{
+		FreeEntry(world.RandomGeometryPool, ent->PoolEntry);
 	}
 	if (ent->RoadPiece)
 	{
@@ -709,6 +728,7 @@ void RemoveEntity(entity_world &world, entity *ent)
     if (ent->LaneSlot && ent->LaneSlot->Occupy)
     {
         RemoveEntityFromList(world.LaneSlotEntities, ent);
+        RemoveFromLaneIndex(world.LaneIndex, ent);
     }
     if (ent->FrameRotation)
     {
@@ -738,6 +758,7 @@ void RemoveEntity(entity_world &world, entity *ent)
     {
         RemoveEntityFromList(world.MovementEntities, ent);
     }
+    RemoveFromTrackIndex(world.TrackIndex, ent);
     world.NumEntities = std::max(0, world.NumEntities - 1);
 }
 
@@ -746,6 +767,8 @@ void InitWorldCommonEntities(entity_world &w, asset_loader *loader, camera *cam)
 	DebugLogCall();
 	w.RoadMeshManager.Arena.Free = false;
 
+    ClearTrackIndex(w.TrackIndex);
+    ClearLaneIndex(w.LaneIndex, w.LaneSlotEntities);
     FreeArena(w.Arena);
     w.AsteroidEntities.clear();
     w.CrystalEntities.clear();
@@ -754,6 +777,7 @@ void InitWorldCommonEntities(entity_world &w, asset_loader *loader, camera *cam)
     w.LaneSlotEntities.clear();
     w.ModelEntities.clear();
     w.MovementEntities.clear();
+	w.EnemySkullEntities.clear();
     w.RotatingEntities.clear();
     w.RemoveOffscreenEntities.clear();
     w.RepeatingEntities.clear();
@@ -772,7 +796,10 @@ void InitWorldCommonEntities(entity_world &w, asset_loader *loader, camera *cam)
     ResetPool(w.ExplosionPool);
     ResetPool(w.ShipPool);
     ResetPool(w.PowerupPool);
+	ResetPool(w.EnemySkullPool);
+	ResetPool(w.RandomGeometryPool);
 	ResetPool(w.UpdateArgsPool);
+	ResetParticleSystem(w.Particles);
 
 	DebugLog("GenState");
 
@@ -836,6 +863,7 @@ void ResetRoadPieces(entity_world &world, float baseY)
     {
         auto ent = world.RoadPieceEntities[i];
         ent->Pos().y = baseY + i*ROAD_SEGMENT_SIZE;
+        MarkTrackIndexMoved(world.TrackIndex, ent);
     }
 }
 
@@ -851,31 +879,9 @@ entity_update_args *GetUpdateArg(entity_world &world, entity *ent, float dt)
 }
 
 #define WORLD_ARC_RADIUS   500.0f
-#define WORLD_ARC_Y_FACTOR 0.005f
-vec3 WorldToRenderTransformInner(const vec3 &worldPos, const float radius)
-{
-	float r = (radius - worldPos.z);
-	float d = worldPos.y*WORLD_ARC_Y_FACTOR;
-	vec3 result = worldPos;
-	result.y = std::cos(d) * r;
-	result.z = std::sin(d) * r;
-	return result;
-}
-
 vec3 WorldToRenderTransform(entity_world &w, const vec3 &worldPos, const float radius)
 {
-    vec3 tangentWorldPoint = vec3{ worldPos.x, w.RoadTangentPoint, worldPos.z };
-	vec3 result = WorldToRenderTransformInner(worldPos, radius);
-	vec3 rtdir = glm::normalize(vec3{ 0, -result.z, result.y });
-
-	if (worldPos.y >= tangentWorldPoint.y)
-	{
-		vec3 tangentPoint = WorldToRenderTransformInner(tangentWorldPoint, radius);
-		vec3 tangentDir = glm::normalize(vec3{ 0, -tangentPoint.z, tangentPoint.y });
-		result = tangentPoint + (tangentDir * ((worldPos.y - tangentWorldPoint.y) * (radius * WORLD_ARC_Y_FACTOR)));
-	}
-
-    return result;
+    return BendWorldPoint(worldPos, radius, w.RoadTangentPoint);
 }
 
 static void SetSingleTrailPosition(entity *ent)
@@ -883,6 +889,33 @@ static void SetSingleTrailPosition(entity *ent)
 	ent->TrailGroup->Entities[0]->SetPos(ent->Pos());
 }
 
+// Collapses the trails to the entity's position, like when it's created
+void ResetTrailGroup(entity_world &world, entity *ent)
+{
+	auto tg = ent->TrailGroup;
+	tg->Timer = 0;
+	tg->FirstFrame = true;
+	for (int j = 0; j < tg->Count; j++)
+	{
+		auto trailEntity = tg->Entities[j];
+		auto tr = trailEntity->Trail;
+		tr->Timer = 0;
+		tr->PositionStackIndex = 0;
+		trailEntity->SetPos(ent->Pos());
+		MarkTrackIndexMoved(world.TrackIndex, trailEntity);
+		for (int i = 0; i < TRAIL_COUNT; i++)
+		{
+			tr->Entities[i].SetPos(ent->Pos());
+			tr->Segments[i] = BoundsFromMinMax(ent->Pos(), ent->Pos());
+		}
+		if (!tr->RenderOnly)
+		{
+			tr->Collider.Box = BoundsFromMinMax(ent->Pos(), ent->Pos());
+			tr->Collider.Motion = vec3(0.0f);
+		}
+	}
+}
+
 #define ENTITY_JOB_UNPACK_ARGS(arg) \
 	auto args = (entity_update_args *)arg; \
 	auto &world = *args->World; \
@@ -891,10 +924,10 @@ static void SetSingleTrailPosition(entity *ent)
 
 #define ENTITY_JOB_FREE_ARGS(arg) FreeEntry(world.UpdateArgsPool, args->Entry)
 
-static void UpdateTrailGroupEntityJob(void *arg)
+// Runs on the main thread: it marks the trail entities in the track
+// index, whose moved list isn't safe to push to from the update jobs
+static void UpdateTrailGroupEntity(entity_world &world, entity *ent, float dt)
 {
-	ENTITY_JOB_UNPACK_ARGS(arg);
-
 	if (!ent->Explosion)
 	{
 		SetSingleTrailPosition(ent);
@@ -914,8 +947,6 @@ static void UpdateTrailGroupEntityJob(void *arg)
 		}
 	}
 
-	BeginProfileTimer("Trail push position");
-
 	tg->Timer -= dt;
 	if (tg->Timer <= 0)
 	{
@@ -925,18 +956,19 @@ static void UpdateTrailGroupEntityJob(void *arg)
 			PushPosition(tg->Entities[i]->Trail, tg->Entities[i]->Pos());
 		}
 	}
-	EndProfileTimer("Trail push position");
 
 	auto &m = tg->Mesh;
-	float *bufferData = MapBuffer(m.Buffer, GL_WRITE_ONLY);
+	float *bufferData = m.Buffer.Vertices.data();
 
-	BeginProfileTimer("Trail build quads");
 	for (int j = 0; j < tg->Count; j++)
 	{
+		auto tr = tg->Entities[j]->Trail;
+		vec3 boundsMin = vec3(std::numeric_limits<float>::max());
+		vec3 boundsMax = vec3(-std::numeric_limits<float>::max());
+
 		// First store the quads, then the lines
 		for (int i = 0; i < TRAIL_COUNT; i++)
 		{
-			auto tr = tg->Entities[j]->Trail;
 			auto pieceEntity = tr->Entities + i;
 			vec3 c1 = pieceEntity->Transform.Position;
 			vec3 c2;
@@ -972,17 +1004,28 @@ static void UpdateTrailGroupEntityJob(void *arg)
 			tg->PointCache[j][i * 4 + 1] = p3 - vec3(lo, 0, 0);
 			tg->PointCache[j][i * 4 + 2] = p2 + vec3(lo, 0, 0);
 			tg->PointCache[j][i * 4 + 3] = p4 + vec3(lo, 0, 0);
-			if (pieceEntity->Collider)
+			if (!tr->RenderOnly)
 			{
-				auto &box = pieceEntity->Collider->Box;
+				auto &box = tr->Segments[i];
 				box.Half = vec3(r, (c2.y - c1.y) * 0.5f, 0.5f);
 				box.Center = vec3(c1.x, c1.y + box.Half.y, c1.z + box.Half.z);
+
+				// the half length is negative if the trail goes backwards
+				vec3 half = glm::abs(box.Half);
+				boundsMin = glm::min(boundsMin, box.Center - half);
+				boundsMax = glm::max(boundsMax, box.Center + half);
 			}
 		}
+
+		if (!tr->RenderOnly)
+		{
+			// padded so rounding can't make it smaller than a segment
+			tr->Collider.Box = BoundsFromMinMax(boundsMin - vec3(1e-3f), boundsMax + vec3(1e-3f));
+			tr->Collider.Motion = tr->Owner->Vel() * dt;
+			MarkTrackIndexMoved(world.TrackIndex, tg->Entities[j]);
+		}
 	}
-	EndProfileTimer("Trail build quads");
 
-	BeginProfileTimer("Trail build lines");
 	for (int j = 0; j < tg->Count; j++)
 	{
 		for (int i = 0; i < TRAIL_COUNT; i++)
@@ -996,9 +1039,28 @@ static void UpdateTrailGroupEntityJob(void *arg)
 			bufferData = AddLine(bufferData, *p++, *p++);
 		}
 	}
-	EndProfileTimer("Trail build lines");
+}
 
-	ENTITY_JOB_FREE_ARGS(args);
+#define EXPLOSION_SPARK_COUNT 48
+static void EmitExplosion(particle_system &ps, vec3 pos, vec3 vel, color c)
+{
+    const float count = EXPLOSION_PARTS_COUNT;
+    const float theta = M_PI*2 / count;
+    float angle = 0;
+    for (int i = 0; i < count; i++)
+    {
+        angle += theta;
+
+        vec3 partVel = vec3{std::cos(angle)*10.0f, vel.y + std::sin(angle)*10.0f, 0.0f};
+        EmitRibbon(ps, pos, partVel, c, 0.2f, Global_Game_ExplosionLifeTime);
+    }
+    for (int i = 0; i < EXPLOSION_SPARK_COUNT; i++)
+    {
+        float a = RandomBetween(ps.Entropy, 0.0f, float(M_PI*2));
+        float speed = RandomBetween(ps.Entropy, 5.0f, 20.0f);
+        vec3 sparkVel = vec3{std::cos(a)*speed, vel.y + std::sin(a)*speed, RandomBetween(ps.Entropy, 0.0f, 5.0f)};
+        EmitParticle(ps, pos, sparkVel, c, 0.05f, RandomBetween(ps.Entropy, 0.3f, 1.0f)*Global_Game_ExplosionLifeTime);
+    }
 }
 
 void UpdateExplosionEntityJob(void *arg)
@@ -1010,25 +1072,13 @@ void UpdateExplosionEntityJob(void *arg)
 	{
 		AudioSourceSetPitch(ent->AudioSource, LaneIndexToPitch(ent->LaneSlot->Index));
 		AudioSourcePlay(ent->AudioSource);
+		EmitExplosion(world.Particles, ent->Pos(), ent->Vel(), exp->Color);
 	}
 
 	exp->LifeTime -= dt;
 	if (exp->LifeTime <= 0)
 	{
 		RemoveEntity(world, ent);
-		return;
-	}
-
-	float alpha = exp->LifeTime / Global_Game_ExplosionLifeTime;
-	for (int i = 0; i < EXPLOSION_PARTS_COUNT; i++)
-	{
-		auto partEnt = ent->TrailGroup->Entities[i];
-		partEnt->Transform.Position += partEnt->Transform.Velocity * dt;
-	}
-
-	for (auto &meshPart : ent->TrailGroup->Mesh.Parts)
-	{
-		meshPart.Material->DiffuseColor.a = alpha;
 	}
 
 	ENTITY_JOB_FREE_ARGS(args);
@@ -1044,7 +1094,95 @@ static bool IsInsideRoadPiece(entity *roadEntity, entity *playerEntity)
 
 void UpdateLogiclessEntities(entity_world &world, float dt)
 {
-	
+    for (auto ent : world.ExplosionEntities)
+    {
+        if (!ent) continue;
+        UpdateExplosionEntityJob(GetUpdateArg(world, ent, dt));
+    }
+
+    // builds the trail meshes and the colliders the next tick tests, one
+    // timer for all of them, there's only room for a few per frame
+    BeginProfileTimer("Trails");
+    for (auto ent : world.TrailGroupEntities)
+    {
+        if (!ent) continue;
+        UpdateTrailGroupEntity(world, ent, dt);
+    }
+    EndProfileTimer("Trails");
+
+    float cullY = -std::numeric_limits<float>::infinity();
+    if (world.Camera)
+    {
+        cullY = world.Camera->Position.y;
+    }
+    UpdateParticleSystem(world.Particles, cullY, dt);
+
+    BeginProfileTimer("Track index");
+    UpdateTrackIndex(world.TrackIndex);
+    UpdateLaneIndex(world.LaneIndex, world.LaneSlotEntities);
+    EndProfileTimer("Track index");
+
+    // the entities flagged to be removed are gone once they're a segment
+    // behind the camera, none of them come back (ships are slower than
+    // the player) and their triggers have fired by then
+    auto &offscreen = world.TrackIndex.QueryCache;
+    QueryTrackIndex(world.TrackIndex, -std::numeric_limits<float>::infinity(), cullY - ROAD_SEGMENT_SIZE, TRACK_ANY_LANE, offscreen);
+    for (auto ent : offscreen)
+    {
+        if (ent->Flags & EntityFlag_RemoveOffscreen)
+        {
+            RemoveEntity(world, ent);
+        }
+    }
+}
+
+// Called at the start of every tick, before anything moves
+void SaveEntityTransforms(entity_world &world)
+{
+    for (auto ent : world.ModelEntities)
+    {
+        if (!ent) continue;
+        ent->PrevTransform = ent->Transform;
+    }
+}
+
+// FNV-1a over the state of the moving entities, used by the replays to
+// check that the simulation didn't diverge. The entity hashes are summed
+// so the checksum doesn't depend on which list slot an entity got, a
+// restored snapshot has the same checksum as the world it was taken from
+inline static void HashBytes(uint32 &hash, const void *data, size_t size)
+{
+    auto bytes = (const uint8 *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+}
+
+uint32 GetWorldChecksum(entity_world &world)
+{
+    uint32 result = 2166136261u;
+    HashBytes(result, &world.NumEntities, sizeof(world.NumEntities));
+    for (auto ent : world.ModelEntities)
+    {
+        if (!ent) continue;
+
+        uint32 hash = 2166136261u;
+        HashBytes(hash, &ent->Transform.Position, sizeof(vec3));
+        HashBytes(hash, &ent->Transform.Velocity, sizeof(vec3));
+        result += hash;
+    }
+    return result;
+}
+
+inline static transform InterpolateTransform(const transform &prev, const transform &curr, float alpha)
+{
+    transform result = curr;
+    result.Position = glm::mix(prev.Position, curr.Position, alpha);
+    result.Scale = glm::mix(prev.Scale, curr.Scale, alpha);
+    result.Rotation = glm::mix(prev.Rotation, curr.Rotation, alpha);
+    return result;
 }
 
 void WaitUpdate(entity_world &world)
@@ -1071,24 +1209,80 @@ void RenderBackground(game_main *g, entity_world &w)
     End(g->GUI);
 }
 
-void RenderEntityWorld(render_state &rs, entity_world &world, float dt)
+void RenderEntityWorld(render_state &rs, entity_world &world, float alpha)
 {
 	RenderBackground(rs, world.BackgroundState);
     for (auto ent : world.TrailGroupEntities)
     {
         if (!ent) continue;
         auto tg = ent->TrailGroup;
-        UnmapBuffer(tg->Mesh.Buffer);
-        DrawModel(rs, tg->Model, transform{});
+        if (StreamVertices(Global_StreamBuffer, tg->Mesh.Buffer))
+        {
+            DrawModel(rs, tg->Model, transform{});
+        }
     }
-    for (auto ent : world.ModelEntities)
+    DrawParticleSystem(rs, world.Particles);
+    auto &drawList = world.DrawEntities;
+    drawList.clear();
+    if (Global_Renderer_TrackCulling && world.Camera)
     {
-        if (!ent) continue;
-        if (ent->Model->Visible)
+        // only what's behind the camera is skipped, the world is bent when
+        // rendered so a range in front of it doesn't map to the frustum,
+        // that side is left to the frustum culling
+        auto &visible = world.TrackIndex.QueryCache;
+        float minY = world.Camera->Position.y - ROAD_SEGMENT_SIZE - world.TrackIndex.MaxHalfY;
+        QueryTrackIndex(world.TrackIndex, minY, std::numeric_limits<float>::infinity(), TRACK_ANY_LANE, visible);
+        for (auto ent : visible)
+        {
+            if (ent->Model && ent->Model->Visible)
+            {
+                drawList.push_back(ent);
+            }
+        }
+    }
+    else
+    {
+        for (auto ent : world.ModelEntities)
         {
-            DrawModel(rs, *ent->Model, ent->Transform);
+            if (!ent) continue;
+            if (ent->Model->Visible)
+            {
+                drawList.push_back(ent);
+            }
         }
     }
+
+    // static entities keep the matrix of the previous frame, the rest are
+    // rebuilt in one batch
+    auto &dirty = world.DirtyEntities;
+    dirty.clear();
+    ClearTransformBatch(world.DirtyTransforms);
+    for (auto ent : drawList)
+    {
+        transform t = InterpolateTransform(ent->PrevTransform, ent->Transform, alpha);
+        if (ent->DrawMatrixValid && SameMatrixTransform(t, ent->DrawTransform))
+        {
+            continue;
+        }
+        ent->DrawTransform = t;
+        AddToTransformBatch(world.DirtyTransforms, t);
+        dirty.push_back(ent);
+    }
+    world.DirtyMatrices.resize(dirty.size());
+    ComputeTransformMatrices(world.DirtyTransforms, world.DirtyMatrices.data());
+    for (size_t i = 0; i < dirty.size(); i++)
+    {
+        dirty[i]->DrawMatrix = world.DirtyMatrices[i];
+        dirty[i]->DrawMatrixValid = true;
+    }
+
+    for (auto ent : drawList)
+    {
+        DrawModel(rs, *ent->Model, ent->DrawTransform, ent->DrawMatrix);
+    }
+    world.NumDrawnModels = int(drawList.size());
+    world.NumMatricesBuilt = int(dirty.size());
+    world.NumMatricesCached = int(drawList.size() - dirty.size());
     if (world.LastExplosion)
     {
         ApplyExplosionLight(rs, world.LastExplosion->Color);
@@ -70,7 +70,6 @@ struct finish
 struct explosion;
 struct trail;
 struct trail_group;
-struct trail_piece;
 
 #define EntityFlag_Kinematic          0x1
 #define EntityFlag_IsPlayer           0x2
@@ -84,6 +83,28 @@ struct collider
     vec3 Scale = vec3(1.0f);
 	collider_type Type;
 	bool Active = false; // Passive if false
+
+    // a compound collider: Box covers all the segments, and they're
+    // only tested when it overlaps
+    bounding_box *Segments = NULL;
+    int NumSegments = 0;
+
+    // what Box was last built from, it's only rebuilt when one of them
+    // changes. LocalBox is relative to the entity's position
+    bounding_box LocalBox;
+    vec3 BoundsPosition = vec3(0.0f);
+    vec3 BoundsScale = vec3(0.0f);
+    vec3 BoundsColliderScale = vec3(0.0f);
+    mesh *BoundsMesh = NULL;
+
+    // kinematic colliders that stay still for a while are skipped by
+    // Integrate until they move again
+    int StillFrames = 0;
+    bool Sleeping = false;
+
+    // how much Box moved in the last Integrate, the continuous
+    // collision sweeps it back to where it was
+    vec3 Motion = vec3(0.0f);
 };
 
 struct audio_source
@@ -105,8 +126,22 @@ struct road_piece
 struct entity
 {
     transform Transform;
+
+    // the transform at the start of the tick, rendering interpolates
+    // from it to the current one
+    transform PrevTransform;
+
+    // the matrix the entity was last drawn with and the interpolated
+    // transform it was built from, it's only rebuilt when that changes
+    transform DrawTransform;
+    mat4 DrawMatrix;
+    bool DrawMatrixValid = false;
+
     uint32 Flags = 0;
     int NumCollisions = 0;
+    int TrackKey = TRACK_KEY_NONE;
+    int LaneKey = TRACK_KEY_NONE;
+    bool InWorld = false; // between AddEntity and RemoveEntity
     memory_pool_entry *PoolEntry = NULL;
 	entity_type Type = EntityType_Invalid;
 
@@ -119,7 +154,6 @@ struct entity
     ship *Ship = NULL;
 	trail *Trail = NULL;
 	trail_group *TrailGroup = NULL;
-    trail_piece *TrailPiece = NULL;
     entity_repeat *Repeat = NULL;
     collider *Collider = NULL;
     model *Model = NULL;
@@ -142,7 +176,6 @@ struct entity
 #define EXPLOSION_PARTS_COUNT 12
 struct explosion
 {
-    mesh Mesh;
     color Color;
     float LifeTime;
 };
@@ -151,6 +184,11 @@ struct explosion
 struct trail
 {
     entity Entities[TRAIL_COUNT];
+
+    // the collider of the whole trail, with one segment per piece
+    collider Collider;
+    bounding_box Segments[TRAIL_COUNT];
+    entity *Owner = NULL;
     float Timer = 0;
     float Radius = 0;
     int PositionStackIndex = 0;
@@ -171,11 +209,6 @@ struct trail_group
 	bool RenderOnly;
 };
 
-struct trail_piece
-{
-    entity *Owner;
-};
-
 struct background_instance
 {
 	color Color;
@@ -225,6 +258,7 @@ struct road_state
 struct entity_world
 {
 	thread_pool UpdateThreadPool;
+	thread_pool CollisionThreadPool;
 
     memory_arena PersistentArena;
     memory_arena Arena;
@@ -237,6 +271,7 @@ struct entity_world
     memory_pool CheckpointPool;
 	memory_pool FinishPool;
 	memory_pool EnemySkullPool;
+	memory_pool RandomGeometryPool;
 	generic_pool<entity_update_args> UpdateArgsPool;
 
     mesh *SphereMesh = NULL;
@@ -252,6 +287,12 @@ struct entity_world
 	road_mesh_manager RoadMeshManager;
 
     background_state BackgroundState;
+    particle_system Particles;
+    track_index TrackIndex;
+    lane_index LaneIndex;
+    collision_broadphase Broadphase;
+    integrate_batch IntegrateBatch;
+    collision_stats CollisionStats;
     gen_state *GenState;
 
 	std::vector<entity *> AudioEntities;
@@ -279,6 +320,16 @@ struct entity_world
     entity *PlayerEntity;
     entity *RoadEntity;
     int NumEntities = 0;
+    int NumDrawnModels = 0;
+
+    // the entities drawn this frame and the ones among them whose matrix
+    // has to be rebuilt
+    std::vector<entity *> DrawEntities;
+    std::vector<entity *> DirtyEntities;
+    transform_batch DirtyTransforms;
+    std::vector<mat4> DirtyMatrices;
+    int NumMatricesBuilt = 0;
+    int NumMatricesCached = 0;
 
 	std::function<void()> OnSpawnFinish;
 	bool ShouldSpawnFinish = false;
@@ -61,9 +61,10 @@ enum collider_type
 {
     ColliderType_Crystal,
     ColliderType_Ship,
-    ColliderType_TrailPiece,
+    ColliderType_Trail,
     ColliderType_Asteroid,
 	ColliderType_EnemySkull,
+	ColliderType_Count,
 };
 
 enum color_texture_type
@@ -84,6 +85,7 @@ enum entity_type
 	EntityType_Checkpoint,
 	EntityType_Finish,
 	EntityType_EnemySkull,
+	EntityType_RandomGeometry,
 	EntityType_MAX,
 };
 
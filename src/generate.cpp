@@ -1,42 +1,90 @@
 // Copyright
 
-int GetNextSpawnLane(gen_state *state, bool isShip = false)
+// Picks one of the lanes set in the mask at random, returns the lane index
+static int PickLane(random_series &entropy, uint32 mask)
 {
-    static int lastLane = 0;
-    static int lastShipLane = 0;
-    int lane = lastLane;
-    while (lane == lastLane || (isShip && lane == lastShipLane) || (state->ReservedLanes[lane+2] == 1))
+    assert(mask != 0);
+
+    int count = 0;
+    for (int i = 0; i < ROAD_LANE_COUNT; i++)
+    {
+        count += (mask >> i) & 1;
+    }
+
+    int n = RandomBetween(entropy, 0, count-1);
+    for (int i = 0; i < ROAD_LANE_COUNT; i++)
+    {
+        if ((mask & (1 << i)) && n-- == 0)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// The lanes with nothing around the spawn point
+static uint32 GetFreeSpawnLanes(entity_world &world)
+{
+    float y = world.PlayerEntity->Pos().y + GEN_PLAYER_OFFSET;
+    return GetFreeLanes(world.LaneIndex, y - GEN_LANE_MARGIN, y + GEN_LANE_MARGIN);
+}
+
+// Avoids repeating the last lane and the reserved ones, and prefers the
+// free lanes. The constraints are dropped in that order if no lane
+// passes them, so there's always a lane to spawn in.
+int GetNextSpawnLane(gen_state *state, entity_world &world, bool isShip = false)
+{
+    uint32 mask = LANE_INDEX_ALL;
+    for (int i = 0; i < ROAD_LANE_COUNT; i++)
     {
-        lane = RandomBetween(state->Entropy, -2, 2);
+        if (state->ReservedLanes[i] == 1) mask &= ~(1 << i);
     }
-    lastLane = lane;
+
+    uint32 notReserved = mask;
+    mask &= ~(1 << (state->LastLane+2));
     if (isShip)
     {
-        lastShipLane = lane;
+        mask &= ~(1 << (state->LastShipLane+2));
+    }
+
+    uint32 candidates = mask & GetFreeSpawnLanes(world);
+    if (!candidates) candidates = mask;
+    if (!candidates) candidates = notReserved;
+    if (!candidates) candidates = LANE_INDEX_ALL;
+
+    int lane = PickLane(state->Entropy, candidates) - 2;
+    state->LastLane = lane;
+    if (isShip)
+    {
+        state->LastShipLane = lane;
     }
     return lane;
 }
 
 int GetNextShipColor(gen_state *state, level_state *l)
 {
-    static int lastColor = 0;
-    int color = lastColor;
+    int color = state->LastShipColor;
     if (l->ForceShipColor > -1)
     {
-        return lastColor = l->ForceShipColor;
+        return state->LastShipColor = l->ForceShipColor;
     }
-    while (color == lastColor)
+    while (color == state->LastShipColor)
     {
         color = RandomBetween(state->Entropy, 0, 1);
     }
-    lastColor = color;
+    state->LastShipColor = color;
     return color;
 }
 
+inline static float RedShipPitch(int lane)
+{
+    return 0.5f + (float(lane+2) / 5.0f)*0.5f;
+}
+
 GEN_FUNC(GenerateCrystal)
 {
     auto l = static_cast<level_state *>(data);
-    int lane = GetNextSpawnLane(state);
+    int lane = GetNextSpawnLane(state, g->World);
     auto ent = CreateCrystalEntity(GetEntry(g->World.CrystalPool), g->AssetLoader, GetCrystalMesh(g->World), lane);
     ent->Pos().x = lane * ROAD_LANE_WIDTH;
     ent->Pos().y = g->World.PlayerEntity->Pos().y + GEN_PLAYER_OFFSET;
@@ -53,7 +101,7 @@ GEN_FUNC(GenerateShip)
     auto l = static_cast<level_state *>(data);
     int colorIndex = GetNextShipColor(state, l);
     color c = IntColor(ShipPalette.Colors[colorIndex]);
-    int lane = GetNextSpawnLane(state, true);
+    int lane = GetNextSpawnLane(state, g->World, true);
     auto ent = CreateShipEntity(GetEntry(g->World.ShipPool), GetShipMesh(g->World), c, c, p->Clip, false, colorIndex, lane);
     ent->Pos().x = lane * ROAD_LANE_WIDTH;
     ent->Pos().y = g->World.PlayerEntity->Pos().y + GEN_PLAYER_OFFSET;
@@ -81,7 +129,7 @@ GEN_FUNC(GenerateRedShip)
 
 	if (p->Clip)
 	{
-		AudioSourceSetPitch(ent->AudioSource, 0.5f + (float(lane+2) / 5.0f)*0.5f);
+		AudioSourceSetPitch(ent->AudioSource, RedShipPitch(lane));
 	}
 }
 
@@ -133,24 +181,19 @@ GEN_FUNC(GenerateEnemySkull)
 
 GEN_FUNC(GenerateSideTrail)
 {
-    // TODO: create the side trail pool
-    auto ent = CreateEntity(&g->World.Arena);
-    ent->Pos().y = g->World.PlayerEntity->Pos().y + GEN_PLAYER_OFFSET;
-    ent->TrailGroup = CreateTrailGroup(&g->World.Arena, ent, Color_white, 0.5f, true);
-    AddFlags(ent, EntityFlag_RemoveOffscreen | EntityFlag_UpdateMovement);
-    AddEntity(g->World, ent);
-
-    ent->Vel().y = RandomBetween(state->Entropy, -25.0f, -75.0f);
-    ent->Pos().x = RandomBetween(state->Entropy, 10.0f, 40.0f);
+    vec3 pos = vec3{0, g->World.PlayerEntity->Pos().y + GEN_PLAYER_OFFSET, 0};
+    vec3 vel = vec3(0.0f);
+    vel.y = RandomBetween(state->Entropy, -25.0f, -75.0f);
+    pos.x = RandomBetween(state->Entropy, 10.0f, 40.0f);
     if (RandomBetween(state->Entropy, 0, 1) == 0)
     {
-        ent->Pos().x = -ent->Pos().x;
+        pos.x = -pos.x;
     }
+    EmitRibbon(g->World.Particles, pos, vel, Color_white, 0.5f);
 }
 
 GEN_FUNC(GenerateRandomGeometry)
 {
-    // TODO: create a pool for this
     mesh *m = NULL;
     vec3 scale = vec3(1.0f);
     color c = Color_white;
@@ -167,9 +210,7 @@ GEN_FUNC(GenerateRandomGeometry)
         scale = vec3(50.0f);
     }
 
-    auto ent = CreateEntity(&g->World.Arena);
-    ent->Model = CreateModel(&g->World.Arena, m);
-    ent->FrameRotation = PushStruct<frame_rotation>(&g->World.Arena);
+    auto ent = CreateRandomGeometryEntity(GetEntry(g->World.RandomGeometryPool), m);
     ent->FrameRotation->Rotation.x = RandomBetween(state->Entropy, -45.0f, 45.0f);
     ent->FrameRotation->Rotation.y = RandomBetween(state->Entropy, -45.0f, 45.0f);
     ent->FrameRotation->Rotation.z = RandomBetween(state->Entropy, -45.0f, 45.0f);
@@ -265,25 +306,10 @@ void UpdateGen(game_main *g, gen_state *state, gen_params *p, void *data, float
 	{
 		if (p->Timer <= p->Interval*0.5f && p->ReservedLane == NO_RESERVED_LANE)
 		{
-			const int maxTries = 5;
-			int i = 0;
+			// the player's lane is kept for this spawn
 			int laneIndex = state->PlayerLaneIndex;
-
-			// get the first non-occupied lane, or give up for this frame
-			while (state->LaneSlots[laneIndex] > 0 && i < maxTries)
-			{
-				laneIndex = RandomBetween(state->Entropy, g->World.RoadState.MinLaneIndex, g->World.RoadState.MaxLaneIndex);
-				i++;
-			}
-			if (i >= maxTries)
-			{
-				p->Timer = GetNextTimer(p, state->Entropy);
-			}
-			else
-			{
-				p->ReservedLane = laneIndex - 2;
-				state->ReservedLanes[laneIndex] = 1;
-			}
+			p->ReservedLane = laneIndex - 2;
+			state->ReservedLanes[laneIndex] = 1;
 		}
 	}
 
@@ -10,6 +10,9 @@
 
 #define GEN_PLAYER_OFFSET 250
 
+// how far around the spawn point a lane has to be empty to spawn in it
+#define GEN_LANE_MARGIN (LANE_INDEX_BUCKET_SIZE*2)
+
 // generation flags
 #define GenFlag_Enabled         (1 << 0)
 #define GenFlag_Randomize       (1 << 1)
@@ -39,9 +42,13 @@ struct gen_params
 struct gen_state
 {
     gen_params GenParams[GenType_MAX];
-    int LaneSlots[5];
     int ReservedLanes[5];
     int PlayerLaneIndex = 0;
+
+    // what was spawned last, the next spawn avoids repeating it
+    int LastLane = 0;
+    int LastShipLane = 0;
+    int LastShipColor = 0;
     random_series Entropy;
 };
 
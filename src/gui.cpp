@@ -90,7 +90,7 @@ void InitGUI(gui &g, tween_state &tweenState, game_input &Input)
 			   vertex_attribute{0, 2, GL_FLOAT, 8 * sizeof(float), 0},
 			   vertex_attribute{1, 2, GL_FLOAT, 8 * sizeof(float), 2 * sizeof(float)},
 			   vertex_attribute{2, 4, GL_FLOAT, 8 * sizeof(float), 4 * sizeof(float)}
-	});
+	}, true);
 
     g.MenuChangeTimer = 1.0f;
 	g.MenuChangeSequence = CreateSequence(tweenState);
@@ -380,13 +380,14 @@ void DrawTextGroupCentered(gui &g, text_group *group, rect r, color multiplyColo
 void End(gui &g)
 {
     PushDrawCommand(g);
+    if (!StreamVertices(Global_StreamBuffer, g.Buffer))
+    {
+        UnbindShaderProgram();
+        return;
+    }
 
-    // TODO: reserve vertices before uploading
-    UploadVertices(g.Buffer, GL_DYNAMIC_DRAW);
-
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glBindVertexArray(g.Buffer.VAO);
+    GLSetBlend(true);
+    GLBindVertexArray(g.Buffer.VAO);
     SetUniform(g.Emission, g.EmissionValue);
 
     for (const auto &Cmd : g.DrawCommandList)
@@ -397,16 +398,12 @@ void End(gui &g)
         }
         SetUniform(g.TexWeight, Cmd.TexWeight);
         SetUniform(g.DiffuseColor, Cmd.DiffuseColor);
-        glDrawArrays(Cmd.PrimitiveType, Cmd.Offset, Cmd.Count);
-        if (Cmd.Texture)
-        {
-            Unbind(*Cmd.Texture, 0);
-        }
+        glDrawArrays(Cmd.PrimitiveType, g.Buffer.StreamFirst + Cmd.Offset, Cmd.Count);
     }
 
-    glBindVertexArray(0);
+    GLBindVertexArray(0);
     UnbindShaderProgram();
-    glDisable(GL_BLEND);
+    GLSetBlend(false);
 }
 
 static color textColor = Color_white;
@@ -16,10 +16,15 @@ void RegisterInputActions(game_input &input)
 void AddShadersAssetEntries(game_main *g, asset_job *job)
 {
     AddShaderProgramEntries(job, g->RenderState.ModelProgram);
+    AddShaderProgramEntries(job, g->RenderState.InstancedModelProgram);
+    AddShaderProgramEntries(job, g->RenderState.BloomPrefilterProgram);
+    AddShaderProgramEntries(job, g->RenderState.BloomDownProgram);
+    AddShaderProgramEntries(job, g->RenderState.BloomUpProgram);
+    AddShaderProgramEntries(job, g->RenderState.BloomCompositeProgram);
     AddShaderProgramEntries(job, g->RenderState.BlurHorizontalProgram);
     AddShaderProgramEntries(job, g->RenderState.BlurVerticalProgram);
-    AddShaderProgramEntries(job, g->RenderState.BlendProgram);
     AddShaderProgramEntries(job, g->RenderState.BlitProgram);
+    AddShaderProgramEntries(job, g->RenderState.BlendProgram);
     AddShaderProgramEntries(job, g->RenderState.ResolveMultisampleProgram);
 	  AddShaderProgramEntries(job, g->RenderState.PerlinNoiseProgram);
 }
@@ -3,7 +3,7 @@
 
 #define CRYSTAL_COLOR     IntColor(FirstPalette.Colors[1])
 
-#define FRAME_SECONDS(s)  (s * 60)
+#define FRAME_SECONDS(s)  (s * GAME_TICK_RATE)
 
 struct level_command
 {
@@ -44,9 +44,14 @@ void ResetLevelState(game_main *g, level_state *l, const std::string &levelNumbe
     l->Health = 50;
     l->CheckpointNum = 0;
     l->CurrentCheckpointFrame = 0;
+    l->NumTrailHits = 0;
+    l->NumSweptTrailHits = 0;
     l->GameplayState = GameplayState_Playing;
     l->Level = FindLevel(g->AssetLoader, levelNumber, "main_assets");
     ResetLevel(l->Level);
+    l->StartSnapshot.Data.clear();
+    l->CheckpointSnapshot.Data.clear();
+    l->ShouldSaveCheckpoint = false;
 
 	  MusicMasterLoadSong(g->MusicMaster, l->Level->Song);
 
@@ -140,12 +145,13 @@ void InitLevelState(game_main *g, level_state *l)
 	  ResetPool(l->TrackArgsPool);
 
     l->AssetLoader = &g->AssetLoader;
-    l->Entropy = RandomSeed(g->Platform.GetMilliseconds());
+    l->Entropy = RandomSeed(RandomNextUint32(g->Entropy));
     l->IntroTextPool.Arena = &l->Arena;
     l->ScoreTextPool.Arena = &l->Arena;
     l->TrackArgsPool.Arena = &l->Arena;
     g->Gravity = vec3(0, 0, 0);
     g->World.Camera = &g->Camera;
+    InitCollisionHandlers(l);
 
     // init string formats
     InitFormat(&l->ScorePercentFormat, "%s: %d%%\n", 24, &l->Arena);
@@ -224,6 +230,14 @@ void InitLevelState(game_main *g, level_state *l)
 
 void RestartLevel(game_main *g)
 {
+    auto l = &g->LevelState;
+    if (LoadWorldSnapshot(g, l->StartSnapshot))
+    {
+        l->CheckpointSnapshot.Data.clear();
+        l->ShouldSaveCheckpoint = false;
+        return;
+    }
+
     g->LevelState.Health = 50;
     RemoveGameplayEntities(g->World);
     AddEntity(g->World, g->World.PlayerEntity);
@@ -310,27 +324,6 @@ void AddScoreText(game_main *g, level_state *l, const char *text, int score, vec
     l->ScoreTextList.push_back(scoreText);
 }
 
-struct find_entity_result
-{
-    entity *Found = NULL;
-    entity *Other = NULL;
-};
-find_entity_result FindEntityOfType(entity *first, entity *second, collider_type type)
-{
-    find_entity_result result;
-    if (first->Collider->Type == type)
-    {
-        result.Found = first;
-        result.Other = second;
-    }
-    else if (second->Collider->Type == type)
-    {
-        result.Found = second;
-        result.Other = first;
-    }
-    return result;
-}
-
 #define DRAFT_BOOST       40.0f
 inline static void ApplyBoostToShip(entity *ent, float Boost, float Max)
 {
@@ -381,138 +374,225 @@ void PlayerEnemyCollision(level_state *l, entity_world &w,
     RemoveEntity(w, enemy);
 }
 
-bool HandleCollision(game_main *g, entity *first, entity *second, float dt)
+// The draft charges slower at the end of the trail than right behind
+// its owner, the last segment is the one touching it
+static bool HandleShipTrailCollision(game_main *g, entity *shipEntity, entity *trailEntity, const collision_result &col, float dt)
 {
     auto l = &g->LevelState;
-    auto shipEntity = FindEntityOfType(first, second, ColliderType_Ship).Found;
-    if (first->Collider->Type == ColliderType_TrailPiece || second->Collider->Type == ColliderType_TrailPiece)
+    auto owner = trailEntity->Trail->Owner;
+    if (ENTITY_IS_PLAYER(shipEntity) && shipEntity != owner)
     {
-        auto trailPieceEntity = FindEntityOfType(first, second, ColliderType_TrailPiece).Found;
-        if (shipEntity && ENTITY_IS_PLAYER(shipEntity) && shipEntity != trailPieceEntity->TrailPiece->Owner)
+        if (l->NumTrailCollisions == 0 && (!l->DraftActive || l->DraftTarget != owner))
         {
-            if (l->NumTrailCollisions == 0 && (!l->DraftActive || l->DraftTarget != trailPieceEntity->TrailPiece->Owner))
-            {
-                l->CurrentDraftTime += dt;
-                l->NumTrailCollisions++;
-                l->DraftTarget = trailPieceEntity->TrailPiece->Owner;
-                l->DraftActive = false;
-            }
+            float closeness = (col.Segment < 0) ? 1.0f : float(col.Segment + 1) / TRAIL_COUNT;
+            l->CurrentDraftTime += dt * glm::mix(Global_Game_DraftTailCharge, 1.0f, closeness);
+            l->NumTrailCollisions++;
+            l->DraftTarget = owner;
+            l->DraftActive = false;
         }
-        return false;
     }
-    if (first->Collider->Type == ColliderType_Ship && second->Collider->Type == ColliderType_Ship)
+    return false;
+}
+
+static bool HandleShipShipCollision(game_main *g, entity *first, entity *second, const collision_result &col, float dt)
+{
+    auto l = &g->LevelState;
+    vec3 rv = first->Transform.Velocity - second->Transform.Velocity;
+    entity *entityToExplode = NULL;
+    entity *otherEntity = NULL;
+    if (rv.y < 0.0f)
+    {
+        entityToExplode = first;
+        otherEntity = second;
+    }
+    else
+    {
+        entityToExplode = second;
+        otherEntity = first;
+    }
+    if ((ENTITY_IS_PLAYER(otherEntity) && l->DraftActive && l->DraftTarget == entityToExplode) ||
+        (SHIP_IS_RED(otherEntity->Ship) || SHIP_IS_RED(entityToExplode->Ship)))
     {
-        vec3 rv = first->Transform.Velocity - second->Transform.Velocity;
-        entity *entityToExplode = NULL;
-        entity *otherEntity = NULL;
-        if (rv.y < 0.0f)
+        if (ENTITY_IS_PLAYER(otherEntity))
         {
-            entityToExplode = first;
-            otherEntity = second;
+            l->DraftActive = false;
         }
-        else
+        else if (ENTITY_IS_PLAYER(entityToExplode))
         {
-            entityToExplode = second;
-            otherEntity = first;
+            entityToExplode = otherEntity;
         }
-        if ((ENTITY_IS_PLAYER(otherEntity) && l->DraftActive && l->DraftTarget == entityToExplode) ||
-            (SHIP_IS_RED(otherEntity->Ship) || SHIP_IS_RED(entityToExplode->Ship)))
-        {
-            if (ENTITY_IS_PLAYER(otherEntity))
-            {
-                l->DraftActive = false;
-            }
-            else if (ENTITY_IS_PLAYER(entityToExplode))
-            {
-                entityToExplode = otherEntity;
-            }
-
-            if (SHIP_IS_BLUE(entityToExplode->Ship))
-            {
-                l->Score += SCORE_DESTROY_BLUE_SHIP;
-                entityToExplode->Ship->Scored = true;
-                AddScoreText(g, l, SCORE_TEXT_BLAST, SCORE_DESTROY_BLUE_SHIP, entityToExplode->Pos(), IntColor(ShipPalette.Colors[SHIP_BLUE]));
-            }
-            else if (SHIP_IS_ORANGE(entityToExplode->Ship))
-            {
-                PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 25);
-                return false;
-            }
-            else if (ENTITY_IS_PLAYER(otherEntity) && SHIP_IS_RED(entityToExplode->Ship))
-            {
-                PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 50);
-                return false;
-            }
 
-            auto exp = CreateExplosionEntity(
-                GetEntry(g->World.ExplosionPool),
-				*l->AssetLoader,
-                entityToExplode->Transform.Position,
-                otherEntity->Transform.Velocity,
-                entityToExplode->Ship->Color,
-                entityToExplode->Ship->OutlineColor,
-                vec3{ 0, 1, 1 },
-				entityToExplode->LaneSlot->Lane
-            );
-            AddEntity(g->World, exp);
-            RemoveEntity(g->World, entityToExplode);
+        if (SHIP_IS_BLUE(entityToExplode->Ship))
+        {
+            l->Score += SCORE_DESTROY_BLUE_SHIP;
+            entityToExplode->Ship->Scored = true;
+            AddScoreText(g, l, SCORE_TEXT_BLAST, SCORE_DESTROY_BLUE_SHIP, entityToExplode->Pos(), IntColor(ShipPalette.Colors[SHIP_BLUE]));
+        }
+        else if (SHIP_IS_ORANGE(entityToExplode->Ship))
+        {
+            PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 25);
             return false;
         }
-        else
+        else if (ENTITY_IS_PLAYER(otherEntity) && SHIP_IS_RED(entityToExplode->Ship))
         {
-            if (otherEntity->Flags & EntityFlag_IsPlayer)
-            {
-                PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 25);
-                return false;
-            }
+            PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 50);
+            return false;
         }
+
+        auto exp = CreateExplosionEntity(
+            GetEntry(g->World.ExplosionPool),
+            *l->AssetLoader,
+            entityToExplode->Transform.Position,
+            otherEntity->Transform.Velocity,
+            entityToExplode->Ship->Color,
+            entityToExplode->Ship->OutlineColor,
+            vec3{ 0, 1, 1 },
+            entityToExplode->LaneSlot->Lane
+        );
+        AddEntity(g->World, exp);
+        RemoveEntity(g->World, entityToExplode);
         return false;
     }
+    else
+    {
+        if (otherEntity->Flags & EntityFlag_IsPlayer)
+        {
+            PlayerEnemyCollision(l, g->World, otherEntity, entityToExplode, 25);
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool HandleShipCrystalCollision(game_main *g, entity *shipEntity, entity *crystalEntity, const collision_result &col, float dt)
+{
+    auto l = &g->LevelState;
+    if (shipEntity->Flags & EntityFlag_IsPlayer)
+    {
+        l->Health += SCORE_HEALTH;
+        AddScoreText(g, l, SCORE_TEXT_HEALTH, SCORE_HEALTH, crystalEntity->Pos(), CRYSTAL_COLOR);
+
+        AudioSourceSetPitch(crystalEntity->AudioSource, LaneIndexToPitch(crystalEntity->LaneSlot->Index));
+        AudioSourcePlay(crystalEntity->AudioSource);
+
+        auto pup = CreatePowerupEntity(GetEntry(g->World.PowerupPool),
+                                       g->LevelState.Entropy,
+                                       g->LevelState.TimeElapsed,
+                                       crystalEntity->Pos(),
+                                       shipEntity->Vel(),
+                                       CRYSTAL_COLOR);
+        AddEntity(g->World, pup);
+        RemoveEntity(g->World, crystalEntity);
+    }
+    return false;
+}
+
+static bool HandleShipAsteroidCollision(game_main *g, entity *shipEntity, entity *asteroidEntity, const collision_result &col, float dt)
+{
+    auto l = &g->LevelState;
+    if (ENTITY_IS_PLAYER(shipEntity))
+    {
+        auto exp = CreateExplosionEntity(
+            GetEntry(g->World.ExplosionPool),
+            *l->AssetLoader,
+            shipEntity->Pos(),
+            vec3(0.0f),
+            shipEntity->Ship->Color,
+            shipEntity->Ship->OutlineColor,
+            vec3{ 0, 1, 1 }
+        );
+        AddEntity(g->World, exp);
+        PlayerExplodeAndLoseHealth(l, g->World, shipEntity, 50);
+    }
+    return false;
+}
+
+static void RegisterCollisionHandler(level_state *l, collider_type first, collider_type second, collision_handler_func *func)
+{
+    l->CollisionHandlers[first][second] = collision_handler{ func, false };
+    if (first != second)
+    {
+        l->CollisionHandlers[second][first] = collision_handler{ func, true };
+    }
+}
 
-    auto crystalEntity = FindEntityOfType(first, second, ColliderType_Crystal).Found;
-    if (shipEntity != NULL && crystalEntity != NULL)
+// The pairs without a handler are ignored, the same types are handled
+// in the order they were detected in
+void InitCollisionHandlers(level_state *l)
+{
+    for (int i = 0; i < ColliderType_Count; i++)
     {
-        if (shipEntity->Flags & EntityFlag_IsPlayer)
+        for (int j = 0; j < ColliderType_Count; j++)
         {
-            l->Health += SCORE_HEALTH;
-            AddScoreText(g, l, SCORE_TEXT_HEALTH, SCORE_HEALTH, crystalEntity->Pos(), CRYSTAL_COLOR);
-
-			Println(crystalEntity->LaneSlot->Index);
-			AudioSourceSetPitch(crystalEntity->AudioSource, LaneIndexToPitch(crystalEntity->LaneSlot->Index));
-			AudioSourcePlay(crystalEntity->AudioSource);
-
-            auto pup = CreatePowerupEntity(GetEntry(g->World.PowerupPool),
-                                           g->LevelState.Entropy,
-                                           g->LevelState.TimeElapsed,
-                                           crystalEntity->Pos(),
-                                           shipEntity->Vel(),
-                                           CRYSTAL_COLOR);
-            AddEntity(g->World, pup);
-            RemoveEntity(g->World, crystalEntity);
+            l->CollisionHandlers[i][j] = collision_handler{};
         }
-        return false;
     }
+    RegisterCollisionHandler(l, ColliderType_Ship, ColliderType_Trail, HandleShipTrailCollision);
+    RegisterCollisionHandler(l, ColliderType_Ship, ColliderType_Ship, HandleShipShipCollision);
+    RegisterCollisionHandler(l, ColliderType_Ship, ColliderType_Crystal, HandleShipCrystalCollision);
+    RegisterCollisionHandler(l, ColliderType_Ship, ColliderType_Asteroid, HandleShipAsteroidCollision);
+}
+
+// Turns the frame's collisions into the events that have a handler
+static void BuildCollisionEvents(level_state *l, size_t numCollisions)
+{
+    l->CollisionEvents.clear();
+    for (size_t i = 0; i < numCollisions; i++)
+    {
+        auto &col = l->CollisionCache[i];
+        auto &handler = l->CollisionHandlers[col.First->Collider->Type][col.Second->Collider->Type];
+        if (!handler.Func) continue;
+
+        collision_event event;
+        event.First = handler.Swap ? col.Second : col.First;
+        event.Second = handler.Swap ? col.First : col.Second;
+        event.Func = handler.Func;
+        event.ResultIndex = uint32(i);
+        l->CollisionEvents.push_back(event);
+    }
+}
 
-    auto asteroidEntity = FindEntityOfType(first, second, ColliderType_Asteroid).Found;
-    if (shipEntity != NULL && asteroidEntity != NULL)
+// A hit that needed the sweep has its time of impact inside the motion
+static void CountTrailHits(level_state *l, size_t numCollisions)
+{
+    for (size_t i = 0; i < numCollisions; i++)
     {
-        if (ENTITY_IS_PLAYER(shipEntity))
+        auto &col = l->CollisionCache[i];
+        if (col.Second->Collider->Type != ColliderType_Trail || !ENTITY_IS_PLAYER(col.First)) continue;
+
+        l->NumTrailHits++;
+        if (col.Time < 1.0f)
         {
-            auto exp = CreateExplosionEntity(
-                GetEntry(g->World.ExplosionPool),
-				*l->AssetLoader,
-                shipEntity->Pos(),
-                vec3(0.0f),
-                shipEntity->Ship->Color,
-                shipEntity->Ship->OutlineColor,
-                vec3{ 0, 1, 1 }
-            );
-            AddEntity(g->World, exp);
-            PlayerExplodeAndLoseHealth(l, g->World, shipEntity, 50);
+            l->NumSweptTrailHits++;
         }
-        return false;
     }
-    return false;
+}
+
+// The results are counted in detection order, each one right before its
+// event is handled, so a handler sees the counts of the results before it
+static void CountCollisions(level_state *l, size_t &next, size_t end)
+{
+    for (; next < end; next++)
+    {
+        auto &col = l->CollisionCache[next];
+        col.First->NumCollisions++;
+        col.Second->NumCollisions++;
+    }
+}
+
+static void DispatchCollisionEvents(game_main *g, level_state *l, size_t numCollisions, float dt)
+{
+    size_t next = 0;
+    for (auto &event : l->CollisionEvents)
+    {
+        CountCollisions(l, next, event.ResultIndex + 1);
+        auto &col = l->CollisionCache[event.ResultIndex];
+        if (event.Func(g, event.First, event.Second, col, dt))
+        {
+            ResolveCollision(col);
+        }
+    }
+    CountCollisions(l, next, numCollisions);
 }
 
 void UpdateFreeCam(camera &cam, game_input &input, float dt)
@@ -675,6 +755,21 @@ void UpdateLevel(game_main *g, float dt)
 		}
 	}
 
+    // the snapshots are taken before anything is updated so the whole
+    // world is in the same tick
+    if (l->GameplayState == GameplayState_Playing)
+    {
+        if (IsEmpty(l->StartSnapshot))
+        {
+            SaveWorldSnapshot(g, l->StartSnapshot);
+        }
+        if (l->ShouldSaveCheckpoint)
+        {
+            l->ShouldSaveCheckpoint = false;
+            SaveWorldSnapshot(g, l->CheckpointSnapshot);
+        }
+    }
+
     dt *= Global_Game_TimeSpeed;
     if (l->GameplayState != GameplayState_Paused)
     {
@@ -789,21 +884,16 @@ void UpdateLevel(game_main *g, float dt)
 		BeginProfileTimer("Collision");
 		{
 			size_t frameCollisionCount = 0;
-			DetectCollisions(world.ActiveCollisionEntities, world.PassiveCollisionEntities, l->CollisionCache, &frameCollisionCount);
-			for (size_t i = 0; i < frameCollisionCount; i++)
-			{
-				auto col = &l->CollisionCache[i];
-				col->First->NumCollisions++;
-				col->Second->NumCollisions++;
-
-				if (HandleCollision(g, col->First, col->Second, dt))
-				{
-					ResolveCollision(*col);
-				}
-			}
-
-			Integrate(world.ActiveCollisionEntities, g->Gravity, dt);
-			Integrate(world.PassiveCollisionEntities, g->Gravity, dt);
+			DetectCollisions(world.ActiveCollisionEntities, world.PassiveCollisionEntities, world.Broadphase, &world.CollisionThreadPool, l->CollisionCache, &frameCollisionCount);
+			BuildCollisionEvents(l, frameCollisionCount);
+			CountTrailHits(l, frameCollisionCount);
+			DispatchCollisionEvents(g, l, frameCollisionCount, dt);
+
+			world.CollisionStats = collision_stats{};
+			Integrate(world.ActiveCollisionEntities, g->Gravity, dt, world.IntegrateBatch, world.CollisionStats);
+			MarkTrackIndexMoved(world.TrackIndex, world.IntegrateBatch.Entities);
+			Integrate(world.PassiveCollisionEntities, g->Gravity, dt, world.IntegrateBatch, world.CollisionStats);
+			MarkTrackIndexMoved(world.TrackIndex, world.IntegrateBatch.Entities);
 			if (l->NumTrailCollisions == 0)
 			{
 				l->CurrentDraftTime -= dt;
@@ -881,6 +971,7 @@ void UpdateLevel(game_main *g, float dt)
             vec3 dirToPlayer = glm::normalize(distToPlayer);
             ent->SetVel(ent->Vel() + dirToPlayer * (1.0f/dt) * dt);
             ent->SetPos(ent->Pos() + ent->Vel() * dt);
+            MarkTrackIndexMoved(world.TrackIndex, ent);
             for (auto &meshPart : ent->TrailGroup->Mesh.Parts)
             {
                 float &alpha = meshPart.Material->DiffuseColor.a;
@@ -951,6 +1042,7 @@ void UpdateLevel(game_main *g, float dt)
 
                     l->CheckpointNum++;
 					l->CurrentCheckpointFrame = -1;
+                    l->ShouldSaveCheckpoint = true;
                     PlayerExplodeAndLoseHealth(l, g->World, playerEntity, 25);
                 }
                 break;
@@ -967,6 +1059,7 @@ void UpdateLevel(game_main *g, float dt)
 
                     l->CheckpointNum++;
 					l->CurrentCheckpointFrame = -1;
+                    l->ShouldSaveCheckpoint = true;
                     l->Score += SCORE_CHECKPOINT;
                     AddScoreText(g, l, SCORE_TEXT_CHECKPOINT, SCORE_CHECKPOINT, ent->Pos(), IntColor(ShipPalette.Colors[SHIP_BLUE]));
 
@@ -1000,6 +1093,7 @@ void UpdateLevel(game_main *g, float dt)
             }
 
             ent->Pos().y += ent->Vel().y * dt;
+            MarkTrackIndexMoved(world.TrackIndex, ent);
         }
 		for (auto ent : world.FinishEntities)
 		{
@@ -1008,6 +1102,7 @@ void UpdateLevel(game_main *g, float dt)
 			if (ent->Finish->Finished)
 			{
 				ent->Pos().y = g->Camera.Position.y + 1;
+				MarkTrackIndexMoved(world.TrackIndex, ent);
 			}
 			else if (g->Camera.Position.y + 5.0f >= ent->Pos().y)
 			{
@@ -1101,7 +1196,7 @@ void RenderLevel(game_main *g, float dt)
     RenderBackground(g, g->World);
     RenderBegin(g->RenderState, dt);
 
-    RenderEntityWorld(g->RenderState, g->World, dt);
+    RenderEntityWorld(g->RenderState, g->World, g->RenderAlpha);
 
 #if 0
 #ifdef DRAFT_DEBUG
@@ -1209,12 +1304,15 @@ MENU_FUNC(GameOverMenuCallback)
     case 0:
     {
         // continue from last checkpoint
-        l->CurrentCheckpointFrame = 0;
+        if (!LoadWorldSnapshot(g, l->CheckpointSnapshot))
+        {
+            l->CurrentCheckpointFrame = 0;
+            RemoveGameplayEntities(g->World);
+            AddEntity(g->World, g->World.PlayerEntity);
+            g->World.PlayerEntity->Vel().y = l->PlayerMinVel;
+        }
         l->GameplayState = GameplayState_Playing;
         l->Health = 50;
-        RemoveGameplayEntities(g->World);
-        AddEntity(g->World, g->World.PlayerEntity);
-		g->World.PlayerEntity->Vel().y = l->PlayerMinVel;
         break;
     }
 
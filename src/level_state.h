@@ -43,6 +43,26 @@ struct track_args
 	hash_string::result_type TrackHash;
 };
 
+typedef bool collision_handler_func(game_main *g, entity *first, entity *second, const collision_result &col, float dt);
+
+// An entry of the dispatch table, Swap tells the entities come in the
+// opposite order the handler was registered with
+struct collision_handler
+{
+    collision_handler_func *Func = NULL;
+    bool Swap = false;
+};
+
+// A collision something handles, with the entities already in the
+// handler's order
+struct collision_event
+{
+    entity *First;
+    entity *Second;
+    collision_handler_func *Func;
+    uint32 ResultIndex;
+};
+
 struct level_state
 {
     memory_arena Arena;
@@ -56,6 +76,8 @@ struct level_state
 	generic_pool<track_args> TrackArgsPool;
 
     std::vector<collision_result> CollisionCache;
+    std::vector<collision_event> CollisionEvents;
+    collision_handler CollisionHandlers[ColliderType_Count][ColliderType_Count];
     float PlayerMinVel = PLAYER_MIN_VEL;
     float PlayerMaxVel = PLAYER_INITIAL_MAX_VEL;
     float TimeElapsed = 0;
@@ -90,15 +112,28 @@ struct level_state
     float DraftCharge = 0;
     int NumTrailCollisions = 0;
     bool DraftActive = false;
+
+    // the player's trail hits in the level, and how many of them only the
+    // continuous collision found
+    int NumTrailHits = 0;
+    int NumSweptTrailHits = 0;
     string_format HealthFormat;
     string_format ScoreNumberFormat;
     int Score = 0;
     std::list<level_score_text *> ScoreTextList;
     std::list<level_intro_text *> IntroTextList;
+
+    // taken on the first tick of the level and after passing a
+    // checkpoint, restarting loads them instead of rebuilding the world
+    world_snapshot StartSnapshot;
+    world_snapshot CheckpointSnapshot;
+    bool ShouldSaveCheckpoint = false;
 };
 
 void ResetLevelState(game_main *g, level_state *l, const std::string &levelNumber);
 void InitLevelState(game_main *g, level_state *l);
+void InitCollisionHandlers(level_state *l);
+void RemoveGameplayEntities(entity_world &w);
 void AddIntroText(game_main *g, level_state *l, const char *text, color c);
 void SpawnCheckpoint(game_main *g, level_state *l);
 void SpawnFinish(game_main *g, level_state *l);
@@ -89,8 +89,10 @@ void UpdateFinalCamera(game_main *g)
 {
     auto &fc = g->FinalCamera;
     auto &c = g->Camera;
-    fc.Position = WorldToRenderTransform(g->World, c.Position, g->RenderState.BendRadius);
-    fc.LookAt = WorldToRenderTransform(g->World, c.LookAt, g->RenderState.BendRadius);
+    vec3 position = glm::mix(g->PrevCameraPosition, c.Position, g->RenderAlpha);
+    vec3 lookAt = glm::mix(g->PrevCameraLookAt, c.LookAt, g->RenderAlpha);
+    fc.Position = WorldToRenderTransform(g->World, position, g->RenderState.BendRadius);
+    fc.LookAt = WorldToRenderTransform(g->World, lookAt, g->RenderState.BendRadius);
 
     if (fc.LookAt.y < fc.Position.y)
     {
@@ -118,6 +120,51 @@ void ResetMenuState(game_main *g)
 }
 void UpdateMenuState(game_main *g, float dt);
 
+// Applies the graphics options without a restart, the render targets
+// follow the new size and sample count from the next frame on
+static void ApplyGraphicsOptions(game_main *g)
+{
+	auto &opts = g->Options->Values;
+	auto &r = g->RenderState;
+	r.SampleCount = opts["graphics/aa"]->Bool ? r.MaxMultiSampleCount : 1;
+	Global_Renderer_BloomEnabled = opts["graphics/bloom"]->Bool;
+
+	// the headless platform has no window to resize
+	if (!g->Window)
+	{
+		return;
+	}
+
+	int resID = glm::clamp(opts["graphics/resolution"]->Int, 0, int(ARRAY_COUNT(Global_Resolutions)) - 1);
+	auto res = Global_Resolutions[resID];
+	bool fullscreen = opts["graphics/fullscreen"]->Bool;
+	bool wasFullscreen = (SDL_GetWindowFlags(g->Window) & SDL_WINDOW_FULLSCREEN) != 0;
+	if (res.Width == g->Width && res.Height == g->Height && fullscreen == wasFullscreen)
+	{
+		return;
+	}
+
+	int vWidth = res.Width;
+	int vHeight = res.Height;
+	SDL_SetWindowFullscreen(g->Window, fullscreen ? SDL_WINDOW_FULLSCREEN : 0);
+	SDL_SetWindowSize(g->Window, res.Width, res.Height);
+	if (fullscreen)
+	{
+		SDL_DisplayMode displayMode;
+		SDL_GetDisplayMode(0, 0, &displayMode);
+
+		vWidth = displayMode.w;
+		vHeight = displayMode.h;
+	}
+
+	g->Width = res.Width;
+	g->Height = res.Height;
+	g->ViewportWidth = vWidth;
+	g->ViewportHeight = vHeight;
+	MakeCameraOrthographic(g->GUICamera, 0, g->Width, 0, g->Height, -1, 1);
+	ResizeRenderState(r, g->Width, g->Height, vWidth, vHeight);
+}
+
 
 void InitMenuState(game_main *g)
 {
@@ -152,6 +199,7 @@ void InitMenuState(game_main *g)
 	GraphicsMenu.Items[1].Switch.Value = &g->Options->Values["graphics/fullscreen"]->Bool;
 	GraphicsMenu.Items[2].Switch.Value = &g->Options->Values["graphics/aa"]->Bool;
 	GraphicsMenu.Items[3].Switch.Value = &g->Options->Values["graphics/bloom"]->Bool;
+	ApplyGraphicsOptions(g);
 
 	AudioMenu.Items[0].SliderFloat.Min = 0;
 	AudioMenu.Items[0].SliderFloat.Max = 1;
@@ -238,6 +286,7 @@ void UpdateMenuState(game_main *g, float dt)
 		{
 			m->Screen = MenuScreen_Opts;
 			g->Options->Values["graphics/resolution"]->Int = GraphicsMenu.Items[0].Options.SelectedIndex;
+			ApplyGraphicsOptions(g);
 			SaveOptions(g);
 		}
 	}
@@ -263,7 +312,7 @@ void RenderMenuState(game_main *g, float dt)
     PostProcessBegin(g->RenderState);
     RenderBackground(g, g->World);
     RenderBegin(g->RenderState, dt);
-    RenderEntityWorld(g->RenderState, g->World, dt);
+    RenderEntityWorld(g->RenderState, g->World, g->RenderAlpha);
     UpdateFinalCamera(g);
     RenderEnd(g->RenderState, g->FinalCamera);
     PostProcessEnd(g->RenderState);
@@ -298,14 +347,8 @@ void RenderMenuState(game_main *g, float dt)
 		break;
 
 	case MenuScreen_OptsGraphics:
-	{
-		float halfX = g->Width*0.5f;
-		static auto font = FindBitmapFont(g->AssetLoader, "unispace_12", "main_assets");
-
 		DrawMenu(g, GraphicsMenu, g->GUI.MenuChangeTimer, m->Alpha, true);
-		DrawTextCentered(g->GUI, font, "Warning: graphics settings need restart to apply", rect{ halfX, GetRealPixels(g, 50), 0,0 }, Color_white);
 		break;
-	}
 
 	case MenuScreen_Cred:
 		DrawMenu(g, *CredMenu, g->GUI.MenuChangeTimer, m->Alpha, true);
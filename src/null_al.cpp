@@ -0,0 +1,264 @@
+// Copyright
+
+// Null OpenAL backend for the headless platform. Nothing reaches a
+// device, but sources consume their queued buffers in real time so the
+// music streaming and IsPlaying checks behave like they do with sound.
+
+typedef std::chrono::steady_clock null_al_clock;
+
+struct null_al_stats
+{
+    uint64 NumCalls = 0;
+    uint64 NumPlays = 0;
+    uint64 BytesBuffered = 0;
+};
+
+struct null_al_buffer
+{
+    double Duration = 0;
+};
+
+struct null_al_source
+{
+    ALint State = AL_INITIAL;
+    std::vector<ALuint> Queue;
+    size_t Current = 0;
+    double Offset = 0;
+    float Pitch = 1;
+    bool Looping = false;
+    null_al_clock::time_point LastMix;
+};
+
+struct null_al_state
+{
+    std::mutex Mutex;
+    null_al_stats Stats;
+    ALuint NextName = 1;
+    std::unordered_map<ALuint, null_al_buffer> Buffers;
+    std::unordered_map<ALuint, null_al_source> Sources;
+};
+
+static null_al_state Global_NullAL;
+
+#define NULL_AL_CALL() \
+    std::lock_guard<std::mutex> nullLock(Global_NullAL.Mutex); \
+    Global_NullAL.Stats.NumCalls++
+
+static double NullQueueDuration(null_al_source &src, size_t begin)
+{
+    double result = 0;
+    for (size_t i = begin; i < src.Queue.size(); i++)
+    {
+        result += Global_NullAL.Buffers[src.Queue[i]].Duration;
+    }
+    return result;
+}
+
+// Advances the source by the time passed since it was last mixed
+static void NullMixSource(null_al_source &src)
+{
+    auto now = null_al_clock::now();
+    double t = std::chrono::duration<double>(now - src.LastMix).count() * src.Pitch;
+    src.LastMix = now;
+    if (src.State != AL_PLAYING)
+    {
+        return;
+    }
+
+    t += src.Offset;
+    if (src.Looping)
+    {
+        double total = NullQueueDuration(src, 0);
+        if (total <= 0)
+        {
+            return;
+        }
+        // wrap the position from the start of the queue
+        t = std::fmod(t + total - NullQueueDuration(src, src.Current), total);
+        src.Current = 0;
+    }
+
+    while (src.Current < src.Queue.size())
+    {
+        double duration = Global_NullAL.Buffers[src.Queue[src.Current]].Duration;
+        if (t < duration)
+        {
+            break;
+        }
+        t -= duration;
+        src.Current++;
+    }
+
+    if (src.Current >= src.Queue.size())
+    {
+        src.State = AL_STOPPED;
+        t = 0;
+    }
+    src.Offset = t;
+}
+
+static void NullGenALNames(ALsizei n, ALuint *names)
+{
+    for (ALsizei i = 0; i < n; i++)
+    {
+        names[i] = Global_NullAL.NextName++;
+    }
+}
+
+extern "C"
+{
+    ALenum AL_APIENTRY alGetError(void) { return AL_NO_ERROR; }
+    ALCenum ALC_APIENTRY alcGetError(ALCdevice *device) { return ALC_NO_ERROR; }
+
+    void AL_APIENTRY alListener3f(ALenum param, ALfloat value1, ALfloat value2, ALfloat value3) { NULL_AL_CALL(); }
+    void AL_APIENTRY alListenerfv(ALenum param, const ALfloat *values) { NULL_AL_CALL(); }
+
+    void AL_APIENTRY alGenBuffers(ALsizei n, ALuint *buffers)
+    {
+        NULL_AL_CALL();
+        NullGenALNames(n, buffers);
+        for (ALsizei i = 0; i < n; i++)
+        {
+            Global_NullAL.Buffers[buffers[i]] = null_al_buffer{};
+        }
+    }
+
+    void AL_APIENTRY alBufferData(ALuint bid, ALenum format, const ALvoid *data, ALsizei size, ALsizei freq)
+    {
+        NULL_AL_CALL();
+        int frameSize = 1;
+        switch (format)
+        {
+        case AL_FORMAT_MONO16:
+        case AL_FORMAT_STEREO8:
+            frameSize = 2;
+            break;
+
+        case AL_FORMAT_STEREO16:
+            frameSize = 4;
+            break;
+        }
+        Global_NullAL.Buffers[bid].Duration = (freq > 0) ? double(size / frameSize) / freq : 0;
+        Global_NullAL.Stats.BytesBuffered += size;
+    }
+
+    void AL_APIENTRY alGenSources(ALsizei n, ALuint *sources)
+    {
+        NULL_AL_CALL();
+        NullGenALNames(n, sources);
+        for (ALsizei i = 0; i < n; i++)
+        {
+            Global_NullAL.Sources[sources[i]].LastMix = null_al_clock::now();
+        }
+    }
+
+    void AL_APIENTRY alDeleteSources(ALsizei n, const ALuint *sources)
+    {
+        NULL_AL_CALL();
+        for (ALsizei i = 0; i < n; i++)
+        {
+            Global_NullAL.Sources.erase(sources[i]);
+        }
+    }
+
+    void AL_APIENTRY alSourcef(ALuint sid, ALenum param, ALfloat value)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        if (param == AL_PITCH)
+        {
+            NullMixSource(src);
+            src.Pitch = value;
+        }
+    }
+
+    void AL_APIENTRY alSource3f(ALuint sid, ALenum param, ALfloat value1, ALfloat value2, ALfloat value3) { NULL_AL_CALL(); }
+
+    void AL_APIENTRY alSourcei(ALuint sid, ALenum param, ALint value)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        switch (param)
+        {
+        case AL_LOOPING:
+            src.Looping = (value == AL_TRUE);
+            break;
+
+        case AL_BUFFER:
+            src.Queue.clear();
+            if (value != 0)
+            {
+                src.Queue.push_back(ALuint(value));
+            }
+            src.Current = 0;
+            src.Offset = 0;
+            break;
+        }
+    }
+
+    void AL_APIENTRY alGetSourcei(ALuint sid, ALenum param, ALint *value)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        NullMixSource(src);
+        switch (param)
+        {
+        case AL_SOURCE_STATE:
+            *value = src.State;
+            break;
+
+        case AL_BUFFERS_PROCESSED:
+            *value = ALint(src.Current);
+            break;
+
+        case AL_BUFFERS_QUEUED:
+            *value = ALint(src.Queue.size());
+            break;
+
+        default:
+            *value = 0;
+            break;
+        }
+    }
+
+    void AL_APIENTRY alSourcePlay(ALuint sid)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        if (src.State != AL_PLAYING)
+        {
+            src.Current = 0;
+            src.Offset = 0;
+        }
+        src.State = AL_PLAYING;
+        src.LastMix = null_al_clock::now();
+        Global_NullAL.Stats.NumPlays++;
+    }
+
+    void AL_APIENTRY alSourceStop(ALuint sid)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        src.State = AL_STOPPED;
+        src.Current = src.Queue.size();
+        src.Offset = 0;
+    }
+
+    void AL_APIENTRY alSourceQueueBuffers(ALuint sid, ALsizei numEntries, const ALuint *bids)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        NullMixSource(src);
+        src.Queue.insert(src.Queue.end(), bids, bids + numEntries);
+    }
+
+    void AL_APIENTRY alSourceUnqueueBuffers(ALuint sid, ALsizei numEntries, ALuint *bids)
+    {
+        NULL_AL_CALL();
+        auto &src = Global_NullAL.Sources[sid];
+        size_t n = std::min(size_t(numEntries), src.Current);
+        std::copy(src.Queue.begin(), src.Queue.begin() + n, bids);
+        src.Queue.erase(src.Queue.begin(), src.Queue.begin() + n);
+        src.Current -= n;
+    }
+}
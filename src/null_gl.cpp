@@ -0,0 +1,394 @@
+// Copyright
+
+// Null OpenGL backend for the headless platform. Every call is counted
+// and the objects get fresh names, but nothing is drawn. Buffers keep a
+// copy of their data so the game can still map and write to them.
+
+struct null_gl_stats
+{
+    uint64 NumCalls = 0;
+    uint64 NumDrawCalls = 0;
+    uint64 NumObjects = 0;
+    uint64 BytesUploaded = 0;
+};
+
+struct null_gl_state
+{
+    null_gl_stats Stats;
+    GLuint NextName = 1;
+    GLuint ArrayBuffer = 0;
+    GLuint ElementArrayBuffer = 0;
+    GLuint UniformBuffer = 0;
+    std::unordered_map<GLuint, std::vector<uint8>> Buffers;
+};
+
+static null_gl_state Global_NullGL;
+
+#define NULL_GL_CALL() Global_NullGL.Stats.NumCalls++
+
+static void NullGenNames(GLsizei n, GLuint *names)
+{
+    NULL_GL_CALL();
+    for (GLsizei i = 0; i < n; i++)
+    {
+        names[i] = Global_NullGL.NextName++;
+    }
+    Global_NullGL.Stats.NumObjects += n;
+}
+
+static GLuint NullGenName()
+{
+    GLuint result;
+    NullGenNames(1, &result);
+    return result;
+}
+
+static std::vector<uint8> *NullGetBoundBuffer(GLenum target)
+{
+    GLuint name = Global_NullGL.ArrayBuffer;
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        name = Global_NullGL.ElementArrayBuffer;
+    }
+    else if (target == GL_UNIFORM_BUFFER)
+    {
+        name = Global_NullGL.UniformBuffer;
+    }
+    if (name == 0)
+    {
+        return NULL;
+    }
+    return &Global_NullGL.Buffers[name];
+}
+
+extern "C"
+{
+    // GL 1.1, exported by the GL library itself
+
+    void GLAPIENTRY glGetIntegerv(GLenum pname, GLint *params)
+    {
+        NULL_GL_CALL();
+        switch (pname)
+        {
+        case GL_MAX_COLOR_TEXTURE_SAMPLES:
+            params[0] = 4;
+            break;
+
+        case GL_VIEWPORT:
+        case GL_SCISSOR_BOX:
+            params[0] = params[1] = params[2] = params[3] = 0;
+            break;
+
+        case GL_POLYGON_MODE:
+            params[0] = params[1] = GL_FILL;
+            break;
+
+        case GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT:
+            params[0] = 256;
+            break;
+
+        default:
+            params[0] = 0;
+            break;
+        }
+    }
+
+    void GLAPIENTRY glGetFloatv(GLenum pname, GLfloat *params)
+    {
+        NULL_GL_CALL();
+        params[0] = (pname == GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT) ? 1.0f : 0.0f;
+    }
+
+    const GLubyte * GLAPIENTRY glGetString(GLenum name)
+    {
+        NULL_GL_CALL();
+        return (const GLubyte *)"Null";
+    }
+
+    GLboolean GLAPIENTRY glIsEnabled(GLenum cap) { NULL_GL_CALL(); return GL_FALSE; }
+    void GLAPIENTRY glEnable(GLenum cap) { NULL_GL_CALL(); }
+    void GLAPIENTRY glDisable(GLenum cap) { NULL_GL_CALL(); }
+    void GLAPIENTRY glViewport(GLint x, GLint y, GLsizei width, GLsizei height) { NULL_GL_CALL(); }
+    void GLAPIENTRY glScissor(GLint x, GLint y, GLsizei width, GLsizei height) { NULL_GL_CALL(); }
+    void GLAPIENTRY glClear(GLbitfield mask) { NULL_GL_CALL(); }
+    void GLAPIENTRY glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha) { NULL_GL_CALL(); }
+    void GLAPIENTRY glBlendFunc(GLenum sfactor, GLenum dfactor) { NULL_GL_CALL(); }
+    void GLAPIENTRY glPolygonMode(GLenum face, GLenum mode) { NULL_GL_CALL(); }
+    void GLAPIENTRY glLineWidth(GLfloat width) { NULL_GL_CALL(); }
+    void GLAPIENTRY glDepthMask(GLboolean flag) { NULL_GL_CALL(); }
+    void GLAPIENTRY glDepthFunc(GLenum func) { NULL_GL_CALL(); }
+    void GLAPIENTRY glPixelStorei(GLenum pname, GLint param) { NULL_GL_CALL(); }
+    void GLAPIENTRY glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *pixels)
+    {
+        NULL_GL_CALL();
+
+        // only read back as RGBA bytes
+        memset(pixels, 0, size_t(width)*height*4);
+    }
+
+    void GLAPIENTRY glDrawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        NULL_GL_CALL();
+        Global_NullGL.Stats.NumDrawCalls++;
+    }
+
+    void GLAPIENTRY glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+    {
+        NULL_GL_CALL();
+        Global_NullGL.Stats.NumDrawCalls++;
+    }
+
+    void GLAPIENTRY glGenTextures(GLsizei n, GLuint *textures) { NullGenNames(n, textures); }
+    void GLAPIENTRY glDeleteTextures(GLsizei n, const GLuint *textures) { NULL_GL_CALL(); }
+    void GLAPIENTRY glBindTexture(GLenum target, GLuint texture) { NULL_GL_CALL(); }
+    void GLAPIENTRY glTexParameteri(GLenum target, GLenum pname, GLint param) { NULL_GL_CALL(); }
+    void GLAPIENTRY glTexParameterf(GLenum target, GLenum pname, GLfloat param) { NULL_GL_CALL(); }
+
+    void GLAPIENTRY glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+                                 GLint border, GLenum format, GLenum type, const void *pixels)
+    {
+        NULL_GL_CALL();
+        if (pixels)
+        {
+            Global_NullGL.Stats.BytesUploaded += width*height*4;
+        }
+    }
+}
+
+// Everything after GL 1.1 is loaded by GLEW, so the null backend defines
+// the function pointers GLEW would have filled in
+
+static void GLAPIENTRY NullBindBuffer(GLenum target, GLuint buffer)
+{
+    NULL_GL_CALL();
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        Global_NullGL.ElementArrayBuffer = buffer;
+    }
+    else if (target == GL_UNIFORM_BUFFER)
+    {
+        Global_NullGL.UniformBuffer = buffer;
+    }
+    else
+    {
+        Global_NullGL.ArrayBuffer = buffer;
+    }
+}
+
+static void GLAPIENTRY NullBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+    NULL_GL_CALL();
+    auto buffer = NullGetBoundBuffer(target);
+    if (buffer)
+    {
+        buffer->resize(size);
+        if (data)
+        {
+            memcpy(buffer->data(), data, size);
+            Global_NullGL.Stats.BytesUploaded += size;
+        }
+    }
+}
+
+static void GLAPIENTRY NullBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    NULL_GL_CALL();
+    auto buffer = NullGetBoundBuffer(target);
+    if (buffer && size_t(offset + size) <= buffer->size())
+    {
+        memcpy(buffer->data() + offset, data, size);
+        Global_NullGL.Stats.BytesUploaded += size;
+    }
+}
+
+static void *GLAPIENTRY NullMapBuffer(GLenum target, GLenum access)
+{
+    NULL_GL_CALL();
+    auto buffer = NullGetBoundBuffer(target);
+    if (!buffer || buffer->empty())
+    {
+        return NULL;
+    }
+    return buffer->data();
+}
+
+static void GLAPIENTRY NullBufferStorage(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)
+{
+    NullBufferData(target, size, data, 0);
+}
+
+static void *GLAPIENTRY NullMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+    NULL_GL_CALL();
+    auto buffer = NullGetBoundBuffer(target);
+    if (!buffer || size_t(offset + length) > buffer->size())
+    {
+        return NULL;
+    }
+    return buffer->data() + offset;
+}
+
+// nothing runs on a GPU, every fence is signaled right away
+static GLsync GLAPIENTRY NullFenceSync(GLenum condition, GLbitfield flags)
+{
+    NULL_GL_CALL();
+    return (GLsync)&Global_NullGL;
+}
+
+static GLenum GLAPIENTRY NullClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+    NULL_GL_CALL();
+    return GL_ALREADY_SIGNALED;
+}
+
+static void GLAPIENTRY NullDeleteSync(GLsync sync) { NULL_GL_CALL(); }
+
+static void GLAPIENTRY NullGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64 *params)
+{
+    NULL_GL_CALL();
+    *params = 0;
+}
+
+static GLboolean GLAPIENTRY NullUnmapBuffer(GLenum target)
+{
+    NULL_GL_CALL();
+    return GL_TRUE;
+}
+
+static void GLAPIENTRY NullDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    NULL_GL_CALL();
+    for (GLsizei i = 0; i < n; i++)
+    {
+        Global_NullGL.Buffers.erase(buffers[i]);
+    }
+}
+
+static void GLAPIENTRY NullDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount)
+{
+    NULL_GL_CALL();
+    Global_NullGL.Stats.NumDrawCalls++;
+}
+
+static void GLAPIENTRY NullDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount)
+{
+    NULL_GL_CALL();
+    Global_NullGL.Stats.NumDrawCalls++;
+}
+
+// shaders always compile and link, without an info log
+static void GLAPIENTRY NullGetShaderiv(GLuint shader, GLenum pname, GLint *param)
+{
+    NULL_GL_CALL();
+    *param = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;
+}
+
+static void GLAPIENTRY NullGetProgramiv(GLuint program, GLenum pname, GLint *param)
+{
+    NULL_GL_CALL();
+    *param = (pname == GL_LINK_STATUS) ? GL_TRUE : 0;
+}
+
+static void GLAPIENTRY NullGetInfoLog(GLuint object, GLsizei bufSize, GLsizei *length, GLchar *infoLog)
+{
+    NULL_GL_CALL();
+    if (length) *length = 0;
+    if (infoLog && bufSize > 0) infoLog[0] = 0;
+}
+
+static GLuint GLAPIENTRY NullCreateShader(GLenum type) { return NullGenName(); }
+static GLuint GLAPIENTRY NullCreateProgram() { return NullGenName(); }
+static GLint GLAPIENTRY NullGetLocation(GLuint program, const GLchar *name) { NULL_GL_CALL(); return 0; }
+static GLuint GLAPIENTRY NullGetUniformBlockIndex(GLuint program, const GLchar *name) { NULL_GL_CALL(); return 0; }
+static GLenum GLAPIENTRY NullCheckFramebufferStatus(GLenum target) { NULL_GL_CALL(); return GL_FRAMEBUFFER_COMPLETE; }
+
+static void GLAPIENTRY NullShaderSource(GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullObject(GLuint object) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullObjectPair(GLuint first, GLuint second) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullObjectTriple(GLuint a, GLuint b, GLuint c) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullEnum(GLenum value) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullEnumPair(GLenum first, GLenum second) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullEnumQuad(GLenum a, GLenum b, GLenum c, GLenum d) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullBindFramebuffer(GLenum target, GLuint framebuffer) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullBindBufferBase(GLenum target, GLuint index, GLuint buffer) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullDeleteNames(GLsizei n, const GLuint *names) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullDrawBuffers(GLsizei n, const GLenum *bufs) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullUniform1i(GLint location, GLint v0) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullUniformfv(GLint location, GLsizei count, const GLfloat *value) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) { NULL_GL_CALL(); }
+static void GLAPIENTRY NullTexImage2DMultisample(GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height, GLboolean fixedsamplelocations) { NULL_GL_CALL(); }
+
+extern "C"
+{
+    PFNGLGENBUFFERSPROC __glewGenBuffers = NullGenNames;
+    PFNGLDELETEBUFFERSPROC __glewDeleteBuffers = NullDeleteBuffers;
+    PFNGLBINDBUFFERPROC __glewBindBuffer = NullBindBuffer;
+    PFNGLBUFFERDATAPROC __glewBufferData = NullBufferData;
+    PFNGLBUFFERSUBDATAPROC __glewBufferSubData = NullBufferSubData;
+    PFNGLMAPBUFFERPROC __glewMapBuffer = NullMapBuffer;
+    PFNGLUNMAPBUFFERPROC __glewUnmapBuffer = NullUnmapBuffer;
+    PFNGLBUFFERSTORAGEPROC __glewBufferStorage = NullBufferStorage;
+    PFNGLMAPBUFFERRANGEPROC __glewMapBufferRange = NullMapBufferRange;
+    GLboolean __GLEW_ARB_buffer_storage = GL_TRUE;
+    PFNGLFENCESYNCPROC __glewFenceSync = NullFenceSync;
+    PFNGLCLIENTWAITSYNCPROC __glewClientWaitSync = NullClientWaitSync;
+    PFNGLDELETESYNCPROC __glewDeleteSync = NullDeleteSync;
+    PFNGLGENQUERIESPROC __glewGenQueries = NullGenNames;
+    PFNGLBEGINQUERYPROC __glewBeginQuery = NullObjectPair;
+    PFNGLENDQUERYPROC __glewEndQuery = NullObject;
+    PFNGLGETQUERYOBJECTUI64VPROC __glewGetQueryObjectui64v = NullGetQueryObjectui64v;
+    PFNGLBINDBUFFERBASEPROC __glewBindBufferBase = NullBindBufferBase;
+    PFNGLBINDBUFFERRANGEPROC __glewBindBufferRange = NullBindBufferRange;
+
+    PFNGLGENVERTEXARRAYSPROC __glewGenVertexArrays = NullGenNames;
+    PFNGLDELETEVERTEXARRAYSPROC __glewDeleteVertexArrays = NullDeleteNames;
+    PFNGLBINDVERTEXARRAYPROC __glewBindVertexArray = NullObject;
+    PFNGLENABLEVERTEXATTRIBARRAYPROC __glewEnableVertexAttribArray = NullObject;
+    PFNGLVERTEXATTRIBPOINTERPROC __glewVertexAttribPointer = NullVertexAttribPointer;
+    PFNGLVERTEXATTRIBDIVISORPROC __glewVertexAttribDivisor = NullObjectPair;
+    PFNGLDRAWARRAYSINSTANCEDPROC __glewDrawArraysInstanced = NullDrawArraysInstanced;
+    PFNGLDRAWELEMENTSINSTANCEDPROC __glewDrawElementsInstanced = NullDrawElementsInstanced;
+
+    PFNGLCREATESHADERPROC __glewCreateShader = NullCreateShader;
+    PFNGLDELETESHADERPROC __glewDeleteShader = NullObject;
+    PFNGLSHADERSOURCEPROC __glewShaderSource = NullShaderSource;
+    PFNGLCOMPILESHADERPROC __glewCompileShader = NullObject;
+    PFNGLGETSHADERIVPROC __glewGetShaderiv = NullGetShaderiv;
+    PFNGLGETSHADERINFOLOGPROC __glewGetShaderInfoLog = NullGetInfoLog;
+    PFNGLCREATEPROGRAMPROC __glewCreateProgram = NullCreateProgram;
+    PFNGLDELETEPROGRAMPROC __glewDeleteProgram = NullObject;
+    PFNGLATTACHSHADERPROC __glewAttachShader = NullObjectPair;
+    PFNGLDETACHSHADERPROC __glewDetachShader = NullObjectPair;
+    PFNGLLINKPROGRAMPROC __glewLinkProgram = NullObject;
+    PFNGLGETPROGRAMIVPROC __glewGetProgramiv = NullGetProgramiv;
+    PFNGLGETPROGRAMINFOLOGPROC __glewGetProgramInfoLog = NullGetInfoLog;
+    PFNGLUSEPROGRAMPROC __glewUseProgram = NullObject;
+    PFNGLGETUNIFORMLOCATIONPROC __glewGetUniformLocation = NullGetLocation;
+    PFNGLGETATTRIBLOCATIONPROC __glewGetAttribLocation = NullGetLocation;
+    PFNGLUNIFORM1IPROC __glewUniform1i = NullUniform1i;
+    PFNGLUNIFORM1FVPROC __glewUniform1fv = NullUniformfv;
+    PFNGLUNIFORM2FVPROC __glewUniform2fv = NullUniformfv;
+    PFNGLUNIFORM3FVPROC __glewUniform3fv = NullUniformfv;
+    PFNGLUNIFORM4FVPROC __glewUniform4fv = NullUniformfv;
+    PFNGLUNIFORMMATRIX4FVPROC __glewUniformMatrix4fv = NullUniformMatrix4fv;
+    PFNGLGETUNIFORMBLOCKINDEXPROC __glewGetUniformBlockIndex = NullGetUniformBlockIndex;
+    PFNGLUNIFORMBLOCKBINDINGPROC __glewUniformBlockBinding = NullObjectTriple;
+
+    PFNGLGENFRAMEBUFFERSPROC __glewGenFramebuffers = NullGenNames;
+    PFNGLDELETEFRAMEBUFFERSPROC __glewDeleteFramebuffers = NullDeleteNames;
+    PFNGLBINDFRAMEBUFFERPROC __glewBindFramebuffer = NullBindFramebuffer;
+    PFNGLFRAMEBUFFERTEXTURE2DPROC __glewFramebufferTexture2D = NullFramebufferTexture2D;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC __glewCheckFramebufferStatus = NullCheckFramebufferStatus;
+    PFNGLDRAWBUFFERSPROC __glewDrawBuffers = NullDrawBuffers;
+    PFNGLTEXIMAGE2DMULTISAMPLEPROC __glewTexImage2DMultisample = NullTexImage2DMultisample;
+    PFNGLGENERATEMIPMAPPROC __glewGenerateMipmap = NullEnum;
+    PFNGLACTIVETEXTUREPROC __glewActiveTexture = NullEnum;
+    PFNGLBINDSAMPLERPROC __glewBindSampler = NullObjectPair;
+
+    PFNGLBLENDEQUATIONPROC __glewBlendEquation = NullEnum;
+    PFNGLBLENDEQUATIONSEPARATEPROC __glewBlendEquationSeparate = NullEnumPair;
+    PFNGLBLENDFUNCSEPARATEPROC __glewBlendFuncSeparate = NullEnumQuad;
+}
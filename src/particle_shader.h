@@ -0,0 +1,70 @@
+#ifndef DRAFT_PARTICLE_SHADER_H
+#define DRAFT_PARTICLE_SHADER_H
+
+static const char *ParticleVertexShaderSource = R"EOF(
+
+// per instance attributes, xyz is the position and w the half width
+layout (location = 0) in vec4 a_Start;
+layout (location = 1) in vec4 a_End;
+layout (location = 2) in vec4 a_Color;
+layout (location = 3) in vec2 a_Alpha;
+
+uniform int  u_LinePass;
+
+smooth out vec4 v_Color;
+smooth out vec4 v_WorldPos;
+
+void main() {
+  // the quad is a 4 vertex strip, the edges are 2 separate lines
+  float t, side;
+  if (u_LinePass == 1) {
+    t = float(gl_VertexID & 1);
+    side = (gl_VertexID < 2) ? -1.0 : 1.0;
+  } else {
+    t = float(gl_VertexID >> 1);
+    side = ((gl_VertexID & 1) == 0) ? -1.0 : 1.0;
+  }
+
+  vec4 p = mix(a_Start, a_End, t);
+  float width = p.w;
+  float alpha = mix(a_Alpha.x, a_Alpha.y, t);
+  if (u_LinePass == 1) {
+    width += 0.05;
+    alpha = 1.0;
+  }
+
+  vec4 worldPos = vec4(WorldToRenderTransform(p.xyz + vec3(side*width, 0, 0)), 1.0);
+  gl_Position = u_ProjectionView * worldPos;
+
+  v_Color = vec4(a_Color.rgb, a_Color.a * alpha);
+  v_WorldPos = worldPos;
+}
+
+)EOF";
+
+static const char *ParticleFragmentShaderSource = R"EOF(
+
+#define AmbientLight 0.5f
+
+uniform float u_Emission;
+
+smooth in vec4 v_Color;
+smooth in vec4 v_WorldPos;
+
+layout (location = 0) out vec4 BlendUnitColor[2];
+
+void main() {
+  vec3 gamma = vec3(1.0/2.2);
+  vec4 Color = vec4(pow(v_Color.rgb * AmbientLight, gamma), v_Color.a);
+
+  float fog = abs(v_WorldPos.y - u_CamPos.y);
+  fog = (u_FogEnd - fog) / (u_FogEnd - u_FogStart);
+  fog = clamp(fog, 0.0, 1.0);
+
+  BlendUnitColor[0] = mix(Color, u_FogColor, 1.0 - fog);
+  BlendUnitColor[1] = vec4(vec3(u_Emission), 1.0) * v_Color.a;
+}
+
+)EOF";
+
+#endif
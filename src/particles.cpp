@@ -0,0 +1,302 @@
+// Copyright
+
+static void InitParticleArrays(memory_arena &arena, particle_arrays &arr, size_t capacity)
+{
+    float **fields[] = {
+        &arr.PosX, &arr.PosY, &arr.PosZ,
+        &arr.VelX, &arr.VelY, &arr.VelZ,
+        &arr.Life, &arr.Decay, &arr.Size,
+        &arr.ColorR, &arr.ColorG, &arr.ColorB,
+    };
+    for (size_t i = 0; i < ArrayCount(fields); i++)
+    {
+        *fields[i] = (float *)PushSize(arena, capacity*sizeof(float), "particle arrays");
+    }
+    arr.Capacity = capacity;
+}
+
+void InitParticleSystem(memory_arena &arena, particle_system &ps, uint32 seed)
+{
+    InitParticleArrays(arena, ps.Particles, PARTICLE_CAPACITY);
+    InitParticleArrays(arena, ps.Ribbons, RIBBON_CAPACITY);
+
+    const size_t pointsSize = RIBBON_CAPACITY*RIBBON_POINT_COUNT*sizeof(float);
+    ps.PointX = (float *)PushSize(arena, pointsSize, "ribbon points");
+    ps.PointY = (float *)PushSize(arena, pointsSize, "ribbon points");
+    ps.PointZ = (float *)PushSize(arena, pointsSize, "ribbon points");
+    ps.Entropy = RandomSeed(seed);
+}
+
+void ResetParticleSystem(particle_system &ps)
+{
+    ps.Particles.Count = 0;
+    ps.Ribbons.Count = 0;
+    ps.PointStart = 0;
+    ps.RecordTimer = 0;
+}
+
+// Returns the slot after the live ones, or -1 if they're all live
+static int NextParticleSlot(particle_arrays &arr, vec3 pos, vec3 vel, color c, float size, float lifeTime)
+{
+    if (arr.Count == arr.Capacity)
+    {
+        arr.NumDropped++;
+        return -1;
+    }
+    size_t i = arr.Count++;
+
+    arr.PosX[i] = pos.x;
+    arr.PosY[i] = pos.y;
+    arr.PosZ[i] = pos.z;
+    arr.VelX[i] = vel.x;
+    arr.VelY[i] = vel.y;
+    arr.VelZ[i] = vel.z;
+    arr.Life[i] = 1.0f;
+    arr.Decay[i] = (lifeTime > 0.0f) ? 1.0f/lifeTime : 0.0f;
+    arr.Size[i] = size;
+    arr.ColorR[i] = c.r;
+    arr.ColorG[i] = c.g;
+    arr.ColorB[i] = c.b;
+    return int(i);
+}
+
+void EmitParticle(particle_system &ps, vec3 pos, vec3 vel, color c, float size, float lifeTime)
+{
+    NextParticleSlot(ps.Particles, pos, vel, c, size, lifeTime);
+}
+
+// A lifeTime of zero makes the ribbon live until it goes behind the camera
+void EmitRibbon(particle_system &ps, vec3 pos, vec3 vel, color c, float radius, float lifeTime = 0.0f)
+{
+    int i = NextParticleSlot(ps.Ribbons, pos, vel, c, radius, lifeTime);
+    if (i < 0) return;
+
+    for (int p = 0; p < RIBBON_POINT_COUNT; p++)
+    {
+        size_t pi = p*RIBBON_CAPACITY + i;
+        ps.PointX[pi] = pos.x;
+        ps.PointY[pi] = pos.y;
+        ps.PointZ[pi] = pos.z;
+    }
+}
+
+static void MoveParticle(particle_arrays &arr, size_t dst, size_t src)
+{
+    float **fields[] = {
+        &arr.PosX, &arr.PosY, &arr.PosZ,
+        &arr.VelX, &arr.VelY, &arr.VelZ,
+        &arr.Life, &arr.Decay, &arr.Size,
+        &arr.ColorR, &arr.ColorG, &arr.ColorB,
+    };
+    for (size_t f = 0; f < ArrayCount(fields); f++)
+    {
+        (*fields[f])[dst] = (*fields[f])[src];
+    }
+}
+
+// Replaces the dead slots by the last live ones, the ribbon points move
+// along with their ribbon if points is set
+static void CompactParticleArrays(particle_arrays &arr, particle_system *points = NULL)
+{
+    size_t i = 0;
+    while (i < arr.Count)
+    {
+        if (arr.Life[i] > 0.0f)
+        {
+            i++;
+            continue;
+        }
+
+        size_t last = --arr.Count;
+        if (i == last) break;
+
+        MoveParticle(arr, i, last);
+        if (points)
+        {
+            for (int p = 0; p < RIBBON_POINT_COUNT; p++)
+            {
+                size_t offset = p*RIBBON_CAPACITY;
+                points->PointX[offset + i] = points->PointX[offset + last];
+                points->PointY[offset + i] = points->PointY[offset + last];
+                points->PointZ[offset + i] = points->PointZ[offset + last];
+            }
+        }
+    }
+}
+
+// Batch update kernel, anything behind cullY is killed
+static void UpdateParticleArrays(particle_arrays &arr, float cullY, float dt)
+{
+    size_t count = arr.Count;
+    float *px = arr.PosX, *py = arr.PosY, *pz = arr.PosZ;
+    float *vx = arr.VelX, *vy = arr.VelY, *vz = arr.VelZ;
+    float *life = arr.Life, *decay = arr.Decay;
+    for (size_t i = 0; i < count; i++)
+    {
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        pz[i] += vz[i] * dt;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        float l = life[i] - decay[i]*dt;
+        l = (py[i] < cullY) ? 0.0f : l;
+        life[i] = std::max(l, 0.0f);
+    }
+}
+
+static void StepParticleSystem(particle_system &ps, float cullY, float dt)
+{
+    UpdateParticleArrays(ps.Particles, cullY, dt);
+    CompactParticleArrays(ps.Particles);
+
+    // a ribbon is only killed when its tail is behind the camera too
+    auto &rb = ps.Ribbons;
+    float *tailY = ps.PointY + ps.PointStart*RIBBON_CAPACITY;
+    UpdateParticleArrays(rb, -std::numeric_limits<float>::infinity(), dt);
+    for (size_t i = 0; i < rb.Count; i++)
+    {
+        bool behind = rb.PosY[i] < cullY && tailY[i] < cullY;
+        rb.Life[i] = behind ? 0.0f : rb.Life[i];
+    }
+    CompactParticleArrays(rb, &ps);
+
+    ps.RecordTimer -= dt;
+    if (ps.RecordTimer <= 0)
+    {
+        ps.RecordTimer = Global_Game_TrailRecordTimer;
+
+        // the oldest point is overwritten by the current head
+        size_t offset = ps.PointStart*RIBBON_CAPACITY;
+        memcpy(ps.PointX + offset, rb.PosX, rb.Count*sizeof(float));
+        memcpy(ps.PointY + offset, rb.PosY, rb.Count*sizeof(float));
+        memcpy(ps.PointZ + offset, rb.PosZ, rb.Count*sizeof(float));
+        ps.PointStart = (ps.PointStart + 1) % RIBBON_POINT_COUNT;
+    }
+}
+
+void UpdateParticleSystem(particle_system &ps, float cullY, float dt)
+{
+    BeginProfileTimer("Particles");
+    StepParticleSystem(ps, cullY, dt);
+    EndProfileTimer("Particles");
+}
+
+inline static float *PushParticleInstance(float *data, vec3 c1, float w1, vec3 c2, float w2,
+                                          float r, float g, float b, float fade, float a1, float a2)
+{
+    *data++ = c1.x; *data++ = c1.y; *data++ = c1.z; *data++ = w1;
+    *data++ = c2.x; *data++ = c2.y; *data++ = c2.z; *data++ = w2;
+    *data++ = r; *data++ = g; *data++ = b; *data++ = fade;
+    *data++ = a1; *data++ = a2;
+    return data;
+}
+
+inline static size_t GetMaxParticleInstances(particle_system &ps)
+{
+    return ps.Ribbons.Count*RIBBON_POINT_COUNT + ps.Particles.Count;
+}
+
+// Writes one instance per ribbon segment and per particle, returns the
+// number of instances written
+static size_t BuildParticleInstances(particle_system &ps, float *data)
+{
+    auto &pa = ps.Particles;
+    auto &rb = ps.Ribbons;
+    float *begin = data;
+    for (size_t i = 0; i < rb.Count; i++)
+    {
+        const float n = RIBBON_POINT_COUNT;
+        float r = rb.Size[i];
+        float rm = r * 0.8f;
+        for (int p = 0; p < RIBBON_POINT_COUNT; p++)
+        {
+            size_t i1 = ((ps.PointStart + p) % RIBBON_POINT_COUNT)*RIBBON_CAPACITY + i;
+            size_t i2 = ((ps.PointStart + p + 1) % RIBBON_POINT_COUNT)*RIBBON_CAPACITY + i;
+            vec3 c1 = vec3{ps.PointX[i1], ps.PointY[i1], ps.PointZ[i1]};
+            vec3 c2 = vec3{ps.PointX[i2], ps.PointY[i2], ps.PointZ[i2]};
+            if (p == RIBBON_POINT_COUNT - 1)
+            {
+                c2 = vec3{rb.PosX[i], rb.PosY[i], rb.PosZ[i]};
+            }
+
+            // the ribbon gets thinner and more transparent to the tail
+            float min2 = rm * ((n - p) / n);
+            float min1 = rm * ((n - p + 1) / n);
+            data = PushParticleInstance(data, c1, r - min1, c2, r - min2,
+                                        rb.ColorR[i], rb.ColorG[i], rb.ColorB[i], rb.Life[i],
+                                        1.0f - (min1 / r), 1.0f - (min2 / r));
+        }
+    }
+    for (size_t i = 0; i < pa.Count; i++)
+    {
+        vec3 vel = vec3{pa.VelX[i], pa.VelY[i], pa.VelZ[i]};
+        vec3 c2 = vec3{pa.PosX[i], pa.PosY[i], pa.PosZ[i]};
+        vec3 c1 = c2 - vel*PARTICLE_STREAK_TIME;
+        data = PushParticleInstance(data, c1, 0.0f, c2, pa.Size[i],
+                                    pa.ColorR[i], pa.ColorG[i], pa.ColorB[i], pa.Life[i],
+                                    0.0f, 1.0f);
+    }
+    return (data - begin) / PARTICLE_INSTANCE_SIZE;
+}
+
+// Writes the instances to the stream buffer, they're drawn at RenderEnd
+void DrawParticleSystem(render_state &rs, particle_system &ps)
+{
+    size_t maxInstances = GetMaxParticleInstances(ps);
+    rs.ParticleInstanceCount = 0;
+    if (maxInstances == 0) return;
+
+    size_t stride = PARTICLE_INSTANCE_SIZE*sizeof(float);
+    float *data = (float *)BeginStreamWrite(Global_StreamBuffer, maxInstances*stride, stride, rs.ParticleStreamOffset);
+    if (!data) return;
+    rs.ParticleStreamVBO = Global_StreamBuffer.VBO;
+
+    BeginProfileTimer("Particles build instances");
+    rs.ParticleInstanceCount = BuildParticleInstances(ps, data);
+    EndProfileTimer("Particles build instances");
+    EndStreamWrite(Global_StreamBuffer);
+}
+
+// Fills a separate system with explosion-like particles and ribbons
+// spread over the track and times the update and the instance building
+// of a frame, the particles live long enough to all be there at the end
+void BenchmarkParticles(particle_benchmark &bench, int numParticles, int numRibbons)
+{
+    const int numFrames = 60;
+    const float dt = 1.0f / 60.0f;
+
+    memory_arena arena;
+    particle_system ps;
+    InitParticleSystem(arena, ps, uint32(numParticles));
+    for (int i = 0; i < numRibbons; i++)
+    {
+        vec3 pos = vec3{RandomBetween(ps.Entropy, -4.0f, 4.0f), RandomBetween(ps.Entropy, 0.0f, 500.0f), 0.0f};
+        vec3 vel = vec3{RandomBetween(ps.Entropy, -5.0f, 5.0f), RandomBetween(ps.Entropy, 0.0f, 50.0f), RandomBetween(ps.Entropy, 0.0f, 5.0f)};
+        EmitRibbon(ps, pos, vel, Color_white, 0.2f, 10.0f);
+    }
+    for (int i = 0; i < numParticles; i++)
+    {
+        vec3 pos = vec3{RandomBetween(ps.Entropy, -4.0f, 4.0f), RandomBetween(ps.Entropy, 0.0f, 500.0f), 0.0f};
+        vec3 vel = vec3{RandomBetween(ps.Entropy, -5.0f, 5.0f), RandomBetween(ps.Entropy, 0.0f, 50.0f), RandomBetween(ps.Entropy, 0.0f, 5.0f)};
+        EmitParticle(ps, pos, vel, Color_white, 0.05f, 10.0f);
+    }
+
+    bench = particle_benchmark{};
+    bench.NumParticles = int(ps.Particles.Count);
+    bench.NumRibbons = int(ps.Ribbons.Count);
+    bench.NumFrames = numFrames;
+
+    std::vector<float> instances(GetMaxParticleInstances(ps)*PARTICLE_INSTANCE_SIZE);
+    for (int f = 0; f < numFrames; f++)
+    {
+        auto start = benchmark_clock::now();
+        StepParticleSystem(ps, -1.0f, dt);
+        bench.UpdateTime += MillisecondsSince(start) / numFrames;
+
+        start = benchmark_clock::now();
+        bench.NumInstances = BuildParticleInstances(ps, instances.data());
+        bench.BuildTime += MillisecondsSince(start) / numFrames;
+    }
+}
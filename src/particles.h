@@ -0,0 +1,56 @@
+#ifndef DRAFT_PARTICLES_H
+#define DRAFT_PARTICLES_H
+
+#define PARTICLE_CAPACITY  32768
+#define RIBBON_CAPACITY    1024
+#define RIBBON_POINT_COUNT 24
+
+#define PARTICLE_STREAK_TIME   0.03f
+#define PARTICLE_LINE_EMISSION 4.0f
+
+// Structure of arrays used both for free particles and for the heads
+// of the ribbons. The live ones are kept packed in [0, Count), a dead
+// one is replaced by the last one. When the arrays are full new ones
+// are dropped instead of taking the slot of a live one.
+struct particle_arrays
+{
+    float *PosX, *PosY, *PosZ;
+    float *VelX, *VelY, *VelZ;
+
+    // Life goes from 1 to 0 at Decay units per second,
+    // a Decay of zero means it only dies offscreen
+    float *Life, *Decay;
+    float *Size;
+    float *ColorR, *ColorG, *ColorB;
+
+    size_t Capacity = 0;
+    size_t Count = 0;
+    size_t NumDropped = 0;
+};
+
+struct particle_system
+{
+    random_series Entropy;
+    particle_arrays Particles;
+    particle_arrays Ribbons;
+
+    // The recorded ribbon points are stored point-major, so recording
+    // a new point for every ribbon is a copy of the head arrays
+    float *PointX, *PointY, *PointZ;
+    int PointStart = 0;
+    float RecordTimer = 0;
+};
+
+struct particle_benchmark
+{
+    int NumParticles = 0;
+    int NumRibbons = 0;
+    int NumFrames = 0;
+    double UpdateTime = 0;
+    double BuildTime = 0;
+    size_t NumInstances = 0;
+};
+
+void BenchmarkParticles(particle_benchmark &bench, int numParticles, int numRibbons);
+
+#endif
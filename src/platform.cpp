@@ -4,6 +4,7 @@
 #include <fstream>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 #define DRAFT_DEBUG
@@ -18,6 +19,7 @@
 #endif
 
 #include "options.cpp"
+#include "replay.cpp"
 
 static void OpenGameController(game_input &input)
 {
@@ -128,6 +130,7 @@ int main(int argc, char **argv)
     game.Platform.GetFileLastWriteTime = PlatformGetFileLastWriteTime;
     game.Platform.GetMilliseconds = PlatformGetMilliseconds;
 	  game.Platform.CreateThread = PlatformCreateThread;
+    game.Seed = uint32(time(NULL));
 
     auto &Input = game.Input;
     if (SDL_NumJoysticks() > 0)
@@ -142,30 +145,54 @@ int main(int argc, char **argv)
     std::string TempPath;
     std::string LibFilename;
     std::string LibExtension;
-    if (argc > 1)
+
+    // usage: platform [library] [-record file | -replay file]
+    replay Replay;
+    for (int i = 1; i < argc; i++)
     {
-        LibPath = std::string(argv[1]);
+        if (strcmp(argv[i], "-record") == 0 && i+1 < argc)
+        {
+            if (!ReplayOpen(Replay, ReplayMode_Record, argv[++i], game.Seed))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "-replay") == 0 && i+1 < argc)
+        {
+            if (!ReplayOpen(Replay, ReplayMode_Play, argv[++i], 0))
+            {
+                exit(EXIT_FAILURE);
+            }
+            game.Seed = Replay.Header.Seed;
+        }
+        else if (i == 1)
+        {
+            LibPath = std::string(argv[1]);
+        }
     }
+    game.ComputeChecksum = (Replay.Mode != ReplayMode_None);
     SplitExtension(LibPath, LibFilename, LibExtension);
     TempPath = LibFilename + "Temp." + LibExtension;
     LoadGameLibrary(Lib, LibPath.c_str(), TempPath.c_str());
 
     Lib.GameInit(&game);
 
-    const float deltaTime = 0.016f;
-    const float deltaTimeMS = deltaTime * 1000.0f;
+    // the game is simulated in fixed ticks and rendered once per frame,
+    // if a frame takes too long the game slows down instead of running
+    // too many ticks to catch up
+    const int maxTicksPerFrame = 4;
     float reloadTimer = GameLibraryReloadTime;
-    float accul = deltaTime;
+    float accul = game.TickTime;
     uint32 previousTime = SDL_GetTicks();
     while (game.Running)
     {
+        const float deltaTime = game.TickTime;
         uint32 currentTime = SDL_GetTicks();
-        float elapsedMS = (currentTime - previousTime);
-        if (elapsedMS > deltaTimeMS*2)
+        float elapsed = (currentTime - previousTime) / 1000.0f;
+        if (elapsed > deltaTime*maxTicksPerFrame)
         {
-            elapsedMS = deltaTimeMS*2;
+            elapsed = deltaTime*maxTicksPerFrame;
         }
-        float elapsed = (elapsedMS / 1000.0f);
         accul += elapsed;
 
 #ifdef DRAFT_DEBUG
@@ -310,8 +337,16 @@ int main(int argc, char **argv)
         int i = 0;
         while (accul >= deltaTime)
         {
-            Lib.GameUpdate(&game, deltaTime);
-            if (i == 0)
+            float tickTime = deltaTime;
+            if (!ReplayBeginTick(Replay, Input, tickTime))
+            {
+                game.Running = false;
+                break;
+            }
+
+            Lib.GameUpdate(&game, tickTime);
+            ReplayEndTick(Replay, Input, tickTime, game.Checksum);
+            if (i == 0 || Replay.Mode == ReplayMode_Play)
             {
                 memcpy(&game.PrevInput, &game.Input, sizeof(game_input));
 				Input.MouseState.dX = 0;
@@ -321,13 +356,16 @@ int main(int argc, char **argv)
             i++;
         }
 
-		//Lib.GameUpdate(&game, elapsed);
+        game.RenderAlpha = accul / deltaTime;
         Lib.GameRender(&game, elapsed);
         SDL_GL_SwapWindow(Window);
         //SDL_Delay(10);
         previousTime = currentTime;
     }
 
+    ReplayPrintSummary(Replay);
+    ReplayClose(Replay);
+
     Lib.GameDestroy(&game);
 	Lib.GameUnload(&game);
 	UnloadGameLibrary(Lib);
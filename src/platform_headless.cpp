@@ -0,0 +1,219 @@
+// Copyright
+
+// Headless platform, runs the game simulation without a window, a GL
+// context or an audio device. The game is linked in statically together
+// with the null GL and AL backends, see the headless target in the Makefile.
+//
+// Usage: headless [-ticks N] [-realtime] [-seed N] [-record file | -replay file]
+//   -ticks N        stop after N ticks, 0 runs until the game stops
+//   -realtime       run the ticks at GAME_TICK_RATE instead of as fast as possible
+//   -seed N         seed the game with N instead of the current time
+//   -record file    record the input of the run
+//   -replay file    play a recorded run back and check it doesn't desync
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <ctime>
+#include <dlfcn.h>
+
+#define DRAFT_DEBUG
+#include "draft.h"
+
+#undef main
+
+#include "null_gl.cpp"
+#include "null_al.cpp"
+#include "replay.cpp"
+
+#define HEADLESS_WIDTH  GAME_BASE_WIDTH
+#define HEADLESS_HEIGHT GAME_BASE_HEIGHT
+
+extern "C"
+{
+    GAME_INIT(GameInit);
+    GAME_UNLOAD(GameUnload);
+    GAME_UPDATE(GameUpdate);
+    GAME_DESTROY(GameDestroy);
+}
+
+typedef std::chrono::steady_clock headless_clock;
+
+static headless_clock::time_point Global_HeadlessStartTime = headless_clock::now();
+static std::vector<platform_thread *> Global_HeadlessThreads;
+
+PLATFORM_GET_FILE_LAST_WRITE_TIME(PlatformGetFileLastWriteTime)
+{
+    return 0;
+}
+
+PLATFORM_COMPARE_FILE_TIME(PlatformCompareFileTime)
+{
+    return int32(t1 > t2) - int32(t1 < t2);
+}
+
+PLATFORM_GET_MILLISECONDS(PlatformGetMilliseconds)
+{
+    auto elapsed = headless_clock::now() - Global_HeadlessStartTime;
+    return uint64(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+// The thread functions are exported by the game, which lives in this
+// executable instead of a separate library
+PLATFORM_CREATE_THREAD(PlatformCreateThread)
+{
+    auto result = new platform_thread;
+    result->Name = name;
+    result->Arg = arg;
+    result->Func = (platform_thread::func *)dlsym(RTLD_DEFAULT, name);
+    if (!result->Func)
+    {
+        fprintf(stderr, "Missing thread function %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    result->Thread = std::thread(result->Func, arg);
+    Global_HeadlessThreads.push_back(result);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint64 maxTicks = 0;
+    bool realtime = false;
+    uint32 seed = uint32(time(NULL));
+    const char *recordPath = NULL;
+    const char *replayPath = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-ticks") == 0 && i+1 < argc)
+        {
+            maxTicks = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-realtime") == 0)
+        {
+            realtime = true;
+        }
+        else if (strcmp(argv[i], "-seed") == 0 && i+1 < argc)
+        {
+            seed = uint32(strtoul(argv[++i], NULL, 10));
+        }
+        else if (strcmp(argv[i], "-record") == 0 && i+1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-replay") == 0 && i+1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-ticks N] [-realtime] [-seed N] [-record file | -replay file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    replay replay;
+    if (replayPath)
+    {
+        if (!ReplayOpen(replay, ReplayMode_Play, replayPath, 0))
+        {
+            return EXIT_FAILURE;
+        }
+        seed = replay.Header.Seed;
+    }
+    else if (recordPath)
+    {
+        if (!ReplayOpen(replay, ReplayMode_Record, recordPath, seed))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // no input device, the keyboard is never pressed
+    static uint8 keys[SDL_NUM_SCANCODES] = {};
+
+    game_main game;
+    game.Window = NULL;
+    game.ViewportWidth = HEADLESS_WIDTH;
+    game.ViewportHeight = HEADLESS_HEIGHT;
+    game.Width = HEADLESS_WIDTH;
+    game.Height = HEADLESS_HEIGHT;
+    game.Input.Keys = keys;
+    game.Input.KeyCount = SDL_NUM_SCANCODES;
+    game.PrevInput = game.Input;
+    game.Platform.AudioDevice = NULL;
+    game.Platform.CompareFileTime = PlatformCompareFileTime;
+    game.Platform.GetFileLastWriteTime = PlatformGetFileLastWriteTime;
+    game.Platform.GetMilliseconds = PlatformGetMilliseconds;
+    game.Platform.CreateThread = PlatformCreateThread;
+    game.Seed = seed;
+    game.ComputeChecksum = (replay.Mode != ReplayMode_None);
+
+    GameInit(&game);
+
+    auto tickDuration = std::chrono::duration_cast<headless_clock::duration>(std::chrono::duration<float>(game.TickTime));
+    auto start = headless_clock::now();
+    auto nextTick = start;
+    double maxTickMS = 0;
+    while (game.Running && (maxTicks == 0 || game.TickCount < maxTicks))
+    {
+        if (realtime)
+        {
+            std::this_thread::sleep_until(nextTick);
+            nextTick += tickDuration;
+        }
+
+        float tickTime = game.TickTime;
+        if (!ReplayBeginTick(replay, game.Input, tickTime))
+        {
+            break;
+        }
+
+        auto tickStart = headless_clock::now();
+        GameUpdate(&game, tickTime);
+        ReplayEndTick(replay, game.Input, tickTime, game.Checksum);
+        game.PrevInput = game.Input;
+
+        double tickMS = std::chrono::duration<double, std::milli>(headless_clock::now() - tickStart).count();
+        maxTickMS = std::max(maxTickMS, tickMS);
+    }
+    double totalMS = std::chrono::duration<double, std::milli>(headless_clock::now() - start).count();
+
+    uint64 ticks = game.TickCount;
+    printf("Ticks: %llu in %.2fms (%.1f ticks/s)\n", (unsigned long long)ticks, totalMS, ticks*1000.0 / std::max(totalMS, 1.0));
+    printf("Tick time: %.3fms avg, %.3fms max\n", totalMS / std::max(ticks, uint64(1)), maxTickMS);
+
+    auto &gl = Global_NullGL.Stats;
+    printf("GL: %llu calls, %llu draws, %llu objects, %llu bytes uploaded\n",
+           (unsigned long long)gl.NumCalls, (unsigned long long)gl.NumDrawCalls,
+           (unsigned long long)gl.NumObjects, (unsigned long long)gl.BytesUploaded);
+    {
+        std::lock_guard<std::mutex> lock(Global_NullAL.Mutex);
+        auto &al = Global_NullAL.Stats;
+        printf("AL: %llu calls, %llu plays, %llu bytes buffered\n",
+               (unsigned long long)al.NumCalls, (unsigned long long)al.NumPlays,
+               (unsigned long long)al.BytesBuffered);
+    }
+    ReplayPrintSummary(replay);
+    ReplayClose(replay);
+
+    fflush(stdout);
+
+    // the pools can't be stopped with jobs in flight, loading may still
+    // be going on if only a few ticks were run
+    while (game.AssetLoader.Pool.NumJobs > 0 || game.World.UpdateThreadPool.NumJobs > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    GameDestroy(&game);
+    GameUnload(&game);
+    for (auto t : Global_HeadlessThreads)
+    {
+        t->Thread.join();
+        delete t;
+    }
+    return EXIT_SUCCESS;
+}
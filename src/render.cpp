@@ -1,6 +1,137 @@
 // Copyright
 
 #include "uber_shader.h"
+#include "particle_shader.h"
+
+// Returns true if the call has to be issued, false if the state is known
+// to be set to the value already
+inline static bool GLStateChanged(gl_state_call call, bool same)
+{
+    auto &gs = Global_GLState;
+    if ((gs.Known & (1 << call)) && same)
+    {
+        gs.Frame.Skipped[call]++;
+        return false;
+    }
+    gs.Known |= (1 << call);
+    gs.Frame.Issued[call]++;
+    return true;
+}
+
+// Forgets the state, for when something else may have changed it
+void InvalidateGLState()
+{
+    Global_GLState.Known = 0;
+    Global_GLState.KnownTextures = 0;
+    Global_GLState.ActiveTextureKnown = false;
+    Global_GLState.BlendFuncKnown = false;
+}
+
+// Called at the start of every frame, the counters are kept for the
+// debug UI
+void BeginGLStateFrame()
+{
+    Global_GLState.LastFrame = Global_GLState.Frame;
+    Global_GLState.Frame = gl_state_stats{};
+    InvalidateGLState();
+}
+
+void GLUseProgram(GLuint program)
+{
+    if (GLStateChanged(GLStateCall_Program, Global_GLState.Program == program))
+    {
+        glUseProgram(Global_GLState.Program = program);
+    }
+}
+
+void GLBindVertexArray(GLuint vao)
+{
+    if (GLStateChanged(GLStateCall_VAO, Global_GLState.VAO == vao))
+    {
+        glBindVertexArray(Global_GLState.VAO = vao);
+    }
+}
+
+// Only the 2D targets are cached, the others always go through
+void GLBindTexture(int unit, GLenum target, GLuint id)
+{
+    auto &gs = Global_GLState;
+    bool cached = (target == GL_TEXTURE_2D && unit < GL_STATE_TEXTURE_UNITS);
+    if (cached && (gs.KnownTextures & (1 << unit)) && gs.Textures[unit] == id)
+    {
+        gs.Frame.Skipped[GLStateCall_Texture]++;
+        return;
+    }
+
+    GLenum activeTexture = GL_TEXTURE0 + unit;
+    if (!gs.ActiveTextureKnown || gs.ActiveTexture != activeTexture)
+    {
+        glActiveTexture(gs.ActiveTexture = activeTexture);
+        gs.ActiveTextureKnown = true;
+    }
+    glBindTexture(target, id);
+    gs.Frame.Issued[GLStateCall_Texture]++;
+    if (cached)
+    {
+        gs.Textures[unit] = id;
+        gs.KnownTextures |= (1 << unit);
+    }
+    else if (unit < GL_STATE_TEXTURE_UNITS)
+    {
+        // another target on the unit, don't trust the 2D one anymore
+        gs.KnownTextures &= ~(1 << unit);
+    }
+}
+
+void GLPolygonMode(GLenum mode)
+{
+    if (GLStateChanged(GLStateCall_PolygonMode, Global_GLState.PolygonMode == mode))
+    {
+        glPolygonMode(GL_FRONT_AND_BACK, Global_GLState.PolygonMode = mode);
+    }
+}
+
+void GLSetCullFace(bool enable)
+{
+    if (GLStateChanged(GLStateCall_CullFace, Global_GLState.CullFace == enable))
+    {
+        Global_GLState.CullFace = enable;
+        if (enable) glEnable(GL_CULL_FACE);
+        else glDisable(GL_CULL_FACE);
+    }
+}
+
+void GLSetBlend(bool enable, GLenum src = GL_SRC_ALPHA, GLenum dst = GL_ONE_MINUS_SRC_ALPHA)
+{
+    auto &gs = Global_GLState;
+    if (GLStateChanged(GLStateCall_Blend, gs.Blend == enable))
+    {
+        gs.Blend = enable;
+        if (enable) glEnable(GL_BLEND);
+        else glDisable(GL_BLEND);
+    }
+    if (!enable)
+    {
+        return;
+    }
+
+    if (gs.BlendFuncKnown && gs.BlendSrc == src && gs.BlendDst == dst)
+    {
+        gs.Frame.Skipped[GLStateCall_Blend]++;
+        return;
+    }
+    glBlendFunc(gs.BlendSrc = src, gs.BlendDst = dst);
+    gs.BlendFuncKnown = true;
+    gs.Frame.Issued[GLStateCall_Blend]++;
+}
+
+void GLLineWidth(float width)
+{
+    if (GLStateChanged(GLStateCall_LineWidth, Global_GLState.LineWidth == width))
+    {
+        glLineWidth(Global_GLState.LineWidth = width);
+    }
+}
 
 static void EnableVertexAttribute(vertex_attribute Attr)
 {
@@ -15,36 +146,46 @@ void ResetBuffer(vertex_buffer &Buffer, size_t Index = 0)
 }
 
 // InitBuffer accepts a variadic number of vertex_attributes, it
-// initializes the buffer and enable the passed attributes
-void InitBuffer(vertex_buffer &buffer, size_t vertexSize, const std::vector<vertex_attribute> &attributes)
+// initializes the buffer and enable the passed attributes. A streamed
+// buffer has no VBO of its own, its attributes point at the stream buffer
+void InitBuffer(vertex_buffer &buffer, size_t vertexSize, const std::vector<vertex_attribute> &attributes, bool streamed = false)
 {
 	buffer.VertexSize = vertexSize;
 	ResetBuffer(buffer);
 
 	glGenVertexArrays(1, &buffer.VAO);
-	glGenBuffers(1, &buffer.VBO);
+	if (streamed)
+	{
+		assert(Global_StreamBuffer.VBO != 0);
+		buffer.VBO = Global_StreamBuffer.VBO;
+		buffer.StreamAttributes = attributes;
+	}
+	else
+	{
+		glGenBuffers(1, &buffer.VBO);
+	}
 
-	glBindVertexArray(buffer.VAO);
+	GLBindVertexArray(buffer.VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, buffer.VBO);
 	for (size_t i = 0; i < attributes.size(); i++)
 	{
 		EnableVertexAttribute(attributes[i]);
 	}
 
-	glBindVertexArray(0);
+	GLBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // InitMeshBuffer initializes a vertex_buffer with the common attributes
 // used by all meshes in the game
-void InitMeshBuffer(vertex_buffer &Buffer)
+void InitMeshBuffer(vertex_buffer &Buffer, bool streamed = false)
 {
     size_t Stride = sizeof(mesh_vertex);
 	InitBuffer(Buffer, 12, {
 			   vertex_attribute{0, 3, GL_FLOAT, Stride, 0}, // position
 			   vertex_attribute{1, 2, GL_FLOAT, Stride, 3 * sizeof(float)}, // uv
 			   vertex_attribute{2, 4, GL_FLOAT, Stride, 5 * sizeof(float)}, // color
-			   vertex_attribute{3, 3, GL_FLOAT, Stride, 9 * sizeof(float)} }); // normal
+			   vertex_attribute{3, 3, GL_FLOAT, Stride, 9 * sizeof(float)} }, streamed); // normal
 }
 
 #define InitialVertexBufferSize 16
@@ -139,6 +280,178 @@ void ReserveVertices(vertex_buffer &Buffer, size_t Size, GLenum Usage)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+static void CreateStreamStorage(stream_buffer &s, size_t frameSize)
+{
+    size_t size = frameSize*STREAM_BUFFER_FRAMES;
+    s.FrameSize = frameSize;
+    s.Persistent = (GLEW_ARB_buffer_storage != 0);
+    s.Mapped = NULL;
+    glGenBuffers(1, &s.VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s.VBO);
+    if (s.Persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        s.Mapped = (uint8 *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+
+        // the storage can still be mapped a range at a time
+        s.Persistent = (s.Mapped != NULL);
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InitStreamBuffer(stream_buffer &s, size_t frameSize)
+{
+    CreateStreamStorage(s, frameSize);
+}
+
+// Replaces the buffer with one whose regions fit minSize. The draws are
+// only issued at RenderEnd, so what was written this frame must stay
+// where it is: orphaning the storage would lose it. The old buffer is
+// kept until the next frame and the writers remember which one they used
+static void GrowStreamBuffer(stream_buffer &s, size_t minSize)
+{
+    size_t frameSize = s.FrameSize;
+    while (frameSize < minSize)
+    {
+        frameSize *= 2;
+    }
+    DebugLog("frame region of " << s.FrameSize << " bytes is full, growing to " << frameSize);
+
+    // the fences guard the regions of the old buffer
+    for (auto &fence : s.Fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+            fence = NULL;
+        }
+    }
+    s.Retired.push_back(s.VBO);
+    CreateStreamStorage(s, frameSize);
+    s.Offset = 0;
+    s.NumOverflows++;
+}
+
+// Moves to the next region, waiting for the GPU if it's still reading
+// the frame that used it
+void BeginStreamFrame(stream_buffer &s)
+{
+    s.BytesLastFrame = s.BytesThisFrame;
+    s.BytesThisFrame = 0;
+    s.Frame = (s.Frame + 1) % STREAM_BUFFER_FRAMES;
+    s.Offset = 0;
+
+    // deleting only drops the names, GL frees them once the GPU is done
+    if (!s.Retired.empty())
+    {
+        glDeleteBuffers(s.Retired.size(), s.Retired.data());
+        s.Retired.clear();
+    }
+
+    GLsync &fence = s.Fences[s.Frame];
+    if (fence)
+    {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            s.NumStalls++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+}
+
+void EndStreamFrame(stream_buffer &s)
+{
+    s.Fences[s.Frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Reserves size bytes in the region of the frame and returns where to
+// write them, offset is aligned to stride so the vertices can be drawn
+// from offset/stride. The write can grow the buffer, so the offset is
+// only valid in s.VBO as it is after the call
+uint8 *BeginStreamWrite(stream_buffer &s, size_t size, size_t stride, size_t &offset)
+{
+    size_t regionStart = s.Frame*s.FrameSize;
+    size_t start = regionStart + s.Offset;
+    start = ((start + stride - 1) / stride) * stride;
+    if (start + size > regionStart + s.FrameSize)
+    {
+        // aligning moves the start by less than a stride
+        GrowStreamBuffer(s, size + stride);
+        regionStart = s.Frame*s.FrameSize;
+        start = ((regionStart + stride - 1) / stride) * stride;
+    }
+    s.Offset = start + size - regionStart;
+    s.BytesThisFrame += size;
+    offset = start;
+    if (s.Persistent)
+    {
+        return s.Mapped + start;
+    }
+
+    // the fences already keep the GPU out of the range
+    glBindBuffer(GL_ARRAY_BUFFER, s.VBO);
+    auto result = (uint8 *)glMapBufferRange(GL_ARRAY_BUFFER, start, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return result;
+}
+
+void EndStreamWrite(stream_buffer &s)
+{
+    if (s.Persistent) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, s.VBO);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool StreamData(stream_buffer &s, const void *data, size_t size, size_t stride, size_t &offset)
+{
+    uint8 *dest = BeginStreamWrite(s, size, stride, offset);
+    if (!dest) return false;
+
+    memcpy(dest, data, size);
+    EndStreamWrite(s);
+    return true;
+}
+
+// Copies the vertices of a streamed buffer to the stream and sets where
+// they start, returns false if they couldn't be written
+bool StreamVertices(stream_buffer &s, vertex_buffer &buf)
+{
+    buf.StreamFirst = 0;
+    size_t stride = buf.VertexSize*sizeof(float);
+    if (buf.VertexCount == 0) return true;
+
+    size_t offset;
+    if (!StreamData(s, buf.Vertices.data(), buf.VertexCount*stride, stride, offset))
+    {
+        return false;
+    }
+    buf.StreamFirst = offset / stride;
+
+    if (buf.VBO != s.VBO)
+    {
+        buf.VBO = s.VBO;
+        GLBindVertexArray(buf.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buf.VBO);
+        for (auto &attr : buf.StreamAttributes)
+        {
+            EnableVertexAttribute(attr);
+        }
+        GLBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return true;
+}
+
 static void CompileShader(GLuint Shader, const char *Source)
 {
     glShaderSource(Shader, 1, &Source, NULL);
@@ -189,6 +502,22 @@ static void LinkShaderProgram(shader_program &Prog)
     glDeleteShader(Prog.FragmentShader);
 }
 
+// Points the program's uniform blocks to their binding points, the
+// programs without them are left alone
+static void BindUniformBlocks(shader_program &Prog)
+{
+    GLuint frameIndex = glGetUniformBlockIndex(Prog.ID, "FrameUniforms");
+    if (frameIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(Prog.ID, frameIndex, UNIFORM_BLOCK_FRAME);
+    }
+    GLuint materialIndex = glGetUniformBlockIndex(Prog.ID, "MaterialUniforms");
+    if (materialIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(Prog.ID, materialIndex, UNIFORM_BLOCK_MATERIAL);
+    }
+}
+
 inline void SetUniform(GLuint Location, int Value)
 {
     glUniform1i(Location, Value);
@@ -222,24 +551,22 @@ inline void SetUniform(GLuint Location, const mat4 &Value)
 
 inline void Bind(shader_program &Prog)
 {
-    glUseProgram(Prog.ID);
+    GLUseProgram(Prog.ID);
 }
 
 inline void UnbindShaderProgram()
 {
-    glUseProgram(0);
+    GLUseProgram(0);
 }
 
 void Bind(texture &Texture, int TextureUnit)
 {
-    glActiveTexture(GL_TEXTURE0 + TextureUnit);
-    glBindTexture(Texture.Target, Texture.ID);
+    GLBindTexture(TextureUnit, Texture.Target, Texture.ID);
 }
 
 void Unbind(texture &Texture, int TextureUnit)
 {
-    glActiveTexture(GL_TEXTURE0 + TextureUnit);
-    glBindTexture(Texture.Target, 0);
+    GLBindTexture(TextureUnit, Texture.Target, 0);
 }
 
 void ApplyTextureParameters(texture &Texture, int TextureUnit)
@@ -401,7 +728,7 @@ static GLenum FramebufferColorAttachments[] = {
     GL_COLOR_ATTACHMENT15,
 };
 
-static void CreateFramebufferTexture(render_state &RenderState, texture &Texture, GLuint Target, uint32 Width, uint32 Height, GLint Filter, GLuint Format)
+static void CreateFramebufferTexture(texture &Texture, GLuint Target, uint32 Width, uint32 Height, GLint Filter, GLuint Format, int SampleCount)
 {
     Texture.Target = Target;
     Texture.Width = Width;
@@ -409,21 +736,26 @@ static void CreateFramebufferTexture(render_state &RenderState, texture &Texture
     Texture.Filters = {Filter, Filter};
     Texture.Wrap = {GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE};
     glGenTextures(1, &Texture.ID);
-    ApplyTextureParameters(Texture, 0);
+    // multisample textures can't be filtered or wrapped
+    if (Target != GL_TEXTURE_2D_MULTISAMPLE)
+    {
+        ApplyTextureParameters(Texture, 0);
+    }
     Bind(Texture, 0);
     UploadTexture(Texture, Format,
                   (Format == OPENGL_DEPTH_COMPONENT_TYPE) ? GL_DEPTH_COMPONENT : GL_BGRA_EXT,
                   GL_UNSIGNED_BYTE, NULL,
-                  RenderState.MaxMultiSampleCount);
+                  SampleCount);
     Unbind(Texture, 0);
 }
 
-static void InitFramebuffer(render_state &RenderState, framebuffer &Framebuffer, uint32 Width, uint32 Height, uint32 Flags, size_t ColorTextureCount)
+static void InitFramebuffer(framebuffer &Framebuffer, uint32 Width, uint32 Height, uint32 Flags, size_t ColorTextureCount, int SampleCount = 0)
 {
     Framebuffer.Width = Width;
     Framebuffer.Height = Height;
     Framebuffer.Flags = Flags;
     Framebuffer.ColorTextureCount = ColorTextureCount;
+    Framebuffer.SampleCount = SampleCount;
 
     glGenFramebuffers(1, &Framebuffer.ID);
     glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer.ID);
@@ -432,23 +764,27 @@ static void InitFramebuffer(render_state &RenderState, framebuffer &Framebuffer,
     GLuint Target = Multisampled ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
     GLint Filter = (Flags & FramebufferFlag_Filtered) ? GL_LINEAR : GL_NEAREST;
     GLuint Format = (Flags & FramebufferFlag_IsFloat) ? GL_RGBA16F : GL_RGBA8;
+    if (Flags & FramebufferFlag_PackedFloat)
+    {
+        Format = GL_R11F_G11F_B10F;
+    }
     for (size_t i = 0; i < ColorTextureCount; i++)
     {
-        CreateFramebufferTexture(RenderState, Framebuffer.ColorTextures[i], Target, Width, Height, Filter, Format);
+        CreateFramebufferTexture(Framebuffer.ColorTextures[i], Target, Width, Height, Filter, Format, SampleCount);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, Target, Framebuffer.ColorTextures[i].ID, 0);
     }
     glDrawBuffers(ColorTextureCount, FramebufferColorAttachments);
 
     if (Flags & FramebufferFlag_HasDepth)
     {
-        CreateFramebufferTexture(RenderState, Framebuffer.DepthTexture, Target, Width, Height, Filter, OPENGL_DEPTH_COMPONENT_TYPE);
+        CreateFramebufferTexture(Framebuffer.DepthTexture, Target, Width, Height, Filter, OPENGL_DEPTH_COMPONENT_TYPE, SampleCount);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, Target, Framebuffer.DepthTexture.ID, 0);
     }
 
     GLenum Status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    printf("%x\n", Status);
 	if (Status != GL_FRAMEBUFFER_COMPLETE)
 	{
+        DebugLog("framebuffer " << Width << "x" << Height << " incomplete, status 0x" << std::hex << Status << std::dec);
 		assert(!(Status == GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT));
 		assert(Status == GL_FRAMEBUFFER_COMPLETE);
 	}
@@ -458,12 +794,16 @@ static void InitFramebuffer(render_state &RenderState, framebuffer &Framebuffer,
 
 static void DestroyFramebuffer(framebuffer &Framebuffer)
 {
-    //DestroyTexture(Framebuffer.DepthTexture);
+    if (Framebuffer.Flags & FramebufferFlag_HasDepth)
+    {
+        glDeleteTextures(1, &Framebuffer.DepthTexture.ID);
+    }
     for (size_t i = 0; i < Framebuffer.ColorTextureCount; i++)
     {
-        //DestroyTexture(Framebuffer.ColorTextures[i]);
+        glDeleteTextures(1, &Framebuffer.ColorTextures[i].ID);
     }
     glDeleteFramebuffers(1, &Framebuffer.ID);
+    Framebuffer.ID = 0;
 }
 
 static void BindFramebuffer(framebuffer &Framebuffer)
@@ -479,6 +819,105 @@ static void UnbindFramebuffer(render_state &rs)
     glViewport(0, 0, rs.ViewportWidth, rs.ViewportHeight);
 }
 
+// Returns a free target of the given size, flags and sample count,
+// making a new one if every match is in use
+static framebuffer *AcquireRenderTarget(render_state &r, uint32 width, uint32 height, uint32 flags, size_t colorTextureCount, int sampleCount = 0)
+{
+    auto &pool = r.TargetPool;
+    for (auto target : pool.Targets)
+    {
+        auto &fb = target->Framebuffer;
+        if (!target->InUse && fb.Width == width && fb.Height == height && fb.Flags == flags &&
+            fb.ColorTextureCount == colorTextureCount && fb.SampleCount == sampleCount)
+        {
+            target->InUse = true;
+            target->LastUsedFrame = pool.Frame;
+            return &fb;
+        }
+    }
+
+    auto target = new render_target;
+    InitFramebuffer(target->Framebuffer, width, height, flags, colorTextureCount, sampleCount);
+    target->InUse = true;
+    target->LastUsedFrame = pool.Frame;
+    pool.Targets.push_back(target);
+    pool.NumCreated++;
+    return &target->Framebuffer;
+}
+
+static void ReleaseRenderTarget(render_state &r, framebuffer *fb)
+{
+    for (auto target : r.TargetPool.Targets)
+    {
+        if (&target->Framebuffer == fb)
+        {
+            assert(target->InUse);
+            target->InUse = false;
+            return;
+        }
+    }
+    assert(!"Framebuffer not in the render target pool");
+}
+
+// Destroys the targets that weren't acquired for a while, or all of
+// the free ones if force is set
+static void TrimRenderTargets(render_state &r, bool force = false)
+{
+    auto &pool = r.TargetPool;
+    for (size_t i = 0; i < pool.Targets.size();)
+    {
+        auto target = pool.Targets[i];
+        if (!target->InUse && (force || pool.Frame - target->LastUsedFrame > RENDER_TARGET_MAX_IDLE_FRAMES))
+        {
+            DestroyFramebuffer(target->Framebuffer);
+            delete target;
+            pool.Targets[i] = pool.Targets.back();
+            pool.Targets.pop_back();
+            pool.NumDestroyed++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void EndRenderTargetFrame(render_state &r)
+{
+    TrimRenderTargets(r);
+    r.TargetPool.Frame++;
+}
+
+void DestroyRenderTargets(render_state &r)
+{
+    if (r.SceneFramebuffer)
+    {
+        ReleaseRenderTarget(r, r.SceneFramebuffer);
+        r.SceneFramebuffer = NULL;
+    }
+    TrimRenderTargets(r, true);
+}
+
+static void BeginGPUTimer(gpu_timer &t)
+{
+    // the query of this slot was issued GPU_TIMER_FRAMES ago
+    int slot = t.Frame % GPU_TIMER_FRAMES;
+    if (t.Pending[slot])
+    {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(t.Queries[slot], GL_QUERY_RESULT, &elapsed);
+        t.Milliseconds = float(elapsed / 1e6);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, t.Queries[slot]);
+    t.Pending[slot] = true;
+}
+
+static void EndGPUTimer(gpu_timer &t)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    t.Frame++;
+}
+
 void EndMesh(mesh *Mesh, GLenum Usage, bool ComputeBounds = true)
 {
     auto &b = Mesh->Buffer;
@@ -531,30 +970,65 @@ static void ModelProgramCallback(shader_asset_param *p)
     if (IsLinkable(program))
     {
         LinkShaderProgram(*program);
-        program->MaterialFlags = glGetUniformLocation(program->ID, "u_MaterialFlags");
-        program->ProjectionView = glGetUniformLocation(program->ID, "u_ProjectionView");
+        BindUniformBlocks(*program);
         program->Transform = glGetUniformLocation(program->ID, "u_Transform");
         program->NormalTransform = glGetUniformLocation(program->ID, "u_NormalTransform");
-        program->DiffuseColor = glGetUniformLocation(program->ID, "u_DiffuseColor");
-        program->TexWeight = glGetUniformLocation(program->ID, "u_TexWeight");
-        program->FogWeight = glGetUniformLocation(program->ID, "u_FogWeight");
-        program->Emission = glGetUniformLocation(program->ID, "u_Emission");
-        program->UvScale = glGetUniformLocation(program->ID, "u_UvScale");
         program->Sampler = glGetUniformLocation(program->ID, "u_Sampler");
-        program->ExplosionLightColor = glGetUniformLocation(program->ID, "u_ExplosionLightColor");
-        program->ExplosionLightTimer = glGetUniformLocation(program->ID, "u_ExplosionLightTimer");
-        program->CamPos = glGetUniformLocation(program->ID, "u_CamPos");
-        program->FogColor = glGetUniformLocation(program->ID, "u_FogColor");
-        program->FogStart = glGetUniformLocation(program->ID, "u_FogStart");
-        program->FogEnd = glGetUniformLocation(program->ID, "u_FogEnd");
-		program->BendRadius = glGetUniformLocation(program->ID, "u_BendRadius");
-        program->RoadTangentPoint = glGetUniformLocation(program->ID, "u_RoadTangentPoint");
-		program->SpecularColor = glGetUniformLocation(program->ID, "u_SpecularColor");
-		program->EmissiveColor = glGetUniformLocation(program->ID, "u_EmissiveColor");
-		program->Shininess = glGetUniformLocation(program->ID, "u_Shininess");
 
         Bind(*program);
         SetUniform(program->Sampler, 0);
+
+        // @TODO: check why this breaks the floor model
+        SetUniform(program->NormalTransform, mat4(1.0f));
+        UnbindShaderProgram();
+    }
+}
+
+static void BloomPrefilterProgramCallback(shader_asset_param *Param)
+{
+    auto *Program = (bloom_prefilter_program *)Param->ShaderProgram;
+    if (IsLinkable(Program))
+    {
+        LinkShaderProgram(*Program);
+        Program->SampleCount = glGetUniformLocation(Program->ID, "u_SampleCount");
+        Program->Downscale = glGetUniformLocation(Program->ID, "u_Downscale");
+        Program->Threshold = glGetUniformLocation(Program->ID, "u_Threshold");
+
+        Bind(*Program);
+        SetUniform(glGetUniformLocation(Program->ID, "u_EmitSampler"), 0);
+        UnbindShaderProgram();
+    }
+}
+
+static void BloomFilterProgramCallback(shader_asset_param *Param)
+{
+    auto *Program = (bloom_filter_program *)Param->ShaderProgram;
+    if (IsLinkable(Program))
+    {
+        LinkShaderProgram(*Program);
+        Program->TexelSize = glGetUniformLocation(Program->ID, "u_TexelSize");
+        Program->Radius = glGetUniformLocation(Program->ID, "u_Radius");
+
+        Bind(*Program);
+        SetUniform(glGetUniformLocation(Program->ID, "u_Sampler"), 0);
+        UnbindShaderProgram();
+    }
+}
+
+static void BloomCompositeProgramCallback(shader_asset_param *Param)
+{
+    auto *Program = (bloom_composite_program *)Param->ShaderProgram;
+    if (IsLinkable(Program))
+    {
+        LinkShaderProgram(*Program);
+        Program->SampleCount = glGetUniformLocation(Program->ID, "u_SampleCount");
+        Program->BloomTexelSize = glGetUniformLocation(Program->ID, "u_BloomTexelSize");
+        Program->Radius = glGetUniformLocation(Program->ID, "u_Radius");
+        Program->Intensity = glGetUniformLocation(Program->ID, "u_Intensity");
+
+        Bind(*Program);
+        SetUniform(glGetUniformLocation(Program->ID, "u_SceneSampler"), 0);
+        SetUniform(glGetUniformLocation(Program->ID, "u_BloomSampler"), 1);
         UnbindShaderProgram();
     }
 }
@@ -580,13 +1054,13 @@ static void BlendProgramCallback(shader_asset_param *Param)
     {
         LinkShaderProgram(*Program);
         Bind(*Program);
-        for (int i = 0; i < BloomBlurPassCount; i++)
+        for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
         {
             char Name[] = "u_Pass#";
             Name[6] = (char)('0' + i);
-            SetUniform(glGetUniformLocation(Program->ID, Name), 0);
+            SetUniform(glGetUniformLocation(Program->ID, Name), i);
         }
-        SetUniform(glGetUniformLocation(Program->ID, "u_Scene"), BloomBlurPassCount);
+        SetUniform(glGetUniformLocation(Program->ID, "u_Scene"), BLOOM_BLUR_PASSES);
         UnbindShaderProgram();
     }
 }
@@ -636,22 +1110,44 @@ static void PerlinNoiseProgramCallback(shader_asset_param *param)
 }
 
 static void InitShaderProgram(shader_program &Program, const string &vsPath, const string &fsPath,
-                              shader_asset_callback_func *Callback)
+                              shader_asset_callback_func *Callback, const string &defines = "")
 {
     Program.VertexShaderParam = {
         GL_VERTEX_SHADER,
         vsPath,
         &Program,
         Callback,
+        defines,
     };
     Program.FragmentShaderParam = {
         GL_FRAGMENT_SHADER,
         fsPath,
         &Program,
         Callback,
+        defines,
     };
 }
 
+static std::string GetDefinesSource(std::unordered_map<std::string, std::string> &defines)
+{
+    std::string result;
+    for (auto it : defines)
+    {
+        result.append("#define " + it.first + " " + it.second + "\n");
+    }
+    return result;
+}
+
+static void AddInstancedDefines(std::unordered_map<std::string, std::string> &defines)
+{
+    defines["INSTANCED"] = "1";
+    defines["A_INSTANCE_TRANSFORM"] = std::to_string(INSTANCE_ATTRIB_TRANSFORM);
+    defines["A_INSTANCE_COLOR"] = std::to_string(INSTANCE_ATTRIB_COLOR);
+    defines["A_INSTANCE_EMISSION"] = std::to_string(INSTANCE_ATTRIB_EMISSION);
+}
+
+// Compiles the uber shader with the defines, and its instanced variant
+// unless it's the one being compiled
 model_program *CompileUberModelProgram(allocator *alloc, std::unordered_map<std::string, std::string> &defines)
 {
     static std::unordered_map<std::string, model_program *> shaderCache;
@@ -671,15 +1167,15 @@ model_program *CompileUberModelProgram(allocator *alloc, std::unordered_map<std:
 	result->VertexShader = vertexShader;
 	result->FragmentShader = fragmentShader;
 
-    std::string vertexSource = "#version 330\n";
-    std::string fragmentSource = "#version 330\n";
-    for (auto it : defines)
-    {
-        std::string str = "#define " + it.first + " " + it.second + "\n";
-        vertexSource.append(str);
-        fragmentSource.append(str);
-    }
+    std::string definesSource = GetDefinesSource(defines);
+    std::string vertexSource = "#version 330\n" + definesSource;
+    std::string fragmentSource = "#version 330\n" + definesSource;
 
+    vertexSource.append(FrameUniformsSource);
+    vertexSource.append(MaterialUniformsSource);
+    fragmentSource.append(FrameUniformsSource);
+    fragmentSource.append(MaterialUniformsSource);
+    vertexSource.append(BendShaderSource);
     vertexSource.append(UberVertexShaderSource);
     fragmentSource.append(UberFragmentShaderSource);
 
@@ -691,11 +1187,41 @@ model_program *CompileUberModelProgram(allocator *alloc, std::unordered_map<std:
     ModelProgramCallback(&param);
 
     shaderCache[key] = result;
+    if (defines.find("INSTANCED") == defines.end())
+    {
+        auto instancedDefines = defines;
+        AddInstancedDefines(instancedDefines);
+        result->Instanced = CompileUberModelProgram(alloc, instancedDefines);
+    }
     return result;
 }
 
+static void CompileParticleProgram(particle_program &program)
+{
+    program.VertexShader = glCreateShader(GL_VERTEX_SHADER);
+    program.FragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+
+    std::string vertexSource = "#version 330\n";
+    vertexSource.append(FrameUniformsSource);
+    vertexSource.append(BendShaderSource);
+    vertexSource.append(ParticleVertexShaderSource);
+    std::string fragmentSource = "#version 330\n";
+    fragmentSource.append(FrameUniformsSource);
+    fragmentSource.append(ParticleFragmentShaderSource);
+
+    CompileShader(program.VertexShader, vertexSource.c_str());
+    CompileShader(program.FragmentShader, fragmentSource.c_str());
+    LinkShaderProgram(program);
+    BindUniformBlocks(program);
+
+    program.Emission = glGetUniformLocation(program.ID, "u_Emission");
+    program.LinePass = glGetUniformLocation(program.ID, "u_LinePass");
+}
+
 static void InitRenderState(render_state &r, uint32 width, uint32 height, uint32 viewportWidth, uint32 viewportHeight)
 {
+    InitStreamBuffer(Global_StreamBuffer, STREAM_BUFFER_FRAME_SIZE);
+
     glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &r.MaxMultiSampleCount);
     if (r.MaxMultiSampleCount > 8)
     {
@@ -713,23 +1239,52 @@ static void InitRenderState(render_state &r, uint32 width, uint32 height, uint32
         "data/shaders/model.frag.glsl",
         ModelProgramCallback
     );
+
+    std::unordered_map<std::string, std::string> instancedDefines;
+    AddInstancedDefines(instancedDefines);
     InitShaderProgram(
-        r.BlurHorizontalProgram,
+        r.InstancedModelProgram,
+        "data/shaders/model.vert.glsl",
+        "data/shaders/model.frag.glsl",
+        ModelProgramCallback,
+        GetDefinesSource(instancedDefines)
+    );
+    r.ModelProgram.Instanced = &r.InstancedModelProgram;
+    InitShaderProgram(
+        r.BloomPrefilterProgram,
         "data/shaders/blit.vert.glsl",
-        "data/shaders/blurh.frag.glsl",
-        BlurProgramCallback
+        "data/shaders/bloom_prefilter.frag.glsl",
+        BloomPrefilterProgramCallback
     );
     InitShaderProgram(
-        r.BlurVerticalProgram,
+        r.BloomDownProgram,
         "data/shaders/blit.vert.glsl",
-        "data/shaders/blurv.frag.glsl",
-        BlurProgramCallback
+        "data/shaders/bloom_down.frag.glsl",
+        BloomFilterProgramCallback
     );
     InitShaderProgram(
-        r.BlendProgram,
+        r.BloomUpProgram,
         "data/shaders/blit.vert.glsl",
-        "data/shaders/blend.frag.glsl",
-        BlendProgramCallback
+        "data/shaders/bloom_up.frag.glsl",
+        BloomFilterProgramCallback
+    );
+    InitShaderProgram(
+        r.BloomCompositeProgram,
+        "data/shaders/blit.vert.glsl",
+        "data/shaders/bloom_composite.frag.glsl",
+        BloomCompositeProgramCallback
+    );
+    InitShaderProgram(
+        r.BlurHorizontalProgram,
+        "data/shaders/blit.vert.glsl",
+        "data/shaders/blurh.frag.glsl",
+        BlurProgramCallback
+    );
+    InitShaderProgram(
+        r.BlurVerticalProgram,
+        "data/shaders/blit.vert.glsl",
+        "data/shaders/blurv.frag.glsl",
+        BlurProgramCallback
     );
     InitShaderProgram(
         r.BlitProgram,
@@ -737,6 +1292,12 @@ static void InitRenderState(render_state &r, uint32 width, uint32 height, uint32
         "data/shaders/blit.frag.glsl",
         BlitProgramCallback
     );
+    InitShaderProgram(
+        r.BlendProgram,
+        "data/shaders/blit.vert.glsl",
+        "data/shaders/blend.frag.glsl",
+        BlendProgramCallback
+    );
     InitShaderProgram(
         r.ResolveMultisampleProgram,
         "data/shaders/blit.vert.glsl",
@@ -750,6 +1311,17 @@ static void InitRenderState(render_state &r, uint32 width, uint32 height, uint32
 		PerlinNoiseProgramCallback
 	);
 
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &r.UniformBufferAlignment);
+    if (r.UniformBufferAlignment <= 0)
+    {
+        r.UniformBufferAlignment = 256;
+    }
+    glGenBuffers(1, &r.FrameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, r.FrameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(frame_uniforms), NULL, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &r.MaterialUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
     InitMeshBuffer(r.SpriteBuffer);
 	InitBuffer(r.ScreenBuffer, 4, {
 		vertex_attribute{0, 2, GL_FLOAT, 4 * sizeof(float), 0},
@@ -772,20 +1344,25 @@ static void InitRenderState(render_state &r, uint32 width, uint32 height, uint32
     PushVertex(r.ScreenBuffer, data + 20);
     UploadVertices(r.ScreenBuffer, GL_STATIC_DRAW);
 
-    InitFramebuffer(r, r.MultisampledSceneFramebuffer, width, height, FramebufferFlag_HasDepth | FramebufferFlag_Multisampled, ColorTextureFlag_Count);
-    InitFramebuffer(r, r.SceneFramebuffer, width, height, FramebufferFlag_HasDepth, ColorTextureFlag_Count);
-    for (int i = 0; i < BloomBlurPassCount; i++)
+    CompileParticleProgram(r.ParticleProgram);
+    size_t particleStride = PARTICLE_INSTANCE_SIZE * sizeof(float);
+    InitBuffer(r.ParticleBuffer, PARTICLE_INSTANCE_SIZE, {
+        vertex_attribute{0, 4, GL_FLOAT, particleStride, 0}, // start
+        vertex_attribute{1, 4, GL_FLOAT, particleStride, 4 * sizeof(float)}, // end
+        vertex_attribute{2, 4, GL_FLOAT, particleStride, 8 * sizeof(float)}, // color
+        vertex_attribute{3, 2, GL_FLOAT, particleStride, 12 * sizeof(float)} }, true); // alpha
+    GLBindVertexArray(r.ParticleBuffer.VAO);
+    for (GLuint i = 0; i < 4; i++)
     {
-        // @TODO: maybe it is not necessary to scale down
-        size_t BlurWidth = width >> i;
-        size_t BlurHeight = height >> i;
-
-        InitFramebuffer(r, r.BlurHorizontalFramebuffers[i], BlurWidth, BlurHeight, FramebufferFlag_Filtered, 1);
-        InitFramebuffer(r, r.BlurVerticalFramebuffers[i], BlurWidth, BlurHeight, FramebufferFlag_Filtered, 1);
+        glVertexAttribDivisor(i, 1);
     }
+    GLBindVertexArray(0);
+
+    r.SampleCount = r.MaxMultiSampleCount;
+    glGenQueries(GPU_TIMER_FRAMES, r.PostProcessTimer.Queries);
 
 #ifdef DRAFT_DEBUG
-    InitMeshBuffer(r.DebugBuffer);
+    InitMeshBuffer(r.DebugBuffer, true);
 #endif
 }
 
@@ -796,118 +1373,287 @@ inline void RenderClear(render_state &rs)
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+// The render targets follow the new size from the next frame on, the
+// ones of the old size are trimmed once they're idle
+void ResizeRenderState(render_state &r, uint32 width, uint32 height, uint32 viewportWidth, uint32 viewportHeight)
+{
+    r.Width = width;
+    r.Height = height;
+    r.ViewportWidth = viewportWidth;
+    r.ViewportHeight = viewportHeight;
+}
+
 void PostProcessBegin(render_state &rs)
 {
     if (Global_Renderer_DoPostFX)
     {
-        BindFramebuffer(rs.MultisampledSceneFramebuffer);
+        if (!rs.SceneFramebuffer)
+        {
+            rs.SceneFramebuffer = AcquireRenderTarget(rs, rs.Width, rs.Height, FramebufferFlag_HasDepth | FramebufferFlag_Multisampled,
+                                                      ColorTextureFlag_Count, std::max(rs.SampleCount, 1));
+        }
+        BindFramebuffer(*rs.SceneFramebuffer);
     }
     RenderClear(rs);
 }
 
-enum blur_orientation
-{
-    Blur_Horizontal,
-    Blur_Vertical,
-};
-static framebuffer *RenderBlur(render_state &RenderState, blur_program *Program)
+// Draws the scene with the bloom added to output, or to the screen
+static void RenderBloom(render_state &r, framebuffer *output = NULL)
 {
-    Bind(*Program);
-    framebuffer *Sources = RenderState.BlurHorizontalFramebuffers;
-    framebuffer *Dests = RenderState.BlurVerticalFramebuffers;
-    if (Program == &RenderState.BlurVerticalProgram)
+    auto &scene = *r.SceneFramebuffer;
+    int passCount = glm::clamp(Global_Renderer_BloomPassCount, 1, BLOOM_MAX_PASSES);
+    int downscale = std::max(Global_Renderer_BloomDownscale, 1);
+    uint32 width = std::max(r.Width / downscale, 1u);
+    uint32 height = std::max(r.Height / downscale, 1u);
+
+    // each level half the size of the previous one. The emissive values
+    // add up over the levels, so they're packed floats instead of bytes
+    // that would clip
+    framebuffer *levels[BLOOM_MAX_PASSES];
+    for (int i = 0; i < passCount; i++)
     {
-        auto Tmp = Sources;
-        Sources = Dests;
-        Dests = Tmp;
+        levels[i] = AcquireRenderTarget(r, std::max(width >> i, 1u), std::max(height >> i, 1u),
+                                        FramebufferFlag_Filtered | FramebufferFlag_PackedFloat, 1);
     }
-    for (int i = 0; i < BloomBlurPassCount; i++)
+
+    // resolve, threshold and first downsample in one go
+    auto &prefilter = r.BloomPrefilterProgram;
+    Bind(prefilter);
+    SetUniform(prefilter.SampleCount, scene.SampleCount);
+    SetUniform(prefilter.Downscale, downscale);
+    SetUniform(prefilter.Threshold, Global_Renderer_BloomThreshold);
+    Bind(scene.ColorTextures[ColorTextureFlag_Emit], 0);
+    BindFramebuffer(*levels[0]);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    auto &down = r.BloomDownProgram;
+    Bind(down);
+    for (int i = 1; i < passCount; i++)
     {
-        if (Program == &RenderState.BlurVerticalProgram)
-        {
-            SetUniform(Program->PixelSize, Global_Renderer_BloomBlurOffset / float(Sources[i].Height));
-        }
-        else
-        {
-            SetUniform(Program->PixelSize, Global_Renderer_BloomBlurOffset / float(Sources[i].Width));
-        }
+        auto &source = *levels[i - 1];
+        SetUniform(down.TexelSize, vec2{1.0f / source.Width, 1.0f / source.Height});
+        Bind(source.ColorTextures[0], 0);
+        BindFramebuffer(*levels[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    // every level ends up with the sum of itself and the ones below
+    auto &up = r.BloomUpProgram;
+    Bind(up);
+    SetUniform(up.Radius, Global_Renderer_BloomRadius);
+    GLSetBlend(true, GL_ONE, GL_ONE);
+    for (int i = passCount - 1; i > 0; i--)
+    {
+        auto &source = *levels[i];
+        SetUniform(up.TexelSize, vec2{1.0f / source.Width, 1.0f / source.Height});
+        Bind(source.ColorTextures[0], 0);
+        BindFramebuffer(*levels[i - 1]);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        ReleaseRenderTarget(r, levels[i]);
+    }
+    GLSetBlend(false);
+    if (output)
+    {
+        BindFramebuffer(*output);
+    }
+    else
+    {
+        UnbindFramebuffer(r);
+    }
+
+    // the intensity is split between the levels so the brightness
+    // doesn't change with the pass count
+    auto &composite = r.BloomCompositeProgram;
+    Bind(composite);
+    SetUniform(composite.SampleCount, scene.SampleCount);
+    SetUniform(composite.BloomTexelSize, vec2{1.0f / levels[0]->Width, 1.0f / levels[0]->Height});
+    SetUniform(composite.Radius, Global_Renderer_BloomRadius);
+    SetUniform(composite.Intensity, Global_Renderer_BloomIntensity / passCount);
+    Bind(scene.ColorTextures[ColorTextureFlag_SurfaceReflect], 0);
+    Bind(levels[0]->ColorTextures[0], 1);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    UnbindShaderProgram();
+    ReleaseRenderTarget(r, levels[0]);
+}
+
+#define BLOOM_BLUR_OFFSET 1.8f
 
-        BindFramebuffer(Dests[i]);
+// The bloom before the mip chain: resolves the whole scene, blurs the
+// emit horizontally and vertically at three sizes and adds them up
+static void RenderBlurBloom(render_state &r, framebuffer *output)
+{
+    auto &scene = *r.SceneFramebuffer;
+    auto resolved = AcquireRenderTarget(r, r.Width, r.Height, 0, ColorTextureFlag_Count);
+    Bind(r.ResolveMultisampleProgram);
+    SetUniform(r.ResolveMultisampleProgram.SampleCount, scene.SampleCount);
+    for (size_t i = 0; i < ColorTextureFlag_Count; i++)
+    {
+        Bind(scene.ColorTextures[i], i);
+    }
+    BindFramebuffer(*resolved);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    framebuffer *horizontal[BLOOM_BLUR_PASSES];
+    framebuffer *vertical[BLOOM_BLUR_PASSES];
+    Bind(r.BlitProgram);
+    Bind(resolved->ColorTextures[ColorTextureFlag_Emit], 0);
+    for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
+    {
+        uint32 width = std::max(r.Width >> i, 1u);
+        uint32 height = std::max(r.Height >> i, 1u);
+        horizontal[i] = AcquireRenderTarget(r, width, height, FramebufferFlag_Filtered, 1);
+        vertical[i] = AcquireRenderTarget(r, width, height, FramebufferFlag_Filtered, 1);
+        BindFramebuffer(*horizontal[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
 
+    Bind(r.BlurHorizontalProgram);
+    for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
+    {
+        SetUniform(r.BlurHorizontalProgram.PixelSize, BLOOM_BLUR_OFFSET / float(horizontal[i]->Width));
+        Bind(horizontal[i]->ColorTextures[0], 0);
+        BindFramebuffer(*vertical[i]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+    Bind(r.BlurVerticalProgram);
+    for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
+    {
+        SetUniform(r.BlurVerticalProgram.PixelSize, BLOOM_BLUR_OFFSET / float(vertical[i]->Height));
+        Bind(vertical[i]->ColorTextures[0], 0);
+        BindFramebuffer(*horizontal[i]);
         glClear(GL_COLOR_BUFFER_BIT);
-        Bind(Sources[i].ColorTextures[0], 0);
         glDrawArrays(GL_TRIANGLES, 0, 6);
-        Unbind(Sources[i].ColorTextures[0], 0);
+    }
 
-        UnbindFramebuffer(RenderState);
+    Bind(r.BlendProgram);
+    for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
+    {
+        Bind(horizontal[i]->ColorTextures[0], i);
     }
+    Bind(resolved->ColorTextures[ColorTextureFlag_SurfaceReflect], BLOOM_BLUR_PASSES);
+    BindFramebuffer(*output);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
     UnbindShaderProgram();
-    return Dests;
+
+    for (int i = 0; i < BLOOM_BLUR_PASSES; i++)
+    {
+        ReleaseRenderTarget(r, horizontal[i]);
+        ReleaseRenderTarget(r, vertical[i]);
+    }
+    ReleaseRenderTarget(r, resolved);
 }
 
-void PostProcessEnd(render_state &r)
+static float TimeBloom(bloom_benchmark &bench, render_state &r, framebuffer *output, bool chain)
 {
-    if (Global_Renderer_DoPostFX)
+    glBeginQuery(GL_TIME_ELAPSED, bench.Query);
+    if (chain)
     {
-        UnbindFramebuffer(r);
-        glBindVertexArray(r.ScreenBuffer.VAO);
+        RenderBloom(r, output);
+    }
+    else
+    {
+        RenderBlurBloom(r, output);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
 
-        // resolve multisample
-        if (Global_Renderer_BloomEnabled)
-        {
-            BindFramebuffer(r.SceneFramebuffer);
-        }
+    // waiting is fine, it's a benchmark
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(bench.Query, GL_QUERY_RESULT, &elapsed);
+    return float(elapsed / 1e6);
+}
 
-        Bind(r.ResolveMultisampleProgram);
-        SetUniform(r.ResolveMultisampleProgram.SampleCount, r.MaxMultiSampleCount);
-        for (size_t i = 0; i < ColorTextureFlag_Count; i++)
+// Draws the scene of the frame through both blooms numRuns times each
+// and compares the last images
+void BenchmarkBloom(render_state &r, bloom_benchmark &bench, int numRuns)
+{
+    if (!bench.Query)
+    {
+        glGenQueries(1, &bench.Query);
+    }
+    framebuffer *blurOutput = AcquireRenderTarget(r, r.Width, r.Height, 0, 1);
+    framebuffer *chainOutput = AcquireRenderTarget(r, r.Width, r.Height, 0, 1);
+    GLBindVertexArray(r.ScreenBuffer.VAO);
+
+    bench.NumRuns = numRuns;
+    bench.BlurTime = 0;
+    bench.ChainTime = 0;
+    for (int i = 0; i < numRuns; i++)
+    {
+        bench.BlurTime += TimeBloom(bench, r, blurOutput, false) / numRuns;
+        bench.ChainTime += TimeBloom(bench, r, chainOutput, true) / numRuns;
+    }
+
+    size_t size = r.Width*r.Height*4;
+    std::vector<uint8> blurPixels(size);
+    std::vector<uint8> chainPixels(size);
+    BindFramebuffer(*blurOutput);
+    glReadPixels(0, 0, r.Width, r.Height, GL_RGBA, GL_UNSIGNED_BYTE, blurPixels.data());
+    BindFramebuffer(*chainOutput);
+    glReadPixels(0, 0, r.Width, r.Height, GL_RGBA, GL_UNSIGNED_BYTE, chainPixels.data());
+    UnbindFramebuffer(r);
+
+    // the alpha isn't shown
+    bench.MaxDiff = 0;
+    uint64 diffSum = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (i % 4 == 3) continue;
+
+        int diff = std::abs(int(blurPixels[i]) - int(chainPixels[i]));
+        bench.MaxDiff = std::max(bench.MaxDiff, diff);
+        diffSum += diff;
+    }
+    bench.MeanDiff = float(diffSum / double(r.Width*r.Height*3));
+    bench.WithinThreshold = (bench.MeanDiff <= BLOOM_BENCHMARK_MAX_MEAN_DIFF);
+
+    ReleaseRenderTarget(r, blurOutput);
+    ReleaseRenderTarget(r, chainOutput);
+}
+
+void PostProcessEnd(render_state &r)
+{
+    if (r.SceneFramebuffer)
+    {
+        if (r.BloomBenchmark.Pending)
         {
-            Bind(r.MultisampledSceneFramebuffer.ColorTextures[i], i);
+            r.BloomBenchmark.Pending = false;
+            BenchmarkBloom(r, r.BloomBenchmark, 10);
         }
-        glDrawArrays(GL_TRIANGLES, 0, 6);
 
+        BeginGPUTimer(r.PostProcessTimer);
+        UnbindFramebuffer(r);
+        GLBindVertexArray(r.ScreenBuffer.VAO);
         if (Global_Renderer_BloomEnabled)
         {
-            UnbindFramebuffer(r);
-
-            // downsample scene for blur
-            Bind(r.BlitProgram);
-            Bind(r.SceneFramebuffer.ColorTextures[ColorTextureFlag_Emit], 0);
-            for (int i = 0; i < BloomBlurPassCount; i++)
-            {
-                BindFramebuffer(r.BlurHorizontalFramebuffers[i]);
-                glDrawArrays(GL_TRIANGLES, 0, 6);
-            }
-            UnbindFramebuffer(r);
-            UnbindShaderProgram();
-
-            // perform blur
-            RenderBlur(r, &r.BlurHorizontalProgram);
-            framebuffer *BlurOutput = RenderBlur(r, &r.BlurVerticalProgram);
-
-            // blend scene with blur results
-            Bind(r.BlendProgram);
-            for (int i = 0; i < BloomBlurPassCount; i++)
+            RenderBloom(r);
+        }
+        else
+        {
+            Bind(r.ResolveMultisampleProgram);
+            SetUniform(r.ResolveMultisampleProgram.SampleCount, r.SceneFramebuffer->SampleCount);
+            for (size_t i = 0; i < ColorTextureFlag_Count; i++)
             {
-                Bind(BlurOutput[i].ColorTextures[0], i);
+                Bind(r.SceneFramebuffer->ColorTextures[i], i);
             }
-            Bind(r.SceneFramebuffer.ColorTextures[ColorTextureFlag_SurfaceReflect], BloomBlurPassCount);
             glDrawArrays(GL_TRIANGLES, 0, 6);
             UnbindShaderProgram();
         }
+        EndGPUTimer(r.PostProcessTimer);
+
+        ReleaseRenderTarget(r, r.SceneFramebuffer);
+        r.SceneFramebuffer = NULL;
     }
-    // @TODO: cleanup textures
 }
 
 void RenderBackground(render_state &rs, const background_state &bg)
 {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLSetBlend(true);
 
 	Bind(rs.PerlinNoiseProgram);
 	Bind(*bg.RandomTexture, 0);
 	SetUniform(rs.PerlinNoiseProgram.Time, bg.Time);
-	glBindVertexArray(rs.ScreenBuffer.VAO);
+	GLBindVertexArray(rs.ScreenBuffer.VAO);
 
 	for (int i = 0; i < bg.Instances.size(); i++)
 	{
@@ -916,7 +1662,7 @@ void RenderBackground(render_state &rs, const background_state &bg)
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 
-	glDisable(GL_BLEND);
+	GLSetBlend(false);
 }
 
 void RenderBegin(render_state &rs, float deltaTime)
@@ -931,133 +1677,751 @@ void RenderBegin(render_state &rs, float deltaTime)
     }
 
 	rs.DeltaTime = deltaTime;
-    rs.LastVAO = -1;
     rs.RenderableCount = 0;
-    rs.FrameSolidRenderables.clear();
-    rs.FrameTransparentRenderables.clear();
+    rs.ParticleInstanceCount = 0;
+    rs.FrameKeys.clear();
+    rs.Matrices.clear();
+    rs.NumTransparent = 0;
+    rs.FrameNumber++;
 
 #ifdef DRAFT_DEBUG
     ResetBuffer(rs.DebugBuffer);
 #endif
 }
 
-mat4 GetTransformMatrix(transform &t)
+void ClearTransformBatch(transform_batch &b)
 {
-    mat4 TransformMatrix = glm::translate(mat4(1.0f), t.Position);
-    if (t.Rotation.x != 0.0f)
+    for (auto v : { &b.PosX, &b.PosY, &b.PosZ, &b.SclX, &b.SclY, &b.SclZ,
+                    &b.SinX, &b.CosX, &b.SinY, &b.CosY, &b.SinZ, &b.CosZ })
     {
-        TransformMatrix = glm::rotate(TransformMatrix, glm::radians(t.Rotation.x), vec3(1,0,0));
+        v->clear();
     }
-    if (t.Rotation.y != 0.0f)
+}
+
+inline static void AddAngle(std::vector<float> &sines, std::vector<float> &cosines, float degrees)
+{
+    // most transforms aren't rotated at all
+    if (degrees == 0.0f)
     {
-        TransformMatrix = glm::rotate(TransformMatrix, glm::radians(t.Rotation.y), vec3(0,1,0));
+        sines.push_back(0.0f);
+        cosines.push_back(1.0f);
+        return;
     }
-    if (t.Rotation.z != 0.0f)
+    float r = glm::radians(degrees);
+    sines.push_back(std::sin(r));
+    cosines.push_back(std::cos(r));
+}
+
+size_t AddToTransformBatch(transform_batch &b, const transform &t)
+{
+    size_t index = b.PosX.size();
+    b.PosX.push_back(t.Position.x);
+    b.PosY.push_back(t.Position.y);
+    b.PosZ.push_back(t.Position.z);
+    b.SclX.push_back(t.Scale.x);
+    b.SclY.push_back(t.Scale.y);
+    b.SclZ.push_back(t.Scale.z);
+    AddAngle(b.SinX, b.CosX, t.Rotation.x);
+    AddAngle(b.SinY, b.CosY, t.Rotation.y);
+    AddAngle(b.SinZ, b.CosZ, t.Rotation.z);
+    return index;
+}
+
+// The matrix is T * Rx * Ry * Rz * S, what translating, rotating around
+// X, Y and Z and scaling with glm gives, written out
+static void ComputeTransformMatricesScalar(const transform_batch &b, size_t begin, size_t end, mat4 *out)
+{
+    for (size_t i = begin; i < end; i++)
     {
-        TransformMatrix = glm::rotate(TransformMatrix, glm::radians(t.Rotation.z), vec3(0,0,1));
+        float sa = b.SinX[i], ca = b.CosX[i];
+        float sb = b.SinY[i], cb = b.CosY[i];
+        float sc = b.SinZ[i], cc = b.CosZ[i];
+        auto &m = out[i];
+        m[0] = vec4{ cb*cc, ca*sc + sa*sb*cc, sa*sc - ca*sb*cc, 0.0f } * b.SclX[i];
+        m[1] = vec4{ -cb*sc, ca*cc - sa*sb*sc, sa*cc + ca*sb*sc, 0.0f } * b.SclY[i];
+        m[2] = vec4{ sb, -sa*cb, ca*cb, 0.0f } * b.SclZ[i];
+        m[3] = vec4{ b.PosX[i], b.PosY[i], b.PosZ[i], 1.0f };
     }
-    TransformMatrix = glm::scale(TransformMatrix, t.Scale);
-    return TransformMatrix;
 }
 
-static void RenderRenderable(render_state &rs, camera &Camera, renderable &r)
+#ifdef DRAFT_SSE
+// Builds the elements of 4 matrices at a time and transposes them into
+// columns
+static void ComputeTransformMatricesSSE(const transform_batch &b, size_t begin, size_t end, mat4 *out)
 {
-    if (rs.LastVAO != r.VAO)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
     {
-        glBindVertexArray(rs.LastVAO = r.VAO);
+        __m128 sa = _mm_loadu_ps(&b.SinX[i]), ca = _mm_loadu_ps(&b.CosX[i]);
+        __m128 sb = _mm_loadu_ps(&b.SinY[i]), cb = _mm_loadu_ps(&b.CosY[i]);
+        __m128 sc = _mm_loadu_ps(&b.SinZ[i]), cc = _mm_loadu_ps(&b.CosZ[i]);
+        __m128 sx = _mm_loadu_ps(&b.SclX[i]);
+        __m128 sy = _mm_loadu_ps(&b.SclY[i]);
+        __m128 sz = _mm_loadu_ps(&b.SclZ[i]);
+        __m128 sasb = _mm_mul_ps(sa, sb);
+        __m128 casb = _mm_mul_ps(ca, sb);
+
+        // element r of column c for the 4 matrices
+        __m128 cols[4][4];
+        cols[0][0] = _mm_mul_ps(_mm_mul_ps(cb, cc), sx);
+        cols[0][1] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(ca, sc), _mm_mul_ps(sasb, cc)), sx);
+        cols[0][2] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(sa, sc), _mm_mul_ps(casb, cc)), sx);
+        cols[0][3] = zero;
+        cols[1][0] = _mm_mul_ps(_mm_sub_ps(zero, _mm_mul_ps(cb, sc)), sy);
+        cols[1][1] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ca, cc), _mm_mul_ps(sasb, sc)), sy);
+        cols[1][2] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sa, cc), _mm_mul_ps(casb, sc)), sy);
+        cols[1][3] = zero;
+        cols[2][0] = _mm_mul_ps(sb, sz);
+        cols[2][1] = _mm_mul_ps(_mm_sub_ps(zero, _mm_mul_ps(sa, cb)), sz);
+        cols[2][2] = _mm_mul_ps(_mm_mul_ps(ca, cb), sz);
+        cols[2][3] = zero;
+        cols[3][0] = _mm_loadu_ps(&b.PosX[i]);
+        cols[3][1] = _mm_loadu_ps(&b.PosY[i]);
+        cols[3][2] = _mm_loadu_ps(&b.PosZ[i]);
+        cols[3][3] = one;
+
+        for (int c = 0; c < 4; c++)
+        {
+            _MM_TRANSPOSE4_PS(cols[c][0], cols[c][1], cols[c][2], cols[c][3]);
+            for (int lane = 0; lane < 4; lane++)
+            {
+                _mm_storeu_ps(&out[i + lane][c][0], cols[c][lane]);
+            }
+        }
     }
+    ComputeTransformMatricesScalar(b, i, end, out);
+}
+#endif
 
+// Writes the matrix of every transform in the batch to out
+void ComputeTransformMatrices(const transform_batch &b, mat4 *out)
+{
+#ifdef DRAFT_SSE
+    ComputeTransformMatricesSSE(b, 0, b.PosX.size(), out);
+#else
+    ComputeTransformMatricesScalar(b, 0, b.PosX.size(), out);
+#endif
+}
+
+mat4 GetTransformMatrix(const transform &t)
+{
+    static thread_local transform_batch batch;
+    ClearTransformBatch(batch);
+    AddToTransformBatch(batch, t);
+
+    mat4 result;
+    ComputeTransformMatricesScalar(batch, 0, 1, &result);
+    return result;
+}
+
+// Points the instance attributes of the bound VAO to the instances of
+// the renderable, the offset changes with every instanced draw
+static void BindInstanceAttributes(render_state &rs, renderable &r)
+{
+    size_t stride = sizeof(render_instance);
+    size_t base = rs.InstanceStreamOffset + r.InstanceOffset*stride;
+    glBindBuffer(GL_ARRAY_BUFFER, rs.InstanceStreamVBO);
+    for (GLuint i = 0; i < 4; i++)
+    {
+        GLuint location = INSTANCE_ATTRIB_TRANSFORM + i;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, false, stride, (void *)(base + i*sizeof(vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+    glEnableVertexAttribArray(INSTANCE_ATTRIB_COLOR);
+    glVertexAttribPointer(INSTANCE_ATTRIB_COLOR, 4, GL_FLOAT, false, stride, (void *)(base + offsetof(render_instance, Color)));
+    glVertexAttribDivisor(INSTANCE_ATTRIB_COLOR, 1);
+    glEnableVertexAttribArray(INSTANCE_ATTRIB_EMISSION);
+    glVertexAttribPointer(INSTANCE_ATTRIB_EMISSION, 1, GL_FLOAT, false, stride, (void *)(base + offsetof(render_instance, Emission)));
+    glVertexAttribDivisor(INSTANCE_ATTRIB_EMISSION, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void RenderRenderable(render_state &rs, camera &Camera, renderable &r)
+{
+    GLBindVertexArray(r.VAO);
     if (r.PrimitiveType == GL_LINES || r.PrimitiveType == GL_LINE_LOOP)
     {
-        glLineWidth(r.LineWidth);
+        GLLineWidth(r.LineWidth);
     }
 
-    static model_program *previousProgram = NULL;
     auto program = &rs.ModelProgram;
     if (r.Program)
     {
         program = r.Program;
     }
 
-	Bind(*program);
-    if (program != previousProgram)
+    // everything else comes from the frame and material blocks
+    if (r.InstanceCount > 0)
     {
-        previousProgram = program;
+        program = program->Instanced;
+        Bind(*program);
+        BindInstanceAttributes(rs, r);
+    }
+    else
+    {
+        Bind(*program);
+        SetUniform(program->Transform, rs.Matrices[r.MatrixIndex]);
     }
 
-    SetUniform(program->BendRadius, rs.BendRadius);
-    SetUniform(program->RoadTangentPoint, *rs.RoadTangentPoint);
-    SetUniform(program->FogStart, Global_Renderer_FogStart);
-    SetUniform(program->FogEnd, Global_Renderer_FogEnd);
-    SetUniform(program->FogColor, rs.FogColor);
-    SetUniform(program->ProjectionView, Camera.ProjectionView);
-    SetUniform(program->CamPos, Camera.Position);
-    SetUniform(program->Transform, GetTransformMatrix(r.Transform));
-
-    // @TODO: check why this breaks the floor model
-    SetUniform(program->NormalTransform, mat4(1.0f));
-
+    // the texture is left bound, the next draw with it skips the bind
     if (r.Material->Texture)
     {
         Bind(*r.Material->Texture, 0);
     }
-    if (r.Material->Flags & MaterialFlag_PolygonLines)
-    {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    }
-    SetUniform(program->MaterialFlags, (int)r.Material->Flags);
-    SetUniform(program->DiffuseColor, r.Material->DiffuseColor);
-	SetUniform(program->SpecularColor, r.Material->SpecularColor);
-	SetUniform(program->EmissiveColor, r.Material->EmissiveColor);
-    SetUniform(program->TexWeight, r.Material->TexWeight);
-    SetUniform(program->FogWeight, r.Material->FogWeight);
-    SetUniform(program->Emission, r.Material->Emission);
-	SetUniform(program->Shininess, r.Material->Shininess);
-    SetUniform(program->UvScale, r.Material->UvScale);
-    SetUniform(program->ExplosionLightColor, rs.ExplosionLightColor);
-    SetUniform(program->ExplosionLightTimer, rs.ExplosionLightTimer);
-
-	if (r.Material->Flags & MaterialFlag_CullFace)
-	{
-		glEnable(GL_CULL_FACE);
-	}
+    GLPolygonMode((r.Material->Flags & MaterialFlag_PolygonLines) ? GL_LINE : GL_FILL);
+	GLSetCullFace((r.Material->Flags & MaterialFlag_CullFace) != 0);
 
 	if (r.IsIndexed)
 	{
+        void *indices = (void *)(r.Offset*sizeof(uint32));
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r.IBO);
-		glDrawElements(r.PrimitiveType, r.Count, GL_UNSIGNED_INT, (void *)(r.Offset*sizeof(uint32)));
+        if (r.InstanceCount > 0)
+        {
+            glDrawElementsInstanced(r.PrimitiveType, r.Count, GL_UNSIGNED_INT, indices, r.InstanceCount);
+        }
+        else
+        {
+            glDrawElements(r.PrimitiveType, r.Count, GL_UNSIGNED_INT, indices);
+        }
 	}
+    else if (r.InstanceCount > 0)
+    {
+        glDrawArraysInstanced(r.PrimitiveType, r.Offset, r.Count, r.InstanceCount);
+    }
 	else
 	{
 		glDrawArrays(r.PrimitiveType, r.Offset, r.Count);
 	}
+}
 
-	if (r.Material->Flags & MaterialFlag_CullFace)
-	{
-		glDisable(GL_CULL_FACE);
-	}
+// Points the particle attributes at where this frame's instances were
+// streamed to, instanced draws can't start at an instance in GL 3.3
+static void BindParticleInstances(render_state &rs)
+{
+    size_t stride = PARTICLE_INSTANCE_SIZE*sizeof(float);
+    size_t base = rs.ParticleStreamOffset;
+    glBindBuffer(GL_ARRAY_BUFFER, rs.ParticleStreamVBO);
+    glVertexAttribPointer(0, 4, GL_FLOAT, false, stride, (void *)(base));
+    glVertexAttribPointer(1, 4, GL_FLOAT, false, stride, (void *)(base + 4*sizeof(float)));
+    glVertexAttribPointer(2, 4, GL_FLOAT, false, stride, (void *)(base + 8*sizeof(float)));
+    glVertexAttribPointer(3, 2, GL_FLOAT, false, stride, (void *)(base + 12*sizeof(float)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void RenderParticles(render_state &rs, camera &Camera)
+{
+    if (rs.ParticleInstanceCount == 0) return;
+
+    auto &program = rs.ParticleProgram;
+    Bind(program);
+    GLBindVertexArray(rs.ParticleBuffer.VAO);
+    BindParticleInstances(rs);
+    glDepthMask(GL_FALSE);
 
-    if (r.Material->Flags & MaterialFlag_PolygonLines)
+    SetUniform(program.LinePass, 0);
+    SetUniform(program.Emission, 0.0f);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, rs.ParticleInstanceCount);
+
+    GLLineWidth(DEFAULT_LINE_WIDTH);
+    SetUniform(program.LinePass, 1);
+    SetUniform(program.Emission, PARTICLE_LINE_EMISSION);
+    glDrawArraysInstanced(GL_LINES, 0, 4, rs.ParticleInstanceCount);
+
+    glDepthMask(GL_TRUE);
+}
+
+static material DebugMaterial{Color_white, 0.0f, 0.0f, NULL, MaterialFlag_PolygonLines};
+
+#define SORT_DEPTH_BUCKETS 16
+
+// Packs the draw order of a renderable into a key, sorting the keys
+// sorts the draws. All of them start with the pass and the order:
+//   63-62 pass, 61-54 order
+// The solid ones go roughly front to back to save overdraw, and within a
+// depth bucket the most expensive state change goes in the highest bits
+// so the draws that share state are grouped:
+//   53-50 depth bucket, 49-42 program, 41-34 texture,
+//   33-24 VAO, 23-12 material, 11-0 depth
+// The transparent ones are blended, so they go back to front:
+//   53-22 inverted depth
+static uint64 GetSortKey(render_state &rs, camera &Camera, renderable &r, float viewDepth)
+{
+    uint64 key = (uint64(r.Pass) << 62) | (uint64(r.Order) << 54);
+    float depth = 0.0f;
+    if (Camera.Far > 0.0f)
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        depth = glm::clamp(viewDepth / Camera.Far, 0.0f, 1.0f);
     }
-    if (r.Material->Texture)
+    if (r.Pass == RenderPass_Transparent)
     {
-        Unbind(*r.Material->Texture, 0);
+        // 0xffffffff rounds up to 2^32 as a float, so it's clamped to
+        // keep a depth of 0 out of the order bits
+        uint64 inverted = std::min(uint64((1.0f - depth) * 0xffffffffu), uint64(0xffffffffu));
+        return key | (inverted << 22);
     }
+
+    auto program = r.Program ? r.Program : &rs.ModelProgram;
+    uint64 texture = r.Material->Texture ? r.Material->Texture->ID : 0;
+    uint64 material = uint64(uintptr_t(r.Material) >> 4);
+    uint64 bucket = std::min(uint64(depth * SORT_DEPTH_BUCKETS), uint64(SORT_DEPTH_BUCKETS - 1));
+
+    key |= (bucket << 50);
+    key |= (uint64(program->ID & 0xff) << 42);
+    key |= (uint64(texture & 0xff) << 34);
+    key |= (uint64(r.VAO & 0x3ff) << 24);
+    key |= (uint64(material & 0xfff) << 12);
+    key |= uint64(depth * 0xfff);
+    return key;
 }
 
-static material DebugMaterial{Color_white, 0.0f, 0.0f, NULL, MaterialFlag_PolygonLines};
+// LSD radix sort, a byte at a time. It's stable, so equal keys keep the
+// submission order, and the passes where every key has the same byte
+// are skipped, which is most of the high ones
+static void RadixSortKeys(std::vector<render_key> &keys, std::vector<render_key> &temp)
+{
+    size_t count = keys.size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    size_t offsets[8][256] = {};
+    for (auto &k : keys)
+    {
+        for (int b = 0; b < 8; b++)
+        {
+            offsets[b][(k.Key >> (b*8)) & 0xff]++;
+        }
+    }
+
+    temp.resize(count);
+    render_key *src = keys.data();
+    render_key *dst = temp.data();
+    for (int b = 0; b < 8; b++)
+    {
+        int shift = b*8;
+        auto &offset = offsets[b];
+        if (offset[(src[0].Key >> shift) & 0xff] == count)
+        {
+            continue;
+        }
 
-struct renderable_sorter
+        size_t sum = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            size_t c = offset[i];
+            offset[i] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[offset[(src[i].Key >> shift) & 0xff]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    if (src != keys.data())
+    {
+        keys.swap(temp);
+    }
+}
+
+// The CPU version of WorldToRenderTransform in BendShaderSource
+static vec3 BendWorldPointInner(const vec3 &p, float radius)
+{
+    float r = radius - p.z;
+    float d = p.y*WORLD_ARC_Y_FACTOR;
+    return vec3{ p.x, std::cos(d)*r, std::sin(d)*r };
+}
+
+vec3 BendWorldPoint(const vec3 &p, float radius, float tangentY)
 {
-    render_state *rs;
+    if (p.y < tangentY)
+    {
+        return BendWorldPointInner(p, radius);
+    }
+
+    // past the tangent point the world goes straight
+    vec3 tangentPoint = BendWorldPointInner(vec3{ p.x, tangentY, p.z }, radius);
+    vec3 tangentDir = glm::normalize(vec3{ 0, -tangentPoint.z, tangentPoint.y });
+    return tangentPoint + tangentDir*((p.y - tangentY)*(radius*WORLD_ARC_Y_FACTOR));
+}
 
-    bool operator()(size_t a, size_t b)
+// Returns a box in render space that contains the renderable after the
+// bend. The corners are bent at both ends and at the tangent point, and
+// the box grows by how far the arc between them can bulge out
+static bounding_box GetBentBounds(render_state &rs, renderable &r)
+{
+    float radius = rs.BendRadius;
+    float tangentY = *rs.RoadTangentPoint;
+    vec3 half = glm::abs(r.Bounds.Half);
+    if (r.Transform.Rotation != vec3(0.0f))
     {
-        return rs->Renderables[a].SortNumber < rs->Renderables[b].SortNumber;
+        // the bounds aren't rotated, the sphere around them is safe
+        half = vec3(glm::length(half));
+    }
+
+    if (r.Material->Flags & MaterialFlag_TransformUniform)
+    {
+        // only the origin is bent, the mesh keeps its shape around it
+        vec3 offset = r.Bounds.Center - r.Transform.Position;
+        return bounding_box{ BendWorldPoint(r.Transform.Position, radius, tangentY) + offset, half };
+    }
+
+    vec3 min = r.Bounds.Center - half;
+    vec3 max = r.Bounds.Center + half;
+    float ys[3] = { min.y, max.y, tangentY };
+    int numYs = (tangentY > min.y && tangentY < max.y) ? 3 : 2;
+
+    vec3 lo(FLT_MAX);
+    vec3 hi(-FLT_MAX);
+    for (int i = 0; i < numYs; i++)
+    {
+        for (int corner = 0; corner < 4; corner++)
+        {
+            vec3 p{ (corner & 1) ? max.x : min.x, ys[i], (corner & 2) ? max.z : min.z };
+            p = BendWorldPoint(p, radius, tangentY);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+    }
+
+    float arc = (std::min(max.y, tangentY) - min.y)*WORLD_ARC_Y_FACTOR;
+    if (arc > 0.0f)
+    {
+        float sagitta = std::abs(radius - min.z)*(1.0f - std::cos(std::min(arc, float(M_PI))*0.5f));
+        lo -= vec3(sagitta);
+        hi += vec3(sagitta);
+    }
+    return bounding_box{ (lo + hi)*0.5f, (hi - lo)*0.5f };
+}
+
+// Gribb and Hartmann, the planes come out of the rows of the matrix
+static frustum GetFrustum(const mat4 &m)
+{
+    frustum result;
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = vec4{ m[0][i], m[1][i], m[2][i], m[3][i] };
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        result.Planes[i*2] = rows[3] + rows[i];
+        result.Planes[i*2 + 1] = rows[3] - rows[i];
+    }
+    return result;
+}
+
+// A box is outside when it's entirely behind any of the planes
+static void CullBoxesScalar(const frustum &f, cull_batch &b, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        bool visible = true;
+        for (int p = 0; p < 6 && visible; p++)
+        {
+            auto &pl = f.Planes[p];
+            float d = pl.x*b.CenterX[i] + pl.y*b.CenterY[i] + pl.z*b.CenterZ[i] + pl.w;
+            float e = std::abs(pl.x)*b.HalfX[i] + std::abs(pl.y)*b.HalfY[i] + std::abs(pl.z)*b.HalfZ[i];
+            visible = (d + e >= 0.0f);
+        }
+        b.Visible[i] = visible;
+    }
+}
+
+#ifdef DRAFT_SSE
+static void CullBoxesSSE(const frustum &f, cull_batch &b, size_t begin, size_t end)
+{
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&b.CenterX[i]);
+        __m128 cy = _mm_loadu_ps(&b.CenterY[i]);
+        __m128 cz = _mm_loadu_ps(&b.CenterZ[i]);
+        __m128 hx = _mm_loadu_ps(&b.HalfX[i]);
+        __m128 hy = _mm_loadu_ps(&b.HalfY[i]);
+        __m128 hz = _mm_loadu_ps(&b.HalfZ[i]);
+        __m128 outside = zero;
+        for (int p = 0; p < 6; p++)
+        {
+            auto &pl = f.Planes[p];
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(pl.x)), _mm_mul_ps(cy, _mm_set1_ps(pl.y))),
+                                  _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(pl.z)), _mm_set1_ps(pl.w)));
+            __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, _mm_set1_ps(std::abs(pl.x))), _mm_mul_ps(hy, _mm_set1_ps(std::abs(pl.y)))),
+                                  _mm_mul_ps(hz, _mm_set1_ps(std::abs(pl.z))));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, e), zero));
+        }
+        int mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            b.Visible[i + lane] = !(mask & (1 << lane));
+        }
+    }
+    CullBoxesScalar(f, b, i, end);
+}
+#endif
+
+// Tests the bent bounds of the renderables against the camera and marks
+// the ones it can't see
+static void CullRenderables(render_state &rs, camera &Camera)
+{
+    auto &b = rs.CullBatch;
+    size_t count = rs.RenderableCount;
+    b.CenterX.resize(count);
+    b.CenterY.resize(count);
+    b.CenterZ.resize(count);
+    b.HalfX.resize(count);
+    b.HalfY.resize(count);
+    b.HalfZ.resize(count);
+    b.Visible.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto &r = rs.Renderables[i];
+        // the ones that aren't culled still get tested, the result is
+        // ignored below
+        bounding_box box;
+        if (r.Cull)
+        {
+            box = GetBentBounds(rs, r);
+        }
+        else
+        {
+            box.Center = Camera.Position;
+        }
+        b.CenterX[i] = box.Center.x;
+        b.CenterY[i] = box.Center.y;
+        b.CenterZ[i] = box.Center.z;
+        b.HalfX[i] = box.Half.x;
+        b.HalfY[i] = box.Half.y;
+        b.HalfZ[i] = box.Half.z;
     }
-};
+
+    frustum f = GetFrustum(Camera.ProjectionView);
+#ifdef DRAFT_SSE
+    CullBoxesSSE(f, b, 0, count);
+#else
+    CullBoxesScalar(f, b, 0, count);
+#endif
+
+    rs.NumCulled = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto &r = rs.Renderables[i];
+        r.Visible = (b.Visible[i] != 0) || !r.Cull || !Global_Renderer_FrustumCulling;
+        rs.NumCulled += !r.Visible;
+    }
+    rs.NumVisible = count - rs.NumCulled;
+}
+
+// The distance along the view direction of every bent center, in bulk
+// since it's needed for every renderable that gets a sort key
+static void ComputeViewDepths(cull_batch &b, camera &Camera)
+{
+    vec3 forward = -vec3{ Camera.View[0][2], Camera.View[1][2], Camera.View[2][2] };
+    float offset = -glm::dot(Camera.Position, forward);
+    size_t count = b.CenterX.size();
+    b.Depth.resize(count);
+
+    size_t i = 0;
+#ifdef DRAFT_SSE
+    const __m128 fx = _mm_set1_ps(forward.x);
+    const __m128 fy = _mm_set1_ps(forward.y);
+    const __m128 fz = _mm_set1_ps(forward.z);
+    const __m128 fw = _mm_set1_ps(offset);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.CenterX[i]), fx), _mm_mul_ps(_mm_loadu_ps(&b.CenterY[i]), fy)),
+                              _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&b.CenterZ[i]), fz), fw));
+        _mm_storeu_ps(&b.Depth[i], d);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        b.Depth[i] = b.CenterX[i]*forward.x + b.CenterY[i]*forward.y + b.CenterZ[i]*forward.z + offset;
+    }
+}
+
+static instance_key GetInstanceKey(renderable &r)
+{
+    instance_key key;
+    key.Program = r.Program;
+    key.VAO = r.VAO;
+    key.IBO = r.IsIndexed ? r.IBO : 0;
+    key.Offset = r.Offset;
+    key.Count = r.Count;
+    key.PrimitiveType = r.PrimitiveType;
+    key.LineWidth = r.LineWidth;
+    key.Order = r.Order;
+    key.Texture = r.Material->Texture;
+    key.SpecularColor = r.Material->SpecularColor;
+    key.EmissiveColor = r.Material->EmissiveColor;
+    key.Shininess = r.Material->Shininess;
+    key.TexWeight = r.Material->TexWeight;
+    key.FogWeight = r.Material->FogWeight;
+    key.Flags = r.Material->Flags;
+    key.UvScale = r.Material->UvScale;
+    return key;
+}
+
+#define INSTANCE_GROUP_NONE 0xffffffff
+
+// Groups the solid renderables that only differ by transform, diffuse
+// color and emission. The first renderable of a group with more than one
+// member draws all of them with one instanced call, the rest are marked
+// with IsInstance and don't get a sort key
+static void BuildInstances(render_state &rs)
+{
+    rs.InstanceGroupMap.clear();
+    rs.InstanceGroups.clear();
+    rs.Instances.clear();
+    rs.RenderableGroups.resize(rs.RenderableCount);
+    rs.NumInstancedDraws = 0;
+    for (size_t i = 0; i < rs.RenderableCount; i++)
+    {
+        auto &r = rs.Renderables[i];
+        auto program = r.Program ? r.Program : &rs.ModelProgram;
+        r.InstanceOffset = 0;
+        r.InstanceCount = 0;
+        r.IsInstance = false;
+        rs.RenderableGroups[i] = INSTANCE_GROUP_NONE;
+        if (!Global_Renderer_Instancing || !r.Visible || r.Pass != RenderPass_Solid || !program->Instanced)
+        {
+            continue;
+        }
+
+        auto it = rs.InstanceGroupMap.emplace(GetInstanceKey(r), uint32(rs.InstanceGroups.size()));
+        if (it.second)
+        {
+            rs.InstanceGroups.push_back(instance_group{ 0, 0, 0, -1 });
+        }
+        rs.InstanceGroups[it.first->second].Count++;
+        rs.RenderableGroups[i] = it.first->second;
+    }
+
+    uint32 numInstances = 0;
+    for (auto &group : rs.InstanceGroups)
+    {
+        if (group.Count > 1)
+        {
+            group.Offset = group.Fill = numInstances;
+            numInstances += group.Count;
+        }
+    }
+    rs.Instances.resize(numInstances);
+
+    for (size_t i = 0; i < rs.RenderableCount; i++)
+    {
+        uint32 groupIndex = rs.RenderableGroups[i];
+        if (groupIndex == INSTANCE_GROUP_NONE || rs.InstanceGroups[groupIndex].Count < 2)
+        {
+            continue;
+        }
+
+        auto &r = rs.Renderables[i];
+        auto &group = rs.InstanceGroups[groupIndex];
+        if (group.First < 0)
+        {
+            group.First = int32(i);
+            r.InstanceOffset = group.Offset;
+            r.InstanceCount = group.Count;
+            rs.NumInstancedDraws++;
+        }
+        else
+        {
+            r.IsInstance = true;
+        }
+        rs.Instances[group.Fill++] = render_instance{ rs.Matrices[r.MatrixIndex], r.Material->DiffuseColor, r.Material->Emission };
+    }
+
+    if (rs.Instances.empty()) return;
+
+    size_t stride = sizeof(render_instance);
+    if (!StreamData(Global_StreamBuffer, rs.Instances.data(), rs.Instances.size()*stride, stride, rs.InstanceStreamOffset))
+    {
+        // the range couldn't be mapped, everything is drawn on its own
+        for (size_t i = 0; i < rs.RenderableCount; i++)
+        {
+            auto &r = rs.Renderables[i];
+            r.InstanceCount = 0;
+            r.IsInstance = false;
+        }
+        rs.NumInstancedDraws = 0;
+        return;
+    }
+    rs.InstanceStreamVBO = Global_StreamBuffer.VBO;
+}
+
+// Uploads the constants that are the same for every draw in the frame
+static void WriteFrameUniforms(render_state &rs, camera &Camera)
+{
+    frame_uniforms u;
+    u.ProjectionView = Camera.ProjectionView;
+    u.FogColor = rs.FogColor;
+    u.ExplosionLightColor = rs.ExplosionLightColor;
+    u.CamPos = Camera.Position;
+    u.FogStart = Global_Renderer_FogStart;
+    u.FogEnd = Global_Renderer_FogEnd;
+    u.BendRadius = rs.BendRadius;
+    u.RoadTangentPoint = *rs.RoadTangentPoint;
+    u.ExplosionLightTimer = rs.ExplosionLightTimer;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, rs.FrameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(u), &u);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_FRAME, rs.FrameUniformBuffer);
+}
+
+inline static size_t GetMaterialUniformStride(render_state &rs)
+{
+    size_t align = size_t(rs.UniformBufferAlignment);
+    return (sizeof(material_uniforms) + align - 1) / align * align;
+}
+
+// Packs a block for every material drawn this frame into one buffer, the
+// draws bind their material's block by offset. A material shared by many
+// renderables is only written once
+static void WriteMaterialUniforms(render_state &rs)
+{
+    size_t stride = GetMaterialUniformStride(rs);
+    rs.NumMaterials = 0;
+    for (auto &k : rs.FrameKeys)
+    {
+        auto m = rs.Renderables[k.Index].Material;
+        if (m->UniformFrame == rs.FrameNumber)
+        {
+            continue;
+        }
+
+        size_t offset = rs.NumMaterials++ * stride;
+        if (rs.MaterialUniforms.size() < offset + stride)
+        {
+            rs.MaterialUniforms.resize(std::max(offset + stride, rs.MaterialUniforms.size()*2));
+        }
+        auto u = (material_uniforms *)(rs.MaterialUniforms.data() + offset);
+        u->DiffuseColor = m->DiffuseColor;
+        u->SpecularColor = m->SpecularColor;
+        u->EmissiveColor = m->EmissiveColor;
+        u->UvScale = m->UvScale;
+        u->TexWeight = m->TexWeight;
+        u->FogWeight = m->FogWeight;
+        u->Emission = m->Emission;
+        u->Shininess = m->Shininess;
+        u->Flags = int32(m->Flags);
+        u->Pad = 0;
+        m->UniformFrame = rs.FrameNumber;
+        m->UniformOffset = uint32(offset);
+    }
+
+    // orphans last frame's data instead of waiting for it
+    glBindBuffer(GL_UNIFORM_BUFFER, rs.MaterialUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, rs.NumMaterials*stride, rs.MaterialUniforms.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
 void RenderEnd(render_state &rs, camera &Camera)
 {
@@ -1065,50 +2429,80 @@ void RenderEnd(render_state &rs, camera &Camera)
 
 #ifdef DRAFT_DEBUG
     // push debug renderable
+    if (StreamVertices(Global_StreamBuffer, rs.DebugBuffer))
     {
         size_t i = NextRenderable(rs);
         auto &r = rs.Renderables[i];
         r.VAO = rs.DebugBuffer.VAO;
-        r.Offset = 0;
+        r.Offset = rs.DebugBuffer.StreamFirst;
         r.Count = rs.DebugBuffer.VertexCount;
         r.Material = &DebugMaterial;
+        r.Program = NULL;
         r.PrimitiveType = GL_LINES;
+        r.IsIndexed = false;
         r.Transform = transform{};
-        rs.FrameSolidRenderables.push_back(i);
-        UploadVertices(rs.DebugBuffer, GL_DYNAMIC_DRAW);
+        r.MatrixIndex = uint32(rs.Matrices.size());
+        rs.Matrices.push_back(mat4(1.0f));
+        r.Order = RENDER_ORDER_DEFAULT;
+        r.Pass = RenderPass_Solid;
+        r.Cull = false;
     }
 #endif
 
-    renderable_sorter sorter;
-    sorter.rs = &rs;
-    std::sort(rs.FrameSolidRenderables.begin(), rs.FrameSolidRenderables.end(), sorter);
-    //std::sort(rs.FrameTransparentRenderables.begin(), rs.FrameTransparentRenderables.end(), sorter);
+    CullRenderables(rs, Camera);
+    ComputeViewDepths(rs.CullBatch, Camera);
+    BuildInstances(rs);
+    rs.FrameKeys.clear();
+    for (size_t i = 0; i < rs.RenderableCount; i++)
+    {
+        auto &r = rs.Renderables[i];
+        if (r.Visible && !r.IsInstance)
+        {
+            rs.FrameKeys.push_back(render_key{ GetSortKey(rs, Camera, r, rs.CullBatch.Depth[i]), uint32(i) });
+        }
+    }
+    RadixSortKeys(rs.FrameKeys, rs.SortTemp);
+    WriteFrameUniforms(rs, Camera);
+    WriteMaterialUniforms(rs);
 
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
-    for (auto renderableIndex : rs.FrameSolidRenderables)
+    GLSetBlend(false);
+    material *boundMaterial = NULL;
+    for (auto &k : rs.FrameKeys)
     {
-        RenderRenderable(rs, Camera, rs.Renderables[renderableIndex]);
-    }
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    for (auto renderableIndex : rs.FrameTransparentRenderables)
-    {
-        RenderRenderable(rs, Camera, rs.Renderables[renderableIndex]);
+        auto &r = rs.Renderables[k.Index];
+        if (r.Material != boundMaterial)
+        {
+            glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_MATERIAL, rs.MaterialUniformBuffer,
+                              r.Material->UniformOffset, sizeof(material_uniforms));
+            boundMaterial = r.Material;
+        }
+        GLSetBlend(r.Pass == RenderPass_Transparent);
+        RenderRenderable(rs, Camera, r);
     }
-    glDisable(GL_BLEND);
+
+    // the rest of the renderer expects the defaults
+    GLPolygonMode(GL_FILL);
+    GLSetCullFace(false);
+    GLSetBlend(true);
+    RenderParticles(rs, Camera);
+    GLSetBlend(false);
     glDisable(GL_DEPTH_TEST);
 }
 
 void AddRenderable(render_state &rs, size_t index, material *material)
 {
+    auto &r = rs.Renderables[index];
+    r.Cull = true;
     if (material->DiffuseColor.a < 1.0f || (material->Flags & MaterialFlag_ForceTransparent))
     {
-        rs.FrameTransparentRenderables.push_back(index);
+        r.Pass = RenderPass_Transparent;
+        rs.NumTransparent++;
     }
     else
     {
-        rs.FrameSolidRenderables.push_back(index);
+        r.Pass = RenderPass_Solid;
     }
 }
 
@@ -1120,26 +2514,35 @@ void ApplyExplosionLight(render_state &rs, color c)
 
 void DrawMeshPart(render_state &rs, mesh &Mesh, mesh_part &part, const transform &Transform)
 {
+    uint32 matrixIndex = uint32(rs.Matrices.size());
+    rs.Matrices.push_back(GetTransformMatrix(Transform));
+
     size_t Index = NextRenderable(rs);
     auto &r = rs.Renderables[Index];
-    r.SortNumber = rs.RenderableCount * 100;
+    r.Order = RENDER_ORDER_DEFAULT;
     r.Program = part.Program;
     r.LineWidth = part.LineWidth;
     r.PrimitiveType = part.PrimitiveType;
-    r.Offset = part.Offset;
+    r.Offset = part.Offset + Mesh.Buffer.StreamFirst;
     r.Count = part.Count;
     r.VAO = Mesh.Buffer.VAO;
 	r.IBO = Mesh.Buffer.IBO;
 	r.IsIndexed = Mesh.Buffer.IsIndexed;
     r.Material = part.Material;
     r.Transform = Transform;
+    r.MatrixIndex = matrixIndex;
     r.Bounds = BoundsFromMinMax(Mesh.Min*Transform.Scale, Mesh.Max*Transform.Scale);
     r.Bounds.Center += Transform.Position;
     AddRenderable(rs, Index, part.Material);
 }
 
-void DrawModel(render_state &rs, model &Model, const transform &Transform)
+// Draws the model with a matrix that was already built from the
+// transform, it's shared by all the parts
+void DrawModel(render_state &rs, model &Model, const transform &Transform, const mat4 &Matrix)
 {
+    uint32 matrixIndex = uint32(rs.Matrices.size());
+    rs.Matrices.push_back(Matrix);
+
     mesh *Mesh = Model.Mesh;
     for (auto &Part : Mesh->Parts)
     {
@@ -1154,29 +2557,35 @@ void DrawModel(render_state &rs, model &Model, const transform &Transform)
         auto &r = rs.Renderables[Index];
         if (Model.SortNumber > -1)
         {
-            r.SortNumber = Model.SortNumber + i;
+            r.Order = uint8(std::min(Model.SortNumber + int(i), RENDER_ORDER_DEFAULT - 1));
         }
         else
         {
-            r.SortNumber = rs.RenderableCount * 100;
+            r.Order = RENDER_ORDER_DEFAULT;
         }
 
         r.Program = Part.Program;
         r.LineWidth = Part.LineWidth;
         r.PrimitiveType = Part.PrimitiveType;
-        r.Offset = Part.Offset;
+        r.Offset = Part.Offset + Mesh->Buffer.StreamFirst;
         r.Count = Part.Count;
         r.VAO = Mesh->Buffer.VAO;
 		r.IBO = Mesh->Buffer.IBO;
 		r.IsIndexed = Mesh->Buffer.IsIndexed;
         r.Material = Material;
         r.Transform = Transform;
+        r.MatrixIndex = matrixIndex;
         r.Bounds = BoundsFromMinMax(Mesh->Min*Transform.Scale, Mesh->Max*Transform.Scale);
         r.Bounds.Center += Transform.Position;
         AddRenderable(rs, Index, Material);
     }
 }
 
+void DrawModel(render_state &rs, model &Model, const transform &Transform)
+{
+    DrawModel(rs, Model, Transform, GetTransformMatrix(Transform));
+}
+
 #ifdef DRAFT_DEBUG
 inline static void DrawDebugCollider(render_state &rs, bounding_box &box, bool isColliding)
 {
@@ -53,6 +53,15 @@ struct mesh_vertex
 	~mesh_vertex() {}
 };
 
+struct vertex_attribute
+{
+    GLuint Location;
+    size_t Size;
+    GLenum Type;
+    size_t Stride;
+    size_t Offset;
+};
+
 struct vertex_buffer
 {
     std::vector<float> Vertices;
@@ -62,17 +71,45 @@ struct vertex_buffer
     size_t VertexSize;
 	float *MappedData = NULL;
 	bool IsIndexed = false;
+
+    // the first vertex in the stream buffer, 0 if it's not streamed
+    size_t StreamFirst = 0;
+
+    // kept to point the VAO at the stream buffer again when it grows
+    std::vector<vertex_attribute> StreamAttributes;
 };
 
-struct vertex_attribute
+// every particle and ribbon at capacity take a bit over 3MB
+#define STREAM_BUFFER_FRAMES     3
+#define STREAM_BUFFER_FRAME_SIZE (8 << 20)
+
+// The vertex data the CPU writes every frame: gui, debug lines, trails,
+// particles and model instances. One buffer split in a region per frame
+// in flight, a region is only written again once the fence of the frame
+// that used it is signaled. It's mapped once if the driver has buffer
+// storage, otherwise every write maps its range unsynchronized. When a
+// region is full the buffer is replaced by one with bigger regions.
+struct stream_buffer
 {
-    GLuint Location;
-    size_t Size;
-    GLenum Type;
-    size_t Stride;
-    size_t Offset;
+    GLuint VBO = 0;
+    uint8 *Mapped = NULL;
+    bool Persistent = false;
+    size_t FrameSize = 0;
+    size_t Frame = 0;
+    size_t Offset = 0;
+    GLsync Fences[STREAM_BUFFER_FRAMES] = {};
+
+    // the buffers replaced this frame, the recorded draws still use them
+    std::vector<GLuint> Retired;
+
+    size_t BytesThisFrame = 0;
+    size_t BytesLastFrame = 0;
+    uint32 NumStalls = 0;
+    uint32 NumOverflows = 0;
 };
 
+static stream_buffer Global_StreamBuffer;
+
 struct texture_filters
 {
     GLint Min, Mag;
@@ -160,6 +197,17 @@ struct camera
     };
 };
 
+// The factor that turns world Y into an angle around the bend, the same
+// as in WorldToRenderTransform in the shaders
+#define WORLD_ARC_Y_FACTOR 0.005f
+
+// The planes point inside, a point p is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0
+struct frustum
+{
+    vec4 Planes[6];
+};
+
 #define MaterialFlag_PolygonLines     0x1
 #define MaterialFlag_ForceTransparent 0x2
 #define MaterialFlag_TransformUniform 0x4
@@ -177,6 +225,11 @@ struct material
     uint32 Flags = 0;
     vec2 UvScale = vec2{ 1, 1 };
 
+    // where the renderer put the material block this frame, see
+    // WriteMaterialUniforms
+    uint32 UniformFrame = 0;
+    uint32 UniformOffset = 0;
+
     material() {}
     material(color c, float e, float tw, texture *t, uint32 f = 0, vec2 us = vec2{ 1, 1 })
         : DiffuseColor(c), Emission(e), TexWeight(tw), Texture(t), Flags(f), UvScale(us) {}
@@ -229,6 +282,9 @@ struct shader_asset_param
     string Path;
     shader_program *ShaderProgram;
     shader_asset_callback_func *Callback;
+
+    // inserted after the #version line of the file
+    string Defines;
 };
 
 struct shader_program
@@ -240,33 +296,53 @@ struct shader_program
     GLuint FragmentShader = 0;
 };
 
+// The rest of the model uniforms live in the frame and material blocks
 struct model_program : shader_program
 {
     shader_asset_param VertexShaderParam;
     shader_asset_param FragmentShaderParam;
-    int ProjectionView;
     int Transform;
     int NormalTransform;
-    int DiffuseColor;
-	int SpecularColor;
-	int EmissiveColor;
-    int TexWeight;
-    int FogWeight;
-    int Emission;
-	int Shininess;
-    int UvScale;
     int Sampler;
-    int MaterialFlags;
-    int ExplosionLightColor;
-    int ExplosionLightTimer;
-    int CamPos;
-    int FogColor;
-    int FogStart;
-    int FogEnd;
-	int BendRadius;
-    int RoadTangentPoint;
+
+    // the same program compiled with INSTANCED, it takes the transform,
+    // diffuse color and emission from render_instance attributes
+    model_program *Instanced = NULL;
+};
+
+struct particle_program : shader_program
+{
+    int Emission;
+    int LinePass;
+};
+
+// Resolves, thresholds and downsamples the emit buffer to the first
+// bloom level
+struct bloom_prefilter_program : shader_program
+{
+    int SampleCount;
+    int Downscale;
+    int Threshold;
+};
+
+// The downsample and the upsample between the bloom levels
+struct bloom_filter_program : shader_program
+{
+    int TexelSize;
+    int Radius;
+};
+
+// Resolves the scene and adds the bloom to it
+struct bloom_composite_program : shader_program
+{
+    int SampleCount;
+    int BloomTexelSize;
+    int Radius;
+    int Intensity;
 };
 
+// The separable blur of the bloom before the mip chain, only drawn by
+// BenchmarkBloom to compare against
 struct blur_program : shader_program
 {
     int PixelSize;
@@ -289,16 +365,40 @@ struct perlin_noise_program : shader_program
 #define FramebufferFlag_IsFloat  0x2
 #define FramebufferFlag_Filtered 0x4
 #define FramebufferFlag_Multisampled 0x8
+#define FramebufferFlag_PackedFloat  0x10
 struct framebuffer
 {
     uint32 Flags;
     uint32 Width, Height;
     size_t ColorTextureCount;
+    int SampleCount;
     GLuint ID;
     texture DepthTexture;
     texture ColorTextures[ColorTextureFlag_Count];
 };
 
+// The targets not acquired for this many frames are destroyed, so the
+// ones of an old size or sample count go away after a resize
+#define RENDER_TARGET_MAX_IDLE_FRAMES 3
+
+struct render_target
+{
+    framebuffer Framebuffer;
+    bool InUse = false;
+    uint64 LastUsedFrame = 0;
+};
+
+// The framebuffers of the post process passes. A pass acquires a target
+// matching its size, flags and sample count and releases it when it's
+// done reading it, so a later pass with the same needs gets the same one
+struct render_target_pool
+{
+    std::vector<render_target *> Targets;
+    uint64 Frame = 0;
+    size_t NumCreated = 0;
+    size_t NumDestroyed = 0;
+};
+
 struct transform
 {
     vec3 Position;
@@ -307,48 +407,334 @@ struct transform
     vec3 Rotation = vec3(0.0f);
 };
 
+// Only what goes in the matrix, the velocity is left out
+inline bool SameMatrixTransform(const transform &a, const transform &b)
+{
+    return a.Position == b.Position && a.Scale == b.Scale && a.Rotation == b.Rotation;
+}
+
+// The TRS of the transforms whose matrices have to be built, in SoA form
+// so ComputeTransformMatrices builds them 4 at a time. The rotation is
+// stored as the sine and cosine of each angle
+struct transform_batch
+{
+    std::vector<float> PosX, PosY, PosZ;
+    std::vector<float> SclX, SclY, SclZ;
+    std::vector<float> SinX, CosX, SinY, CosY, SinZ, CosZ;
+};
+
+enum gl_state_call
+{
+    GLStateCall_Program,
+    GLStateCall_VAO,
+    GLStateCall_Texture,
+    GLStateCall_PolygonMode,
+    GLStateCall_CullFace,
+    GLStateCall_Blend,
+    GLStateCall_LineWidth,
+    GLStateCall_count,
+};
+
+static const char *GLStateCallNames[] = {
+    "Program",
+    "VAO",
+    "Texture",
+    "Polygon mode",
+    "Cull face",
+    "Blend",
+    "Line width",
+};
+
+#define GL_STATE_TEXTURE_UNITS 8
+
+struct gl_state_stats
+{
+    uint32 Issued[GLStateCall_count] = {};
+    uint32 Skipped[GLStateCall_count] = {};
+};
+
+// What the GL state was last set to, the calls that wouldn't change it
+// are skipped. Known has a bit per gl_state_call (and KnownTextures one
+// per unit) for the values that were set through the cache since the
+// last InvalidateGLState
+struct gl_state_cache
+{
+    GLuint Program = 0;
+    GLuint VAO = 0;
+    GLenum ActiveTexture = GL_TEXTURE0;
+    GLuint Textures[GL_STATE_TEXTURE_UNITS] = {};
+    GLenum PolygonMode = GL_FILL;
+    GLenum BlendSrc = GL_ONE;
+    GLenum BlendDst = GL_ZERO;
+    float LineWidth = 1;
+    bool CullFace = false;
+    bool Blend = false;
+    bool ActiveTextureKnown = false;
+    uint32 Known = 0;
+    uint32 KnownTextures = 0;
+    bool BlendFuncKnown = false;
+
+    gl_state_stats Frame;
+    gl_state_stats LastFrame;
+};
+
+static gl_state_cache Global_GLState;
+
+struct render_key
+{
+    uint64 Key;
+    uint32 Index;
+};
+
+enum render_pass
+{
+    RenderPass_Solid,
+    RenderPass_Transparent,
+};
+
+// Binding points of the uniform blocks, the layouts below have to match
+// the std140 blocks in FrameUniformsSource and MaterialUniformsSource
+#define UNIFORM_BLOCK_FRAME    0
+#define UNIFORM_BLOCK_MATERIAL 1
+
+struct frame_uniforms
+{
+    mat4 ProjectionView;
+    color FogColor;
+    color ExplosionLightColor;
+    vec3 CamPos;
+    float FogStart;
+    float FogEnd;
+    float BendRadius;
+    float RoadTangentPoint;
+    float ExplosionLightTimer;
+};
+
+struct material_uniforms
+{
+    color DiffuseColor;
+    color SpecularColor;
+    color EmissiveColor;
+    vec2 UvScale;
+    float TexWeight;
+    float FogWeight;
+    float Emission;
+    float Shininess;
+    int32 Flags;
+    float Pad;
+};
+
+static_assert(sizeof(frame_uniforms) == 128, "frame_uniforms doesn't match the std140 block");
+static_assert(sizeof(material_uniforms) == 80, "material_uniforms doesn't match the std140 block");
+
+// The per instance attributes come after the mesh ones, the transform
+// takes 4 locations
+#define INSTANCE_ATTRIB_TRANSFORM 4
+#define INSTANCE_ATTRIB_COLOR     8
+#define INSTANCE_ATTRIB_EMISSION  9
+
+struct render_instance
+{
+    mat4 Transform;
+    color Color;
+    float Emission;
+};
+
+// renderables without an explicit order go after the ordered ones
+#define RENDER_ORDER_DEFAULT 255
+
 struct renderable
 {
     transform Transform;
+
+    // into render_state::Matrices, the parts of a model share it
+    uint32 MatrixIndex;
     bounding_box Bounds;
     model_program *Program;
     material *Material;
     size_t Offset;
     size_t Count;
-    int SortNumber;
+    uint8 Order;
+    render_pass Pass;
     GLuint VAO;
 	GLuint IBO;
     GLuint PrimitiveType;
     GLfloat LineWidth;
 	bool IsIndexed;
+
+    // set by BuildInstances, a renderable with InstanceCount > 0 draws
+    // its whole group and the other ones in the group are skipped
+    uint32 InstanceOffset;
+    uint32 InstanceCount;
+    bool IsInstance;
+
+    // Cull is false for the ones without bounds, Visible is set by
+    // CullRenderables
+    bool Cull;
+    bool Visible;
+};
+
+// The bent bounds of the renderables in SoA form, tested against the
+// frustum 4 at a time. Depth is the view depth of the centers, which the
+// sort keys use
+struct cull_batch
+{
+    std::vector<float> CenterX, CenterY, CenterZ;
+    std::vector<float> HalfX, HalfY, HalfZ;
+    std::vector<uint8> Visible;
+    std::vector<float> Depth;
 };
 
-#define BloomBlurPassCount 3
+// What the renderables must share to be drawn as instances of each
+// other. The diffuse color and emission are per instance, the rest of
+// the material has to match
+struct instance_key
+{
+    model_program *Program;
+    GLuint VAO;
+    GLuint IBO;
+    size_t Offset;
+    size_t Count;
+    GLuint PrimitiveType;
+    GLfloat LineWidth;
+    uint8 Order;
+    texture *Texture;
+    color SpecularColor;
+    color EmissiveColor;
+    float Shininess;
+    float TexWeight;
+    float FogWeight;
+    uint32 Flags;
+    vec2 UvScale;
+
+    bool operator==(const instance_key &k) const
+    {
+        return Program == k.Program && VAO == k.VAO && IBO == k.IBO &&
+            Offset == k.Offset && Count == k.Count && PrimitiveType == k.PrimitiveType &&
+            LineWidth == k.LineWidth && Order == k.Order && Texture == k.Texture &&
+            SpecularColor == k.SpecularColor && EmissiveColor == k.EmissiveColor &&
+            Shininess == k.Shininess && TexWeight == k.TexWeight && FogWeight == k.FogWeight &&
+            Flags == k.Flags && UvScale == k.UvScale;
+    }
+};
+
+struct instance_key_hash
+{
+    size_t operator()(const instance_key &k) const
+    {
+        size_t h = std::hash<void *>()(k.Program);
+        h = h*31 + k.VAO;
+        h = h*31 + k.Offset;
+        h = h*31 + k.Count;
+        h = h*31 + std::hash<void *>()(k.Texture);
+        return h;
+    }
+};
+
+struct instance_group
+{
+    uint32 Count;
+    uint32 Offset;
+    uint32 Fill;
+    int32 First;
+};
+
+#define PARTICLE_INSTANCE_SIZE 14
+
+// The GPU time of a part of the frame, the result is read a couple of
+// frames later so it never waits for the GPU
+#define GPU_TIMER_FRAMES 3
+struct gpu_timer
+{
+    GLuint Queries[GPU_TIMER_FRAMES] = {};
+    bool Pending[GPU_TIMER_FRAMES] = {};
+    int Frame = 0;
+    float Milliseconds = 0;
+};
+
+// The mip chain against the old separable blur on the scene of a frame.
+// The images are compared on the 0-255 scale of the screen, the chain
+// is wider and softer so they're never identical
+#define BLOOM_BENCHMARK_MAX_MEAN_DIFF 6.0f
+struct bloom_benchmark
+{
+    bool Pending = false;
+    int NumRuns = 0;
+    GLuint Query = 0;
+    float BlurTime = 0;
+    float ChainTime = 0;
+    int MaxDiff = 0;
+    float MeanDiff = 0;
+    bool WithinThreshold = false;
+};
+
+#define BLOOM_MAX_PASSES 8
+#define BLOOM_BLUR_PASSES 3
 struct render_state
 {
     memory_arena Arena;
 
     model_program ModelProgram;
+    model_program InstancedModelProgram;
+    particle_program ParticleProgram;
+    bloom_prefilter_program BloomPrefilterProgram;
+    bloom_filter_program BloomDownProgram;
+    bloom_filter_program BloomUpProgram;
+    bloom_composite_program BloomCompositeProgram;
     blur_program BlurHorizontalProgram;
     blur_program BlurVerticalProgram;
-    shader_program BlendProgram;
     shader_program BlitProgram;
+    shader_program BlendProgram;
     resolve_multisample_program ResolveMultisampleProgram;
 	perlin_noise_program PerlinNoiseProgram;
 
-    framebuffer MultisampledSceneFramebuffer;
-    framebuffer SceneFramebuffer;
-    framebuffer BlurHorizontalFramebuffers[BloomBlurPassCount];
-    framebuffer BlurVerticalFramebuffers[BloomBlurPassCount];
+    // acquired from the pool between PostProcessBegin and PostProcessEnd
+    render_target_pool TargetPool;
+    framebuffer *SceneFramebuffer = NULL;
+    gpu_timer PostProcessTimer;
+    bloom_benchmark BloomBenchmark;
 
     vertex_buffer SpriteBuffer;
     vertex_buffer ScreenBuffer;
 
+    // one instance per ribbon segment or particle
+    vertex_buffer ParticleBuffer;
+    size_t ParticleInstanceCount = 0;
+    size_t ParticleStreamOffset = 0;
+    GLuint ParticleStreamVBO = 0;
+
     std::vector<renderable> Renderables;
     size_t RenderableCount;
 
-    fixed_array<size_t, 128> FrameSolidRenderables;
-    fixed_array<size_t, 128> FrameTransparentRenderables;
+    // the renderables of the frame in draw order, see GetSortKey
+    std::vector<render_key> FrameKeys;
+    std::vector<render_key> SortTemp;
+
+    // the world matrices of the frame, one per DrawModel
+    std::vector<mat4> Matrices;
+    size_t NumTransparent = 0;
+
+    // the frame block is written once per RenderEnd, the material one
+    // holds a block for every material drawn in the frame
+    GLuint FrameUniformBuffer = 0;
+    GLuint MaterialUniformBuffer = 0;
+    GLint UniformBufferAlignment = 256;
+    std::vector<uint8> MaterialUniforms;
+    uint32 FrameNumber = 0;
+    size_t NumMaterials = 0;
+
+    // the solid renderables that can be drawn together, see BuildInstances
+    size_t InstanceStreamOffset = 0;
+    GLuint InstanceStreamVBO = 0;
+    std::vector<render_instance> Instances;
+    std::unordered_map<instance_key, uint32, instance_key_hash> InstanceGroupMap;
+    std::vector<instance_group> InstanceGroups;
+    std::vector<uint32> RenderableGroups;
+    size_t NumInstancedDraws = 0;
+
+    cull_batch CullBatch;
+    size_t NumCulled = 0;
+    size_t NumVisible = 0;
 
     uint32 Width;
     uint32 Height;
@@ -356,7 +742,9 @@ struct render_state
 	uint32 ViewportHeight;
 
     GLint MaxMultiSampleCount;
-    GLint LastVAO;
+
+    // the samples of the scene target, 1 when AA is off
+    int SampleCount;
 
     color FogColor;
     color ExplosionLightColor;
@@ -0,0 +1,293 @@
+// Copyright
+
+// Input recording and playback, shared by the platforms. A replay stores
+// the seed the game was started with and, for every tick, the input the
+// tick saw, its dt and the world checksum after it. Only the parts of the
+// input that changed since the previous tick are written.
+
+#define REPLAY_MAGIC   0x4c505244 // "DRPL"
+#define REPLAY_VERSION 1
+
+#define ReplayTickFlag_Actions 0x1
+#define ReplayTickFlag_Mouse   0x2
+#define ReplayTickFlag_Keys    0x4
+
+enum replay_mode
+{
+    ReplayMode_None,
+    ReplayMode_Record,
+    ReplayMode_Play,
+};
+
+struct replay_header
+{
+    uint32 Magic;
+    uint32 Version;
+    uint32 TickRate;
+    uint32 Seed;
+};
+
+struct replay
+{
+    replay_mode Mode = ReplayMode_None;
+    FILE *File = NULL;
+    replay_header Header;
+    uint64 Tick = 0;
+    uint32 ExpectedChecksum = 0;
+    uint64 DesyncTick = 0;
+    bool Desynced = false;
+
+    // the input of the previous tick, what the deltas are based on
+    action_state Actions[Action_count];
+    mouse_state Mouse;
+    uint8 Keys[SDL_NUM_SCANCODES];
+};
+
+template<typename T>
+inline static void ReplayWrite(replay &r, T value)
+{
+    fwrite(&value, sizeof(T), 1, r.File);
+}
+
+template<typename T>
+inline static bool ReplayRead(replay &r, T &value)
+{
+    return fread(&value, sizeof(T), 1, r.File) == 1;
+}
+
+static bool ReplayOpen(replay &r, replay_mode mode, const char *filename, uint32 seed)
+{
+    r.Mode = mode;
+    r.Tick = 0;
+    r.Desynced = false;
+    memset(r.Keys, 0, sizeof(r.Keys));
+    if (mode == ReplayMode_Record)
+    {
+        r.File = fopen(filename, "wb");
+        if (!r.File)
+        {
+            fprintf(stderr, "Could not create replay %s\n", filename);
+            return false;
+        }
+
+        r.Header = replay_header{ REPLAY_MAGIC, REPLAY_VERSION, GAME_TICK_RATE, seed };
+        ReplayWrite(r, r.Header);
+        return true;
+    }
+
+    r.File = fopen(filename, "rb");
+    if (!r.File)
+    {
+        fprintf(stderr, "Could not open replay %s\n", filename);
+        return false;
+    }
+    if (!ReplayRead(r, r.Header) || r.Header.Magic != REPLAY_MAGIC || r.Header.Version != REPLAY_VERSION)
+    {
+        fprintf(stderr, "Invalid replay %s\n", filename);
+        return false;
+    }
+    if (r.Header.TickRate != GAME_TICK_RATE)
+    {
+        fprintf(stderr, "Replay %s was recorded at %dHz, the game ticks at %dHz\n", filename, r.Header.TickRate, GAME_TICK_RATE);
+        return false;
+    }
+    return true;
+}
+
+static void ReplayClose(replay &r)
+{
+    if (r.File)
+    {
+        fclose(r.File);
+        r.File = NULL;
+    }
+    r.Mode = ReplayMode_None;
+}
+
+static bool ActionChanged(const action_state &a, const action_state &b)
+{
+    return a.Pressed != b.Pressed || a.AxisValue != b.AxisValue;
+}
+
+static bool MouseChanged(const mouse_state &a, const mouse_state &b)
+{
+    return a.X != b.X || a.Y != b.Y || a.dX != b.dX || a.dY != b.dY ||
+        a.ScrollY != b.ScrollY || a.Buttons != b.Buttons;
+}
+
+static void ReplayWriteTick(replay &r, game_input &input, float dt, uint32 checksum)
+{
+    uint16 changedActions = 0;
+    for (int i = 0; i < Action_count; i++)
+    {
+        if (ActionChanged(input.Actions[i], r.Actions[i]))
+        {
+            changedActions |= (1 << i);
+        }
+    }
+
+    const uint8 *keys = input.Keys;
+    bool keysChanged = keys && memcmp(keys, r.Keys, sizeof(r.Keys)) != 0;
+
+    uint8 flags = 0;
+    if (changedActions) flags |= ReplayTickFlag_Actions;
+    if (MouseChanged(input.MouseState, r.Mouse)) flags |= ReplayTickFlag_Mouse;
+    if (keysChanged) flags |= ReplayTickFlag_Keys;
+
+    ReplayWrite(r, flags);
+    ReplayWrite(r, dt);
+    ReplayWrite(r, checksum);
+    if (flags & ReplayTickFlag_Actions)
+    {
+        ReplayWrite(r, changedActions);
+        for (int i = 0; i < Action_count; i++)
+        {
+            if (!(changedActions & (1 << i))) continue;
+
+            auto &action = input.Actions[i];
+            ReplayWrite(r, int8(std::min(action.Pressed, 127)));
+            ReplayWrite(r, action.AxisValue);
+            r.Actions[i] = action;
+        }
+    }
+    if (flags & ReplayTickFlag_Mouse)
+    {
+        auto &mouse = input.MouseState;
+        ReplayWrite(r, int16(mouse.X));
+        ReplayWrite(r, int16(mouse.Y));
+        ReplayWrite(r, int16(mouse.dX));
+        ReplayWrite(r, int16(mouse.dY));
+        ReplayWrite(r, int8(mouse.ScrollY));
+        ReplayWrite(r, mouse.Buttons);
+        r.Mouse = mouse;
+    }
+    if (flags & ReplayTickFlag_Keys)
+    {
+        // only the pressed keys are written
+        uint16 count = 0;
+        for (int i = 0; i < SDL_NUM_SCANCODES; i++)
+        {
+            count += (keys[i] != 0);
+        }
+        ReplayWrite(r, count);
+        for (int i = 0; i < SDL_NUM_SCANCODES; i++)
+        {
+            if (keys[i]) ReplayWrite(r, uint16(i));
+        }
+        memcpy(r.Keys, keys, sizeof(r.Keys));
+    }
+}
+
+static bool ReplayReadTick(replay &r, game_input &input, float &dt)
+{
+    uint8 flags;
+    if (!ReplayRead(r, flags) || !ReplayRead(r, dt) || !ReplayRead(r, r.ExpectedChecksum))
+    {
+        return false;
+    }
+
+    if (flags & ReplayTickFlag_Actions)
+    {
+        uint16 changedActions;
+        ReplayRead(r, changedActions);
+        for (int i = 0; i < Action_count; i++)
+        {
+            if (!(changedActions & (1 << i))) continue;
+
+            int8 pressed;
+            ReplayRead(r, pressed);
+            ReplayRead(r, r.Actions[i].AxisValue);
+            r.Actions[i].Pressed = pressed;
+        }
+    }
+    if (flags & ReplayTickFlag_Mouse)
+    {
+        int16 x, y, dx, dy;
+        int8 scrollY;
+        ReplayRead(r, x);
+        ReplayRead(r, y);
+        ReplayRead(r, dx);
+        ReplayRead(r, dy);
+        ReplayRead(r, scrollY);
+        ReplayRead(r, r.Mouse.Buttons);
+        r.Mouse.X = x;
+        r.Mouse.Y = y;
+        r.Mouse.dX = dx;
+        r.Mouse.dY = dy;
+        r.Mouse.ScrollY = scrollY;
+    }
+    if (flags & ReplayTickFlag_Keys)
+    {
+        uint16 count;
+        ReplayRead(r, count);
+        memset(r.Keys, 0, sizeof(r.Keys));
+        for (int i = 0; i < count; i++)
+        {
+            uint16 key;
+            ReplayRead(r, key);
+            if (key < SDL_NUM_SCANCODES) r.Keys[key] = 1;
+        }
+    }
+
+    for (int i = 0; i < Action_count; i++)
+    {
+        input.Actions[i].Pressed = r.Actions[i].Pressed;
+        input.Actions[i].AxisValue = r.Actions[i].AxisValue;
+    }
+    input.MouseState = r.Mouse;
+    input.Keys = r.Keys;
+    input.KeyCount = SDL_NUM_SCANCODES;
+    return true;
+}
+
+// Called before every tick. When playing, overrides the input and dt
+// with the recorded ones, returns false when the replay is over
+static bool ReplayBeginTick(replay &r, game_input &input, float &dt)
+{
+    if (r.Mode != ReplayMode_Play)
+    {
+        return true;
+    }
+    return ReplayReadTick(r, input, dt);
+}
+
+// Called after every tick with the input the tick saw and the world
+// checksum, which is recorded or compared against the recording
+static void ReplayEndTick(replay &r, game_input &input, float dt, uint32 checksum)
+{
+    switch (r.Mode)
+    {
+    case ReplayMode_Record:
+        ReplayWriteTick(r, input, dt, checksum);
+        break;
+
+    case ReplayMode_Play:
+        if (!r.Desynced && checksum != r.ExpectedChecksum)
+        {
+            r.Desynced = true;
+            r.DesyncTick = r.Tick;
+            fprintf(stderr, "Replay desync at tick %llu\n", (unsigned long long)r.Tick);
+        }
+        break;
+    }
+    r.Tick++;
+}
+
+static void ReplayPrintSummary(replay &r)
+{
+    if (r.Mode == ReplayMode_Play)
+    {
+        if (r.Desynced)
+        {
+            printf("Replay: %llu ticks, desynced at tick %llu\n", (unsigned long long)r.Tick, (unsigned long long)r.DesyncTick);
+        }
+        else
+        {
+            printf("Replay: %llu ticks, in sync\n", (unsigned long long)r.Tick);
+        }
+    }
+    else if (r.Mode == ReplayMode_Record)
+    {
+        printf("Replay: recorded %llu ticks\n", (unsigned long long)r.Tick);
+    }
+}
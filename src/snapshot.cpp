@@ -0,0 +1,546 @@
+// Copyright
+
+#define SNAPSHOT_MAGIC         0x50414e53 // "SNAP"
+#define SNAPSHOT_VERSION       2
+#define SNAPSHOT_MAX_MATERIALS 4
+
+#define SnapshotComponent_Ship          0x1
+#define SnapshotComponent_Collider      0x2
+#define SnapshotComponent_LaneSlot      0x4
+#define SnapshotComponent_Checkpoint    0x8
+#define SnapshotComponent_Asteroid      0x10
+#define SnapshotComponent_Powerup       0x20
+#define SnapshotComponent_FrameRotation 0x40
+#define SnapshotComponent_Finish        0x80
+#define SnapshotComponent_AudioSource   0x100
+#define SnapshotComponent_Explosion     0x200
+
+struct snapshot_header
+{
+    uint32 Magic;
+    uint32 Version;
+    uint32 Size;
+    int NumEntities;
+};
+
+// The part of the state that is copied as a whole
+struct snapshot_state
+{
+    level *Level;
+    random_series GameEntropy;
+    random_series LevelEntropy;
+    gen_state Gen;
+    road_state Road;
+    vec2 BackgroundOffset;
+    float BackgroundTime;
+    float RoadTangentPoint;
+    bool ShouldRoadTangent;
+    bool ShouldSpawnFinish;
+    bool DisableRoadRepeat;
+    bool HasRunStatsScreenCommands;
+    vec3 CameraPosition;
+    vec3 CameraLookAt;
+
+    float PlayerMinVel;
+    float PlayerMaxVel;
+    float TimeElapsed;
+    float DamageTimer;
+    float CurrentDraftTime;
+    float DraftCharge;
+    int Health;
+    int CurrentCheckpointFrame;
+    int CheckpointNum;
+    int ForceShipColor;
+    int NumTrailCollisions;
+    int Score;
+    gameplay_state GameplayState;
+    bool DraftActive;
+
+    // index of the draft target in the entity records, -1 if none
+    int DraftTargetIndex;
+    int NumCheckpoints;
+    int NumRoadPieces;
+};
+
+// Each entity is written as this header followed by the components in
+// the mask and the materials
+struct snapshot_entity
+{
+    transform Transform;
+    mesh *Mesh;
+    entity_type Type;
+    uint32 Flags;
+    uint32 Components;
+    int NumCollisions;
+    int NumMaterials;
+    int NumTrailMaterials;
+};
+
+// Only the gameplay part of a collider, the bounds cache and the sleep
+// state are rebuilt after loading, and the segments of a compound
+// collider belong to its entity
+struct snapshot_collider
+{
+    bounding_box Box;
+    vec3 Scale;
+    collider_type Type;
+    bool Active;
+};
+
+struct snapshot_components
+{
+    ship Ship;
+    snapshot_collider Collider;
+    lane_slot LaneSlot;
+    checkpoint Checkpoint;
+    asteroid Asteroid;
+    powerup Powerup;
+    frame_rotation FrameRotation;
+    finish Finish;
+    explosion Explosion;
+    audio_clip *Clip = NULL;
+    material Materials[SNAPSHOT_MAX_MATERIALS];
+    material TrailMaterials[SNAPSHOT_MAX_MATERIALS];
+};
+
+struct snapshot_road_piece
+{
+    vec3 Position;
+    mesh *Mesh;
+    road_piece Piece;
+};
+
+struct snapshot_reader
+{
+    world_snapshot *Snapshot;
+    size_t Offset = 0;
+};
+
+template<typename T>
+inline static void SnapshotWrite(world_snapshot &snap, const T &value)
+{
+    auto bytes = (const uint8 *)&value;
+    snap.Data.insert(snap.Data.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+inline static void SnapshotRead(snapshot_reader &r, T &value)
+{
+    assert(r.Offset + sizeof(T) <= r.Snapshot->Data.size());
+    memcpy((void *)&value, r.Snapshot->Data.data() + r.Offset, sizeof(T));
+    r.Offset += sizeof(T);
+}
+
+// The lists RemoveGameplayEntities empties and the other pooled entities,
+// random geometry is the only thing with EntityFlag_UpdateMovement
+#define SNAPSHOT_LIST_COUNT 9
+static void GetGameplayEntityLists(entity_world &w, std::vector<entity *> *lists[SNAPSHOT_LIST_COUNT])
+{
+    lists[0] = &w.CheckpointEntities;
+    lists[1] = &w.AsteroidEntities;
+    lists[2] = &w.PowerupEntities;
+    lists[3] = &w.ShipEntities;
+    lists[4] = &w.CrystalEntities;
+    lists[5] = &w.FinishEntities;
+    lists[6] = &w.EnemySkullEntities;
+    lists[7] = &w.ExplosionEntities;
+    lists[8] = &w.MovementEntities;
+}
+
+static void RemoveSnapshotEntities(entity_world &w)
+{
+    std::vector<entity *> *lists[SNAPSHOT_LIST_COUNT];
+    GetGameplayEntityLists(w, lists);
+    for (int i = 0; i < SNAPSHOT_LIST_COUNT; i++)
+    {
+        for (auto ent : *lists[i])
+        {
+            if (!ent) continue;
+            RemoveEntity(w, ent);
+        }
+    }
+}
+
+static void WriteEntity(world_snapshot &snap, entity *ent)
+{
+    snapshot_entity rec;
+    rec.Transform = ent->Transform;
+    rec.Mesh = ent->Model ? ent->Model->Mesh : NULL;
+    rec.Type = ent->Type;
+    rec.Flags = ent->Flags;
+    rec.NumCollisions = ent->NumCollisions;
+    rec.Components = 0;
+    if (ent->Ship)          rec.Components |= SnapshotComponent_Ship;
+    if (ent->Collider)      rec.Components |= SnapshotComponent_Collider;
+    if (ent->LaneSlot)      rec.Components |= SnapshotComponent_LaneSlot;
+    if (ent->Checkpoint)    rec.Components |= SnapshotComponent_Checkpoint;
+    if (ent->Asteroid)      rec.Components |= SnapshotComponent_Asteroid;
+    if (ent->Powerup)       rec.Components |= SnapshotComponent_Powerup;
+    if (ent->FrameRotation) rec.Components |= SnapshotComponent_FrameRotation;
+    if (ent->Finish)        rec.Components |= SnapshotComponent_Finish;
+    if (ent->AudioSource)   rec.Components |= SnapshotComponent_AudioSource;
+    if (ent->Explosion)     rec.Components |= SnapshotComponent_Explosion;
+    rec.NumMaterials = ent->Model ? std::min(int(ent->Model->Materials.size()), SNAPSHOT_MAX_MATERIALS) : 0;
+    rec.NumTrailMaterials = ent->TrailGroup ? std::min(int(ent->TrailGroup->Mesh.Parts.size()), SNAPSHOT_MAX_MATERIALS) : 0;
+    SnapshotWrite(snap, rec);
+
+    if (ent->Ship)          SnapshotWrite(snap, *ent->Ship);
+    if (ent->Collider)
+    {
+        auto col = ent->Collider;
+        snapshot_collider saved = { col->Box, col->Scale, col->Type, col->Active };
+        SnapshotWrite(snap, saved);
+    }
+    if (ent->LaneSlot)      SnapshotWrite(snap, *ent->LaneSlot);
+    if (ent->Checkpoint)    SnapshotWrite(snap, *ent->Checkpoint);
+    if (ent->Asteroid)      SnapshotWrite(snap, *ent->Asteroid);
+    if (ent->Powerup)       SnapshotWrite(snap, *ent->Powerup);
+    if (ent->FrameRotation) SnapshotWrite(snap, *ent->FrameRotation);
+    if (ent->Finish)        SnapshotWrite(snap, *ent->Finish);
+    if (ent->AudioSource)   SnapshotWrite(snap, ent->AudioSource->Clip);
+    if (ent->Explosion)     SnapshotWrite(snap, *ent->Explosion);
+    for (int i = 0; i < rec.NumMaterials; i++)
+    {
+        SnapshotWrite(snap, *ent->Model->Materials[i]);
+    }
+    for (int i = 0; i < rec.NumTrailMaterials; i++)
+    {
+        SnapshotWrite(snap, *ent->TrailGroup->Mesh.Parts[i].Material);
+    }
+}
+
+static void ReadEntity(snapshot_reader &r, snapshot_entity &rec, snapshot_components &comps)
+{
+    SnapshotRead(r, rec);
+    if (rec.Components & SnapshotComponent_Ship)          SnapshotRead(r, comps.Ship);
+    if (rec.Components & SnapshotComponent_Collider)      SnapshotRead(r, comps.Collider);
+    if (rec.Components & SnapshotComponent_LaneSlot)      SnapshotRead(r, comps.LaneSlot);
+    if (rec.Components & SnapshotComponent_Checkpoint)    SnapshotRead(r, comps.Checkpoint);
+    if (rec.Components & SnapshotComponent_Asteroid)      SnapshotRead(r, comps.Asteroid);
+    if (rec.Components & SnapshotComponent_Powerup)       SnapshotRead(r, comps.Powerup);
+    if (rec.Components & SnapshotComponent_FrameRotation) SnapshotRead(r, comps.FrameRotation);
+    if (rec.Components & SnapshotComponent_Finish)        SnapshotRead(r, comps.Finish);
+    if (rec.Components & SnapshotComponent_AudioSource)   SnapshotRead(r, comps.Clip);
+    if (rec.Components & SnapshotComponent_Explosion)     SnapshotRead(r, comps.Explosion);
+    for (int i = 0; i < rec.NumMaterials; i++)
+    {
+        SnapshotRead(r, comps.Materials[i]);
+    }
+    for (int i = 0; i < rec.NumTrailMaterials; i++)
+    {
+        SnapshotRead(r, comps.TrailMaterials[i]);
+    }
+}
+
+// Copies the saved state over an entity that has the same components
+static void ApplyEntityState(entity *ent, snapshot_entity &rec, snapshot_components &comps)
+{
+    ent->Transform = rec.Transform;
+    ent->Flags = rec.Flags;
+    ent->NumCollisions = rec.NumCollisions;
+    if (ent->Ship)          *ent->Ship = comps.Ship;
+    if (ent->Collider)
+    {
+        // the box is where it was saved, it's woken up and its bounds are
+        // rebuilt in the next Integrate
+        auto col = ent->Collider;
+        col->Box = comps.Collider.Box;
+        col->Scale = comps.Collider.Scale;
+        col->Type = comps.Collider.Type;
+        col->Active = comps.Collider.Active;
+        col->LocalBox = bounding_box{};
+        col->BoundsPosition = vec3(0.0f);
+        col->BoundsScale = vec3(0.0f);
+        col->BoundsColliderScale = vec3(0.0f);
+        col->BoundsMesh = NULL;
+        col->StillFrames = 0;
+        col->Sleeping = false;
+        col->Motion = vec3(0.0f);
+    }
+    if (ent->LaneSlot)      *ent->LaneSlot = comps.LaneSlot;
+    if (ent->Checkpoint)    *ent->Checkpoint = comps.Checkpoint;
+    if (ent->Asteroid)      *ent->Asteroid = comps.Asteroid;
+    if (ent->Powerup)       *ent->Powerup = comps.Powerup;
+    if (ent->FrameRotation) *ent->FrameRotation = comps.FrameRotation;
+    if (ent->Finish)        *ent->Finish = comps.Finish;
+    if (ent->Explosion)     *ent->Explosion = comps.Explosion;
+    for (int i = 0; i < rec.NumMaterials && ent->Model && i < int(ent->Model->Materials.size()); i++)
+    {
+        *ent->Model->Materials[i] = comps.Materials[i];
+    }
+    for (int i = 0; i < rec.NumTrailMaterials && ent->TrailGroup && i < int(ent->TrailGroup->Mesh.Parts.size()); i++)
+    {
+        *ent->TrailGroup->Mesh.Parts[i].Material = comps.TrailMaterials[i];
+    }
+}
+
+// The pooled entities own GL buffers and audio sources, so instead of
+// copying their memory back they're created again and get their state
+// copied over
+static entity *CreateSnapshotEntity(game_main *g, snapshot_entity &rec, snapshot_components &comps)
+{
+    auto &w = g->World;
+    switch (rec.Type)
+    {
+    case EntityType_Ship:
+    {
+        auto ent = CreateShipEntity(GetEntry(w.ShipPool), GetShipMesh(w), comps.Ship.Color, comps.Ship.OutlineColor,
+                                    comps.Clip, false, comps.Ship.ColorIndex, comps.LaneSlot.Lane);
+        if (comps.Clip && comps.Ship.ColorIndex == SHIP_RED)
+        {
+            AudioSourceSetPitch(ent->AudioSource, RedShipPitch(comps.LaneSlot.Lane));
+        }
+        return ent;
+    }
+
+    case EntityType_Crystal:
+        return CreateCrystalEntity(GetEntry(w.CrystalPool), g->AssetLoader, GetCrystalMesh(w), comps.LaneSlot.Lane);
+
+    case EntityType_Asteroid:
+        return CreateAsteroidEntity(GetEntry(w.AsteroidPool), GetAsteroidMesh(w));
+
+    case EntityType_Powerup:
+        // the random velocity is overwritten and the entropy restored later
+        return CreatePowerupEntity(GetEntry(w.PowerupPool), g->LevelState.Entropy, comps.Powerup.TimeSpawn,
+                                   rec.Transform.Position, rec.Transform.Velocity, comps.Powerup.Color);
+
+    case EntityType_Checkpoint:
+        return CreateCheckpointEntity(GetEntry(w.CheckpointPool), g->AssetLoader, GetCheckpointMesh(w));
+
+    case EntityType_Finish:
+        return CreateFinishEntity(GetEntry(w.FinishPool), g->AssetLoader, GetFinishMesh(w));
+
+    case EntityType_EnemySkull:
+        return CreateEnemySkullEntity(GetEntry(w.EnemySkullPool), rec.Mesh);
+
+    case EntityType_RandomGeometry:
+        return CreateRandomGeometryEntity(GetEntry(w.RandomGeometryPool), rec.Mesh);
+
+    case EntityType_Explosion:
+        // its particles are gone with the particle system, it only plays
+        // the sound again if it was saved before it started
+        return CreateExplosionEntity(GetEntry(w.ExplosionPool), g->AssetLoader, rec.Transform.Position, rec.Transform.Velocity,
+                                     comps.Explosion.Color, comps.Explosion.Color, vec3(0.0f), comps.LaneSlot.Lane);
+    }
+    return NULL;
+}
+
+void SaveWorldSnapshot(game_main *g, world_snapshot &snap)
+{
+    auto start = benchmark_clock::now();
+    auto &w = g->World;
+    auto l = &g->LevelState;
+
+    // keeps the capacity, saving again doesn't allocate
+    snap.Data.clear();
+    snap.NumEntities = 0;
+
+    snapshot_header header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, 0 };
+    SnapshotWrite(snap, header);
+
+    snapshot_state state;
+    state.Level = l->Level;
+    state.GameEntropy = g->Entropy;
+    state.LevelEntropy = l->Entropy;
+    state.Gen = *w.GenState;
+    state.Road = w.RoadState;
+    state.BackgroundOffset = w.BackgroundState.Offset;
+    state.BackgroundTime = w.BackgroundState.Time;
+    state.RoadTangentPoint = w.RoadTangentPoint;
+    state.ShouldRoadTangent = w.ShouldRoadTangent;
+    state.ShouldSpawnFinish = w.ShouldSpawnFinish;
+    state.DisableRoadRepeat = w.DisableRoadRepeat;
+    state.HasRunStatsScreenCommands = l->Level ? l->Level->HasRunStatsScreenCommands : false;
+    state.CameraPosition = g->Camera.Position;
+    state.CameraLookAt = g->Camera.LookAt;
+    state.PlayerMinVel = l->PlayerMinVel;
+    state.PlayerMaxVel = l->PlayerMaxVel;
+    state.TimeElapsed = l->TimeElapsed;
+    state.DamageTimer = l->DamageTimer;
+    state.CurrentDraftTime = l->CurrentDraftTime;
+    state.DraftCharge = l->DraftCharge;
+    state.Health = l->Health;
+    state.CurrentCheckpointFrame = l->CurrentCheckpointFrame;
+    state.CheckpointNum = l->CheckpointNum;
+    state.ForceShipColor = l->ForceShipColor;
+    state.NumTrailCollisions = l->NumTrailCollisions;
+    state.Score = l->Score;
+    state.GameplayState = l->GameplayState;
+    state.DraftActive = l->DraftActive;
+    state.DraftTargetIndex = -1;
+    state.NumCheckpoints = l->Level ? int(l->Level->Checkpoints.size()) : 0;
+    state.NumRoadPieces = int(w.RoadPieceEntities.size());
+
+    std::vector<entity *> *lists[SNAPSHOT_LIST_COUNT];
+    GetGameplayEntityLists(w, lists);
+    for (int i = 0; i < SNAPSHOT_LIST_COUNT; i++)
+    {
+        for (auto ent : *lists[i])
+        {
+            if (!ent) continue;
+            if (ent == l->DraftTarget)
+            {
+                state.DraftTargetIndex = snap.NumEntities;
+            }
+            snap.NumEntities++;
+        }
+    }
+    SnapshotWrite(snap, state);
+
+    for (int i = 0; i < state.NumCheckpoints; i++)
+    {
+        SnapshotWrite(snap, l->Level->Checkpoints[i].CurrentFrameIndex);
+    }
+    for (auto ent : w.RoadPieceEntities)
+    {
+        snapshot_road_piece piece = {};
+        if (ent)
+        {
+            piece.Position = ent->Pos();
+            piece.Mesh = ent->Model->Mesh;
+            piece.Piece = *ent->RoadPiece;
+        }
+        SnapshotWrite(snap, piece);
+    }
+
+    WriteEntity(snap, w.PlayerEntity);
+    for (int i = 0; i < SNAPSHOT_LIST_COUNT; i++)
+    {
+        for (auto ent : *lists[i])
+        {
+            if (!ent) continue;
+            WriteEntity(snap, ent);
+        }
+    }
+
+    auto headerData = (snapshot_header *)snap.Data.data();
+    headerData->Size = uint32(snap.Data.size());
+    headerData->NumEntities = snap.NumEntities;
+    snap.SaveTime = MillisecondsSince(start);
+}
+
+// Returns false if the snapshot is empty or from another level
+bool LoadWorldSnapshot(game_main *g, world_snapshot &snap)
+{
+    if (IsEmpty(snap))
+    {
+        return false;
+    }
+
+    auto start = benchmark_clock::now();
+    auto &w = g->World;
+    auto l = &g->LevelState;
+    snapshot_reader r;
+    r.Snapshot = &snap;
+
+    snapshot_header header;
+    SnapshotRead(r, header);
+    assert(header.Magic == SNAPSHOT_MAGIC && header.Version == SNAPSHOT_VERSION);
+    assert(header.Size == snap.Data.size());
+
+    snapshot_state state;
+    SnapshotRead(r, state);
+    if (state.Level != l->Level)
+    {
+        return false;
+    }
+
+    RemoveSnapshotEntities(w);
+    ResetParticleSystem(w.Particles);
+
+    for (int i = 0; i < state.NumCheckpoints; i++)
+    {
+        SnapshotRead(r, l->Level->Checkpoints[i].CurrentFrameIndex);
+    }
+    for (int i = 0; i < state.NumRoadPieces; i++)
+    {
+        snapshot_road_piece piece;
+        SnapshotRead(r, piece);
+
+        auto ent = w.RoadPieceEntities[i];
+        if (!ent) continue;
+
+        ent->Pos() = piece.Position;
+        ent->PrevTransform = ent->Transform;
+        ent->Model->Mesh = piece.Mesh;
+        *ent->RoadPiece = piece.Piece;
+        MarkTrackIndexMoved(w.TrackIndex, ent);
+    }
+
+    // the player is never freed, its state is copied in place
+    {
+        snapshot_entity rec;
+        snapshot_components comps;
+        ReadEntity(r, rec, comps);
+
+        auto player = w.PlayerEntity;
+        ApplyEntityState(player, rec, comps);
+        player->PrevTransform = player->Transform;
+
+        // the player is removed from the world on game over
+        if (!player->InWorld)
+        {
+            AddEntity(w, player);
+        }
+        else
+        {
+            MarkTrackIndexMoved(w.TrackIndex, player);
+        }
+        ResetTrailGroup(w, player);
+    }
+
+    l->DraftTarget = NULL;
+    for (int i = 0; i < header.NumEntities; i++)
+    {
+        snapshot_entity rec;
+        snapshot_components comps;
+        ReadEntity(r, rec, comps);
+
+        auto ent = CreateSnapshotEntity(g, rec, comps);
+        if (!ent) continue;
+
+        ApplyEntityState(ent, rec, comps);
+        AddEntity(w, ent);
+        if (i == state.DraftTargetIndex)
+        {
+            l->DraftTarget = ent;
+        }
+    }
+    assert(r.Offset == snap.Data.size());
+
+    g->Entropy = state.GameEntropy;
+    l->Entropy = state.LevelEntropy;
+    *w.GenState = state.Gen;
+    w.RoadState = state.Road;
+    w.BackgroundState.Offset = state.BackgroundOffset;
+    w.BackgroundState.Time = state.BackgroundTime;
+    w.RoadTangentPoint = state.RoadTangentPoint;
+    w.ShouldRoadTangent = state.ShouldRoadTangent;
+    w.ShouldSpawnFinish = state.ShouldSpawnFinish;
+    w.DisableRoadRepeat = state.DisableRoadRepeat;
+    if (l->Level)
+    {
+        l->Level->HasRunStatsScreenCommands = state.HasRunStatsScreenCommands;
+    }
+    g->Camera.Position = g->PrevCameraPosition = state.CameraPosition;
+    g->Camera.LookAt = g->PrevCameraLookAt = state.CameraLookAt;
+    l->PlayerMinVel = state.PlayerMinVel;
+    l->PlayerMaxVel = state.PlayerMaxVel;
+    l->TimeElapsed = state.TimeElapsed;
+    l->DamageTimer = state.DamageTimer;
+    l->CurrentDraftTime = state.CurrentDraftTime;
+    l->DraftCharge = state.DraftCharge;
+    l->Health = state.Health;
+    l->CurrentCheckpointFrame = state.CurrentCheckpointFrame;
+    l->CheckpointNum = state.CheckpointNum;
+    l->ForceShipColor = state.ForceShipColor;
+    l->NumTrailCollisions = state.NumTrailCollisions;
+    l->Score = state.Score;
+    l->GameplayState = state.GameplayState;
+    l->DraftActive = state.DraftActive && l->DraftTarget;
+
+    // the player and the road pieces were moved in place
+    UpdateTrackIndex(w.TrackIndex);
+    snap.LoadTime = MillisecondsSince(start);
+    return true;
+}
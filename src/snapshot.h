@@ -0,0 +1,26 @@
+#ifndef DRAFT_SNAPSHOT_H
+#define DRAFT_SNAPSHOT_H
+
+struct game_main;
+
+// A copy of the gameplay state of the world in a flat binary blob: the
+// random series, the gen state, the level progress and every gameplay
+// entity. Loading it puts the world back in the same state, the blob
+// only holds pointers to assets so it's only valid in the same process.
+struct world_snapshot
+{
+    std::vector<uint8> Data;
+    int NumEntities = 0;
+    double SaveTime = 0;
+    double LoadTime = 0;
+};
+
+inline bool IsEmpty(const world_snapshot &snap)
+{
+    return snap.Data.empty();
+}
+
+void SaveWorldSnapshot(game_main *g, world_snapshot &snap);
+bool LoadWorldSnapshot(game_main *g, world_snapshot &snap);
+
+#endif
@@ -34,9 +34,14 @@ void CreateThreadPool(thread_pool &pool, game_main *game, int MaxThreads, int Jo
 	pool.Threads.resize(MaxThreads);
 }
 
-void AddJob(thread_pool &pool, job_func *func, void *arg)
+// Returns false if the job couldn't be queued, the caller can run it
+bool AddJob(thread_pool &pool, job_func *func, void *arg)
 {
-	bool grow = true;
+	if (pool.Stopped)
+	{
+		return false;
+	}
+
 	for (int i = 0; i < pool.NumThreads; i++)
 	{
 		auto data = &pool.Threads[i];
@@ -49,8 +54,7 @@ void AddJob(thread_pool &pool, job_func *func, void *arg)
 
 			Lock.unlock();
 			data->ConditionVar.notify_one();
-			grow = false;
-			break;
+			return true;
 		}
 		else
 		{
@@ -58,7 +62,7 @@ void AddJob(thread_pool &pool, job_func *func, void *arg)
 		}
 	}
 
-	if (grow && pool.NumThreads < pool.MaxThreads)
+	if (pool.NumThreads < pool.MaxThreads)
 	{
 		pool.NumThreads++;
 		pool.NumJobs++;
@@ -68,12 +72,15 @@ void AddJob(thread_pool &pool, job_func *func, void *arg)
 		data->ID = pool.Threads.size() - 1;
 		data->Pool = &pool;
 		data->Thread = pool.Game->Platform.CreateThread(pool.Game, "ThreadPoolLoop", (void *)data);
+		return true;
 	}
+	return false;
 }
 
 void StopThreadPool(thread_pool &Pool)
 {
     assert(Pool.NumJobs == 0);
+    Pool.Stopped = true;
     for (auto &Data : Pool.Threads)
     {
         std::unique_lock<std::mutex> Lock(Data.Mutex);
@@ -84,6 +91,7 @@ void StopThreadPool(thread_pool &Pool)
 
 void RestartThreadPool(thread_pool &Pool)
 {
+	Pool.Stopped = false;
 	for (auto &Data : Pool.Threads)
 	{
 		Data.Stop = false;
@@ -39,6 +39,7 @@ struct thread_pool
 	  int MaxThreads = 1;
 	  int NumThreads = 0;
     std::atomic_int NumJobs;
+    bool Stopped = false;
 };
 
 #endif
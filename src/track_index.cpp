@@ -0,0 +1,381 @@
+// Copyright
+
+#define TRACK_BUCKET_SIZE ROAD_SEGMENT_SIZE
+#define TRACK_MAX_Y       1.0e9f
+
+// Colliders are indexed by their bounds, so the broadphase sees the
+// same positions the narrowphase tests
+inline static float GetTrackY(entity *ent)
+{
+    if (ent->Collider)
+    {
+        return ent->Collider->Box.Center.y;
+    }
+    return ent->Pos().y;
+}
+
+inline static int GetTrackKey(float y)
+{
+    y = glm::clamp(y, -TRACK_MAX_Y, TRACK_MAX_Y);
+    return int(std::floor(y / TRACK_BUCKET_SIZE));
+}
+
+static bool IsEntityInLane(entity *ent, int lane)
+{
+    if (lane == TRACK_ANY_LANE)
+    {
+        return true;
+    }
+
+    float laneLeft = (lane - 0.5f) * ROAD_LANE_WIDTH;
+    float laneRight = (lane + 0.5f) * ROAD_LANE_WIDTH;
+    if (ent->Collider)
+    {
+        auto &box = ent->Collider->Box;
+        return box.Center.x + box.Half.x > laneLeft && box.Center.x - box.Half.x < laneRight;
+    }
+    return ent->Pos().x >= laneLeft && ent->Pos().x < laneRight;
+}
+
+static void RemoveFromBucket(std::vector<entity *> &bucket, entity *ent)
+{
+    for (size_t i = 0; i < bucket.size(); i++)
+    {
+        if (bucket[i] == ent)
+        {
+            bucket[i] = bucket.back();
+            bucket.pop_back();
+            return;
+        }
+    }
+}
+
+static void RemoveFromBucket(track_index &index, entity *ent)
+{
+    auto it = index.Buckets.find(ent->TrackKey);
+    if (it == index.Buckets.end())
+    {
+        return;
+    }
+
+    RemoveFromBucket(it->second, ent);
+    if (it->second.empty())
+    {
+        index.Buckets.erase(it);
+    }
+}
+
+inline static void UpdateMaxHalfY(track_index &index, entity *ent)
+{
+    if (ent->Collider)
+    {
+        index.MaxHalfY = std::max(index.MaxHalfY, ent->Collider->Box.Half.y);
+    }
+}
+
+void AddToTrackIndex(track_index &index, entity *ent)
+{
+    assert(ent->TrackKey == TRACK_KEY_NONE);
+
+    ent->TrackKey = GetTrackKey(GetTrackY(ent));
+    index.Buckets[ent->TrackKey].push_back(ent);
+    UpdateMaxHalfY(index, ent);
+    index.NumEntities++;
+}
+
+void RemoveFromTrackIndex(track_index &index, entity *ent)
+{
+    if (ent->TrackKey == TRACK_KEY_NONE)
+    {
+        return;
+    }
+
+    // the entity can be freed before the next update
+    auto &moved = index.MovedCache;
+    moved.erase(std::remove(moved.begin(), moved.end(), ent), moved.end());
+    RemoveFromBucket(index, ent);
+    ent->TrackKey = TRACK_KEY_NONE;
+    index.NumEntities--;
+}
+
+void ClearTrackIndex(track_index &index)
+{
+    for (auto &bucket : index.Buckets)
+    {
+        for (auto ent : bucket.second)
+        {
+            ent->TrackKey = TRACK_KEY_NONE;
+        }
+    }
+    index.Buckets.clear();
+    index.MovedCache.clear();
+    index.NumEntities = 0;
+    index.NumMoved = 0;
+    index.MaxHalfY = 0;
+}
+
+// Should be called by anything that changes the track position of an
+// entity (its position, or its box when it has a collider). Not thread
+// safe, the jobs have to leave it to the main thread
+void MarkTrackIndexMoved(track_index &index, entity *ent)
+{
+    if (ent->TrackKey != TRACK_KEY_NONE)
+    {
+        index.MovedCache.push_back(ent);
+    }
+}
+
+void MarkTrackIndexMoved(track_index &index, const std::vector<entity *> &entities)
+{
+    for (auto ent : entities)
+    {
+        if (ent) MarkTrackIndexMoved(index, ent);
+    }
+}
+
+// Moves the marked entities that changed bucket since the last update,
+// an entity marked twice is already in its bucket the second time
+void UpdateTrackIndex(track_index &index)
+{
+    index.NumMoved = 0;
+    for (auto ent : index.MovedCache)
+    {
+        UpdateMaxHalfY(index, ent);
+        int key = GetTrackKey(GetTrackY(ent));
+        if (key != ent->TrackKey)
+        {
+            RemoveFromBucket(index, ent);
+            ent->TrackKey = key;
+            index.Buckets[key].push_back(ent);
+            index.NumMoved++;
+        }
+    }
+    index.MovedCache.clear();
+}
+
+// Collects the entities with track position in [y0, y1] that overlap the
+// given lane (or any lane with TRACK_ANY_LANE), ordered by bucket
+size_t QueryTrackIndex(track_index &index, float y0, float y1, int lane, std::vector<entity *> &result)
+{
+    result.clear();
+    auto it = index.Buckets.lower_bound(GetTrackKey(y0));
+    auto end = index.Buckets.upper_bound(GetTrackKey(y1));
+    for (; it != end; it++)
+    {
+        for (auto ent : it->second)
+        {
+            float y = GetTrackY(ent);
+            if (y >= y0 && y <= y1 && IsEntityInLane(ent, lane))
+            {
+                result.push_back(ent);
+            }
+        }
+    }
+    return result.size();
+}
+
+inline static int GetLaneKey(float y)
+{
+    y = glm::clamp(y, -TRACK_MAX_Y, TRACK_MAX_Y);
+    return int(std::floor(y / LANE_INDEX_BUCKET_SIZE));
+}
+
+inline static int GetLaneBucket(int key)
+{
+    return key & (LANE_INDEX_BUCKETS - 1);
+}
+
+static void AddLaneCount(lane_index &index, int key, int lane)
+{
+    int bucket = GetLaneBucket(key);
+    if (index.Counts[bucket][lane]++ == 0)
+    {
+        index.Occupied[lane] |= (uint64(1) << bucket);
+    }
+}
+
+static void RemoveLaneCount(lane_index &index, int key, int lane)
+{
+    int bucket = GetLaneBucket(key);
+    assert(index.Counts[bucket][lane] > 0);
+    if (--index.Counts[bucket][lane] == 0)
+    {
+        index.Occupied[lane] &= ~(uint64(1) << bucket);
+    }
+}
+
+void AddToLaneIndex(lane_index &index, entity *ent)
+{
+    assert(ent->LaneSlot && ent->LaneKey == TRACK_KEY_NONE);
+
+    ent->LaneKey = GetLaneKey(GetTrackY(ent));
+    AddLaneCount(index, ent->LaneKey, ent->LaneSlot->Index);
+    index.NumEntities++;
+}
+
+void RemoveFromLaneIndex(lane_index &index, entity *ent)
+{
+    if (ent->LaneKey == TRACK_KEY_NONE)
+    {
+        return;
+    }
+
+    RemoveLaneCount(index, ent->LaneKey, ent->LaneSlot->Index);
+    ent->LaneKey = TRACK_KEY_NONE;
+    index.NumEntities--;
+}
+
+void ClearLaneIndex(lane_index &index, std::vector<entity *> &entities)
+{
+    for (auto ent : entities)
+    {
+        if (ent) ent->LaneKey = TRACK_KEY_NONE;
+    }
+    index = lane_index{};
+}
+
+// Moves the entities that changed bucket since the last update
+void UpdateLaneIndex(lane_index &index, std::vector<entity *> &entities)
+{
+    index.NumMoved = 0;
+    for (auto ent : entities)
+    {
+        if (!ent || ent->LaneKey == TRACK_KEY_NONE) continue;
+
+        int key = GetLaneKey(GetTrackY(ent));
+        if (key != ent->LaneKey)
+        {
+            RemoveLaneCount(index, ent->LaneKey, ent->LaneSlot->Index);
+            AddLaneCount(index, key, ent->LaneSlot->Index);
+            ent->LaneKey = key;
+            index.NumMoved++;
+        }
+    }
+}
+
+// The bits of the ring buckets that cover [y0, y1]
+static uint64 GetLaneRangeMask(float y0, float y1)
+{
+    int key0 = GetLaneKey(y0);
+    int key1 = GetLaneKey(y1);
+    if (key1 < key0)
+    {
+        return 0;
+    }
+    if (int64(key1) - key0 + 1 >= LANE_INDEX_BUCKETS)
+    {
+        return ~uint64(0);
+    }
+
+    uint64 mask = (uint64(1) << (key1 - key0 + 1)) - 1;
+    int shift = GetLaneBucket(key0);
+    return (shift == 0) ? mask : ((mask << shift) | (mask >> (LANE_INDEX_BUCKETS - shift)));
+}
+
+// Returns a mask with a bit set for each lane index (0 is the leftmost
+// lane) that has nothing in [y0, y1]
+uint32 GetFreeLanes(lane_index &index, float y0, float y1)
+{
+    uint64 range = GetLaneRangeMask(y0, y1);
+    uint32 result = 0;
+    for (int i = 0; i < LANE_INDEX_LANES; i++)
+    {
+        if ((index.Occupied[i] & range) == 0)
+        {
+            result |= (1 << i);
+        }
+    }
+    return result;
+}
+
+// How many entities are in the lane in [y0, y1], rounded to buckets
+int GetLaneCount(lane_index &index, int laneIndex, float y0, float y1)
+{
+    uint64 range = GetLaneRangeMask(y0, y1) & index.Occupied[laneIndex];
+    int result = 0;
+    for (int i = 0; range != 0; i++, range >>= 1)
+    {
+        if (range & 1)
+        {
+            result += index.Counts[i][laneIndex];
+        }
+    }
+    return result;
+}
+
+// Compares the index against a linear scan of the same entities, the
+// entities move every frame like the game ones do
+void BenchmarkTrackIndex(track_index_benchmark &bench, int numEntities)
+{
+    const int numFrames = 60;
+    const int numQueries = 1000;
+    const float trackLength = numEntities * 2.0f;
+    const float dt = 1.0f / 60.0f;
+
+    random_series series = RandomSeed(numEntities);
+    std::vector<entity> entities(numEntities);
+    for (auto &ent : entities)
+    {
+        ent.Pos().x = RandomBetween(series, -2, 2) * ROAD_LANE_WIDTH;
+        ent.Pos().y = RandomBetween(series, 0.0f, trackLength);
+        ent.Vel().y = RandomBetween(series, -75.0f, 150.0f);
+    }
+
+    track_index index;
+    bench = track_index_benchmark{};
+    bench.NumEntities = numEntities;
+    bench.NumQueries = numQueries;
+
+    auto start = benchmark_clock::now();
+    for (auto &ent : entities)
+    {
+        AddToTrackIndex(index, &ent);
+    }
+    bench.InsertTime = MillisecondsSince(start);
+
+    for (int f = 0; f < numFrames; f++)
+    {
+        for (auto &ent : entities)
+        {
+            ent.Pos() += ent.Vel() * dt;
+        }
+        start = benchmark_clock::now();
+        for (auto &ent : entities)
+        {
+            MarkTrackIndexMoved(index, &ent);
+        }
+        UpdateTrackIndex(index);
+        bench.UpdateTime += MillisecondsSince(start) / numFrames;
+    }
+
+    std::vector<float> queryY(numQueries);
+    std::vector<int> queryLane(numQueries);
+    for (int i = 0; i < numQueries; i++)
+    {
+        queryY[i] = RandomBetween(series, 0.0f, trackLength);
+        queryLane[i] = RandomBetween(series, -2, 2);
+    }
+
+    start = benchmark_clock::now();
+    for (int i = 0; i < numQueries; i++)
+    {
+        bench.QueryHits += QueryTrackIndex(index, queryY[i], queryY[i] + ROAD_SEGMENT_SIZE*2, queryLane[i], index.QueryCache);
+    }
+    bench.QueryTime = MillisecondsSince(start);
+
+    start = benchmark_clock::now();
+    for (int i = 0; i < numQueries; i++)
+    {
+        float y0 = queryY[i];
+        float y1 = queryY[i] + ROAD_SEGMENT_SIZE*2;
+        for (auto &ent : entities)
+        {
+            float y = ent.Pos().y;
+            if (y >= y0 && y <= y1 && IsEntityInLane(&ent, queryLane[i]))
+            {
+                bench.LinearQueryHits++;
+            }
+        }
+    }
+    bench.LinearQueryTime = MillisecondsSince(start);
+}
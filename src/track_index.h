@@ -0,0 +1,71 @@
+#ifndef DRAFT_TRACK_INDEX_H
+#define DRAFT_TRACK_INDEX_H
+
+struct entity;
+
+#define TRACK_KEY_NONE std::numeric_limits<int>::min()
+#define TRACK_ANY_LANE -100
+
+// Entities bucketed by their position along the track (the Y axis),
+// each bucket covers one road segment. The code that moves an entity
+// marks it, and the update only checks the marked ones against the
+// bucket they're stored in.
+struct track_index
+{
+    std::map<int, std::vector<entity *>> Buckets;
+    std::vector<entity *> MovedCache;
+    std::vector<entity *> QueryCache;
+
+    // biggest collider half extent in Y, used to pad broadphase queries,
+    // it only grows until the index is cleared
+    float MaxHalfY = 0;
+    int NumEntities = 0;
+    int NumMoved = 0;
+};
+
+#define LANE_INDEX_LANES        5
+#define LANE_INDEX_BUCKETS      64
+#define LANE_INDEX_BUCKET_SIZE  16.0f
+#define LANE_INDEX_ALL          ((1 << LANE_INDEX_LANES) - 1)
+
+// Which lanes are occupied along the track, for the entities that hold
+// a lane slot. The track is cut in buckets that wrap around a ring, each
+// lane has one bit per bucket, so a range of the track is checked with a
+// mask per lane. Buckets that alias on the ring only make a lane look
+// occupied, never free.
+struct lane_index
+{
+    uint64 Occupied[LANE_INDEX_LANES] = {};
+    uint16 Counts[LANE_INDEX_BUCKETS][LANE_INDEX_LANES] = {};
+    int NumEntities = 0;
+    int NumMoved = 0;
+};
+
+struct track_index_benchmark
+{
+    int NumEntities = 0;
+    int NumQueries = 0;
+    double InsertTime = 0;
+    double UpdateTime = 0;
+    double QueryTime = 0;
+    double LinearQueryTime = 0;
+    size_t QueryHits = 0;
+    size_t LinearQueryHits = 0;
+};
+
+void AddToTrackIndex(track_index &index, entity *ent);
+void RemoveFromTrackIndex(track_index &index, entity *ent);
+void ClearTrackIndex(track_index &index);
+void MarkTrackIndexMoved(track_index &index, entity *ent);
+void MarkTrackIndexMoved(track_index &index, const std::vector<entity *> &entities);
+void UpdateTrackIndex(track_index &index);
+size_t QueryTrackIndex(track_index &index, float y0, float y1, int lane, std::vector<entity *> &result);
+void AddToLaneIndex(lane_index &index, entity *ent);
+void RemoveFromLaneIndex(lane_index &index, entity *ent);
+void ClearLaneIndex(lane_index &index, std::vector<entity *> &entities);
+void UpdateLaneIndex(lane_index &index, std::vector<entity *> &entities);
+uint32 GetFreeLanes(lane_index &index, float y0, float y1);
+int GetLaneCount(lane_index &index, int laneIndex, float y0, float y1);
+void BenchmarkTrackIndex(track_index_benchmark &bench, int numEntities);
+
+#endif
@@ -1,6 +1,70 @@
 #ifndef DRAFT_UBER_SHADER_H
 #define DRAFT_UBER_SHADER_H
 
+// The per-frame constants, shared by every shader that draws the world.
+// It's std140 so it's laid out like frame_uniforms in render.h
+static const char *FrameUniformsSource = R"EOF(
+
+layout (std140) uniform FrameUniforms {
+  mat4  u_ProjectionView;
+  vec4  u_FogColor;
+  vec4  u_ExplosionLightColor;
+  vec3  u_CamPos;
+  float u_FogStart;
+  float u_FogEnd;
+  float u_BendRadius;
+  float u_RoadTangentPoint;
+  float u_ExplosionLightTimer;
+};
+
+)EOF";
+
+// Laid out like material_uniforms in render.h
+static const char *MaterialUniformsSource = R"EOF(
+
+layout (std140) uniform MaterialUniforms {
+  vec4  u_DiffuseColor;
+  vec4  u_SpecularColor;
+  vec4  u_EmissiveColor;
+  vec2  u_UvScale;
+  float u_TexWeight;
+  float u_FogWeight;
+  float u_Emission;
+  float u_Shininess;
+  int   u_MaterialFlags;
+};
+
+)EOF";
+
+// Shared by every vertex shader that draws in the bent world space,
+// goes after FrameUniformsSource
+static const char *BendShaderSource = R"EOF(
+
+vec3 WorldToRenderTransformInner(in vec3 pos) {
+  float d = pos.y*0.005f;
+  float r = u_BendRadius - pos.z;
+  vec3 result = pos;
+  result.y = cos(d) * r;
+  result.z = sin(d) * r;
+  return result;
+}
+
+vec3 WorldToRenderTransform(in vec3 pos) {
+  vec3 worldPos = pos;
+  vec3 tangentWorldPoint = vec3(pos.x, u_RoadTangentPoint, pos.z);
+  vec3 result = WorldToRenderTransformInner(pos);
+
+  if (pos.y >= tangentWorldPoint.y) {
+    vec3 tangentPoint = WorldToRenderTransformInner(tangentWorldPoint);
+    vec3 tangentDir = normalize(vec3( 0, -tangentPoint.z, tangentPoint.y ));
+    result = tangentPoint + (tangentDir * ((pos.y - tangentWorldPoint.y) * (u_BendRadius * 0.005f)));
+  }
+
+  return result;
+}
+
+)EOF";
+
 static const char *UberVertexShaderSource = R"EOF(
 
 #define MaterialFlag_TransformUniform 0x4
@@ -19,12 +83,16 @@ layout (location = A_COLOR) in vec4 a_Color;
 
 layout (location = A_NORMAL) in vec3 a_Normal;
 
-uniform mat4 u_ProjectionView;
+#ifdef INSTANCED
+layout (location = A_INSTANCE_TRANSFORM) in mat4 a_InstanceTransform;
+layout (location = A_INSTANCE_COLOR) in vec4 a_InstanceColor;
+layout (location = A_INSTANCE_EMISSION) in float a_InstanceEmission;
+flat out vec4 v_DiffuseColor;
+flat out float v_Emission;
+#else
 uniform mat4 u_Transform;
+#endif
 uniform mat4 u_NormalTransform;
-uniform int  u_MaterialFlags;
-uniform float u_BendRadius;
-uniform float u_RoadTangentPoint;
 
 #ifdef A_UV
 smooth out vec2 v_Uv;
@@ -37,32 +105,17 @@ smooth out vec4 v_Color;
 smooth out vec3 v_Normal;
 smooth out vec4 v_WorldPos;
 
-vec3 WorldToRenderTransformInner(in vec3 pos) {
-  float d = pos.y*0.005f;
-  float r = u_BendRadius - pos.z;
-  vec3 result = pos;
-  result.y = cos(d) * r;
-  result.z = sin(d) * r;
-  return result;
-}
-
-vec3 WorldToRenderTransform(in vec3 pos) {
-  vec3 worldPos = pos;
-  vec3 tangentWorldPoint = vec3(pos.x, u_RoadTangentPoint, pos.z);
-  vec3 result = WorldToRenderTransformInner(pos);
-
-  if (pos.y >= tangentWorldPoint.y) {
-    vec3 tangentPoint = WorldToRenderTransformInner(tangentWorldPoint);
-    vec3 tangentDir = normalize(vec3( 0, -tangentPoint.z, tangentPoint.y ));
-    result = tangentPoint + (tangentDir * ((pos.y - tangentWorldPoint.y) * (u_BendRadius * 0.005f)));
-  }
-
-  return result;
-}
-
 void main() {
-  mat4 transformMatrix = u_Transform;
-  vec3 transformPos = u_Transform[3].xyz;
+#ifdef INSTANCED
+  mat4 modelTransform = a_InstanceTransform;
+  v_DiffuseColor = a_InstanceColor;
+  v_Emission = a_InstanceEmission;
+#else
+  mat4 modelTransform = u_Transform;
+#endif
+
+  mat4 transformMatrix = modelTransform;
+  vec3 transformPos = modelTransform[3].xyz;
   if ((u_MaterialFlags & MaterialFlag_TransformUniform) > 0)
   {
     transformMatrix[3] = vec4(WorldToRenderTransform(transformPos), 1.0);
@@ -100,20 +153,16 @@ static const char *UberFragmentShaderSource = R"EOF(
 #define M_PI 3.1415926535897932384626433832795
 
 uniform sampler2D u_Sampler;
-uniform vec4 u_DiffuseColor;
-uniform vec4 u_SpecularColor;
-uniform vec4 u_EmissiveColor;
-uniform float u_Emission;
-uniform float u_Shininess;
-uniform float u_TexWeight;
-uniform float u_FogWeight;
-uniform vec2 u_UvScale;
-uniform vec4 u_ExplosionLightColor;
-uniform float u_ExplosionLightTimer;
-uniform vec3 u_CamPos;
-uniform vec4 u_FogColor;
-uniform float u_FogStart;
-uniform float u_FogEnd;
+
+#ifdef INSTANCED
+flat in vec4 v_DiffuseColor;
+flat in float v_Emission;
+#define DIFFUSE_COLOR v_DiffuseColor
+#define EMISSION v_Emission
+#else
+#define DIFFUSE_COLOR u_DiffuseColor
+#define EMISSION u_Emission
+#endif
 
 #ifdef A_UV
 smooth in vec2  v_Uv;
@@ -144,7 +193,7 @@ void main() {
   surfaceColor *= v_Color;
 #endif
 
-    surfaceColor *= u_DiffuseColor;
+    surfaceColor *= DIFFUSE_COLOR;
 
     vec3 ambient = surfaceColor.rgb * AmbientLight;
 
@@ -176,7 +225,7 @@ void main() {
   fog = clamp(fog, 0.0, 1.0);
 
   Color = mix(Color, u_FogColor, (1.0 - fog) * u_FogWeight);
-  vec4 Emit = (u_EmissiveColor * u_Emission);
+  vec4 Emit = (u_EmissiveColor * EMISSION);
   BlendUnitColor[0] = Color;
   BlendUnitColor[1] = Emit;
 }